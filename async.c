@@ -0,0 +1,956 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+// before main.h, winsock.h would hide WSAPoll
+#include <winsock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+#include "main.h"
+#include "common.h"
+#include "latin1.h"
+#include "async.h"
+
+#define ASYNC_IN_SIZE           16384
+#define ASYNC_CONNECT_TIMEOUT   5000 // msecs
+
+#ifdef MSG_NOSIGNAL
+#define ASYNC_SEND_FLAGS MSG_NOSIGNAL // one server going away mustn't take the others down
+#else
+#define ASYNC_SEND_FLAGS 0
+#endif
+
+typedef enum {
+  ASYNC_OP_SQUIRT,
+  ASYNC_OP_SUCK,
+  ASYNC_OP_DIR,
+  ASYNC_OP_CLI,
+  ASYNC_OP_STATUS, // cd, set info and the file operations are answered with just a status
+} async_type_t;
+
+typedef enum {
+  ASYNC_STATE_QUEUED,
+  ASYNC_STATE_SEND,
+  ASYNC_STATE_DATA_OUT,
+  ASYNC_STATE_LENGTH,
+  ASYNC_STATE_MISSING,
+  ASYNC_STATE_PROTECTION,
+  ASYNC_STATE_DATA_IN,
+  ASYNC_STATE_ENTRY,
+  ASYNC_STATE_NAME,
+  ASYNC_STATE_FIELDS,
+  ASYNC_STATE_COMMENT,
+  ASYNC_STATE_OUTPUT,
+  ASYNC_STATE_FILEOP,
+  ASYNC_STATE_STATUS,
+} async_state_t;
+
+typedef struct async_op {
+  async_type_t type;
+  async_state_t state;
+  async_state_t recvState;   // what the reply starts with
+  char* request;
+  size_t requestLength;
+  size_t requestSize;
+  char* filename;            // the local file for SQUIRT, the remote one for SUCK and file operations
+  char* destFilename;
+  uint32_t command;
+  int writeToCurrentDir;
+  int fileFd;
+  uint32_t fileLength;
+  uint32_t total;
+  uint32_t localError;
+  uint32_t protection;
+  int32_t* lengthOut;
+  uint32_t* protectionOut;
+  dir_entry_list_t** listOut;
+  dir_entry_list_t* list;
+  char* entryName;
+  uint32_t entryLength;
+  uint32_t fields[7];
+  int compact;
+  int exitState;
+  void (*output)(void* data, const char* utf8, size_t length);
+  async_done_t done;
+  void* data;
+  struct async_op* next;
+} async_op_t;
+
+struct async_conn {
+  squirt_conn_t session;
+  char* hostname;
+  int connecting;
+  struct timeval deadline;
+  const char* out;
+  size_t outLength;
+  size_t outSent;
+  char in[ASYNC_IN_SIZE];
+  size_t inStart;
+  size_t inEnd;
+  async_op_t* head;
+  async_op_t* tail;
+  async_progress_t progress;
+  struct timeval lastProgress;
+};
+
+struct async_engine {
+  async_conn_t** conns;
+  int count;
+  int size;
+};
+
+
+async_engine_t*
+async_newEngine(void)
+{
+  async_engine_t* engine = calloc(1, sizeof(async_engine_t));
+  if (!engine) {
+    fatalError("malloc failed");
+  }
+  return engine;
+}
+
+
+static void
+async_freeOp(async_op_t* op)
+{
+  if (op->fileFd >= 0) {
+    close(op->fileFd);
+  }
+  if (op->list) {
+    dir_freeEntryList(op->list);
+  }
+  free(op->entryName);
+  free(op->request);
+  free(op->filename);
+  free(op->destFilename);
+  free(op);
+}
+
+
+void
+async_freeEngine(async_engine_t* engine)
+{
+  for (int i = 0; i < engine->count; i++) {
+    async_conn_t* conn = engine->conns[i];
+    while (conn->head) {
+      async_op_t* op = conn->head;
+      conn->head = op->next;
+      async_freeOp(op);
+    }
+    if (conn->session.fd >= 0) {
+      close(conn->session.fd);
+    }
+    free(conn->session.buffer);
+    free(conn->hostname);
+    free(conn);
+  }
+  free(engine->conns);
+  free(engine);
+}
+
+
+async_conn_t*
+async_connect(async_engine_t* engine, const char* hostname)
+{
+  async_conn_t* conn = calloc(1, sizeof(async_conn_t));
+  if (!conn || !(conn->hostname = strdup(hostname))) {
+    fatalError("malloc failed");
+  }
+
+  if (engine->count == engine->size) {
+    engine->size = engine->size ? engine->size * 2 : 8;
+    engine->conns = realloc(engine->conns, sizeof(async_conn_t*) * engine->size);
+    if (!engine->conns) {
+      fatalError("malloc failed");
+    }
+  }
+  engine->conns[engine->count++] = conn;
+
+  conn_attach(&conn->session, util_startConnect(hostname));
+  conn->connecting = 1;
+  gettimeofday(&conn->deadline, NULL);
+  conn->deadline.tv_sec += ASYNC_CONNECT_TIMEOUT / 1000;
+
+  if (conn->session.fd < 0) {
+    conn_fail(&conn->session, ERROR_FATAL_ERROR, "failed to connect to server %s", hostname);
+  }
+#ifdef SO_NOSIGPIPE
+  else {
+    int on = 1;
+    setsockopt(conn->session.fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+  }
+#endif
+
+  return conn;
+}
+
+
+squirt_conn_t*
+async_session(async_conn_t* conn)
+{
+  return &conn->session;
+}
+
+
+void
+async_storeError(async_conn_t* conn, uint32_t error, void* data)
+{
+  (void)conn;
+  *(uint32_t*)data = error;
+}
+
+
+void
+async_setProgress(async_conn_t* conn, async_progress_t progress)
+{
+  conn->progress = progress;
+}
+
+
+static void
+async_put(async_op_t* op, const void* data, size_t length)
+{
+  if (op->requestLength + length > op->requestSize) {
+    while (op->requestLength + length > op->requestSize) {
+      op->requestSize = op->requestSize ? op->requestSize * 2 : 64;
+    }
+    op->request = realloc(op->request, op->requestSize);
+    if (!op->request) {
+      fatalError("malloc failed");
+    }
+  }
+  memcpy(op->request + op->requestLength, data, length);
+  op->requestLength += length;
+}
+
+
+static void
+async_putU32(async_op_t* op, uint32_t value)
+{
+  uint32_t networkValue = htonl(value);
+  async_put(op, &networkValue, sizeof(networkValue));
+}
+
+
+static void
+async_putString(async_op_t* op, const char* str)
+{
+  size_t utf8Length = strlen(str), length;
+
+  // the latin1 form and its terminator are never longer than the UTF-8 with
+  // its own, so room is made for that and it is converted into place
+  async_putU32(op, 0);
+  async_put(op, str, utf8Length+1);
+  char* latin1 = op->request + op->requestLength - (utf8Length+1);
+  latin1_fromUtf8(latin1, &length, str, utf8Length);
+  op->requestLength -= utf8Length+1 - length;
+
+  uint32_t networkLength = htonl(length);
+  memcpy(latin1 - sizeof(networkLength), &networkLength, sizeof(networkLength));
+}
+
+
+static async_op_t*
+async_queue(async_conn_t* conn, async_type_t type, async_state_t recvState, async_done_t done, void* data)
+{
+  async_op_t* op = calloc(1, sizeof(async_op_t));
+  if (!op) {
+    fatalError("malloc failed");
+  }
+
+  op->type = type;
+  op->state = ASYNC_STATE_QUEUED;
+  op->recvState = recvState;
+  op->fileFd = -1;
+  op->done = done;
+  op->data = data;
+
+  if (conn->tail) {
+    conn->tail->next = op;
+  } else {
+    conn->head = op;
+  }
+  conn->tail = op;
+
+  return op;
+}
+
+
+static char*
+async_strdup(const char* str)
+{
+  char* copy = str ? strdup(str) : 0;
+  if (str && !copy) {
+    fatalError("malloc failed");
+  }
+  return copy;
+}
+
+
+void
+async_squirt(async_conn_t* conn, const char* filename, const char* destFilename, int writeToCurrentDir, async_done_t done, void* data)
+{
+  // the length is only known once the file is opened, so the request is built then
+  async_op_t* op = async_queue(conn, ASYNC_OP_SQUIRT, ASYNC_STATE_STATUS, done, data);
+  op->filename = async_strdup(filename);
+  op->destFilename = async_strdup(destFilename);
+  op->writeToCurrentDir = writeToCurrentDir;
+}
+
+
+void
+async_suck(async_conn_t* conn, const char* filename, const char* destFilename, int32_t* length, uint32_t* protection, async_done_t done, void* data)
+{
+  async_op_t* op = async_queue(conn, ASYNC_OP_SUCK, ASYNC_STATE_LENGTH, done, data);
+  op->filename = async_strdup(filename);
+  op->destFilename = async_strdup(destFilename);
+  op->lengthOut = length;
+  op->protectionOut = protection;
+  async_putU32(op, SQUIRT_COMMAND_SUCK);
+  async_putString(op, filename);
+}
+
+
+void
+async_dir(async_conn_t* conn, const char* dir, dir_entry_list_t** list, async_done_t done, void* data)
+{
+  async_op_t* op = async_queue(conn, ASYNC_OP_DIR, ASYNC_STATE_ENTRY, done, data);
+  op->listOut = list;
+  async_putU32(op, SQUIRT_COMMAND_DIR);
+  async_putString(op, dir);
+}
+
+
+void
+async_cli(async_conn_t* conn, const char* command, void (*output)(void* data, const char* utf8, size_t length), async_done_t done, void* data)
+{
+  async_op_t* op = async_queue(conn, ASYNC_OP_CLI, ASYNC_STATE_OUTPUT, done, data);
+  op->output = output;
+  async_putU32(op, SQUIRT_COMMAND_CLI);
+  async_putString(op, command);
+}
+
+
+void
+async_cd(async_conn_t* conn, const char* dir, async_done_t done, void* data)
+{
+  async_op_t* op = async_queue(conn, ASYNC_OP_STATUS, ASYNC_STATE_STATUS, done, data);
+  async_putU32(op, SQUIRT_COMMAND_CD);
+  async_putString(op, dir);
+}
+
+
+void
+async_setInfo(async_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, async_done_t done, void* data)
+{
+  async_op_t* op = async_queue(conn, ASYNC_OP_STATUS, ASYNC_STATE_STATUS, done, data);
+  size_t length;
+  uint32_t error;
+
+  char* request = protect_encodeFileInfo(filename, protection, dateStamp, 0, &length, &error);
+  if (!request) {
+    op->localError = error;
+    return;
+  }
+
+  async_put(op, request, length);
+  free(request);
+}
+
+
+void
+async_fileOp(async_conn_t* conn, uint32_t command, const char* name, const char* dest, async_done_t done, void* data)
+{
+  // the destination waits until the server has said it knows the command
+  async_op_t* op = async_queue(conn, ASYNC_OP_STATUS, ASYNC_STATE_FILEOP, done, data);
+  op->command = command;
+  op->filename = async_strdup(name);
+  op->destFilename = async_strdup(dest);
+  async_putU32(op, command);
+  async_putString(op, name);
+}
+
+
+static void
+async_progress(async_conn_t* conn, async_op_t* op, int final)
+{
+  if (conn->progress && (final || util_progressDue(&conn->lastProgress))) {
+    conn->progress(op->filename, &conn->session.start, op->total, op->fileLength);
+    if (final) {
+      fflush(stdout);
+    }
+  }
+}
+
+
+// Transfers are drawn once with nothing sent as they start, then as they go,
+// then once finished unless they were empty
+static void
+async_startTransfer(async_conn_t* conn, async_op_t* op)
+{
+  gettimeofday(&conn->session.start, NULL);
+  conn->lastProgress.tv_sec = conn->lastProgress.tv_usec = 0;
+  async_progress(conn, op, 1);
+}
+
+
+static void
+async_finish(async_conn_t* conn, uint32_t error)
+{
+  async_op_t* op = conn->head;
+
+  conn->head = op->next;
+  if (!conn->head) {
+    conn->tail = 0;
+  }
+
+  if (op->type == ASYNC_OP_SUCK) {
+    if (op->lengthOut) {
+      *op->lengthOut = op->state == ASYNC_STATE_MISSING ? -1 : (int32_t)op->total;
+    }
+    if (op->protectionOut) {
+      *op->protectionOut = op->protection;
+    }
+  } else if (op->type == ASYNC_OP_DIR && op->listOut) {
+    *op->listOut = error ? 0 : op->list;
+    if (!error) {
+      op->list = 0;
+    }
+  }
+
+  // the callback may queue more work on this connection
+  if (op->done) {
+    op->done(conn, error, op->data);
+  }
+  async_freeOp(op);
+}
+
+
+static void
+async_fail(async_conn_t* conn)
+{
+  if (conn->session.fd >= 0) {
+    close(conn->session.fd);
+    conn->session.fd = -1;
+  }
+  conn->out = 0;
+
+  while (conn->head) {
+    async_finish(conn, conn->session.error);
+  }
+}
+
+
+static void
+async_startOp(async_conn_t* conn)
+{
+  async_op_t* op = conn->head;
+
+  if (op->localError) {
+    async_finish(conn, op->localError);
+    return;
+  }
+
+  if (op->type == ASYNC_OP_SQUIRT) {
+    struct stat st;
+    op->fileFd = util_open(op->filename, O_RDONLY|_O_BINARY);
+    if (op->fileFd < 0 || fstat(op->fileFd, &st) != 0 || !conn_buffer(&conn->session)) {
+      async_finish(conn, conn->session.error ? conn->session.error : ERROR_FILE_READ_FAILED);
+      return;
+    }
+    op->fileLength = st.st_size;
+    async_putU32(op, op->writeToCurrentDir ? SQUIRT_COMMAND_SQUIRT_TO_CWD : SQUIRT_COMMAND_SQUIRT);
+    async_putString(op, op->destFilename ? op->destFilename : util_amigaBaseName(op->filename));
+    async_putU32(op, op->fileLength);
+  }
+
+  op->state = ASYNC_STATE_SEND;
+  conn->out = op->request;
+  conn->outLength = op->requestLength;
+  conn->outSent = 0;
+}
+
+
+static void
+async_discardOutput(void* data, const char* utf8, size_t length)
+{
+  (void)data, (void)utf8, (void)length;
+}
+
+
+// The reply to the name of a file operation. A server without the command has
+// sent its status instead, the AmigaDOS command is run in its place.
+static void
+async_fileOpReply(async_conn_t* conn, async_op_t* op, uint32_t reply)
+{
+  op->requestLength = 0;
+
+  if (reply == SQUIRT_FILEOP_REPLY) {
+    if (!op->destFilename) {
+      op->state = ASYNC_STATE_STATUS;
+      return;
+    }
+    async_putString(op, op->destFilename);
+    op->recvState = ASYNC_STATE_STATUS;
+  } else {
+    char* dosCommand = fileop_dosCommand(op->command, op->filename, op->destFilename);
+    async_putU32(op, SQUIRT_COMMAND_CLI);
+    async_putString(op, dosCommand);
+    free(dosCommand);
+    op->type = ASYNC_OP_CLI;
+    op->output = async_discardOutput;
+    op->recvState = ASYNC_STATE_OUTPUT;
+  }
+
+  op->state = ASYNC_STATE_SEND;
+  conn->out = op->request;
+  conn->outLength = op->requestLength;
+  conn->outSent = 0;
+}
+
+
+static void
+async_sent(async_conn_t* conn)
+{
+  async_op_t* op = conn->head;
+  conn->out = 0;
+
+  if (op->type != ASYNC_OP_SQUIRT) {
+    op->state = op->recvState;
+    return;
+  }
+
+  if (op->state == ASYNC_STATE_SEND) {
+    op->state = ASYNC_STATE_DATA_OUT;
+    async_startTransfer(conn, op);
+  }
+
+  if (op->total == op->fileLength) {
+    if (op->fileLength) {
+      async_progress(conn, op, 1);
+    }
+    op->state = ASYNC_STATE_STATUS;
+    return;
+  }
+
+  // the server is already waiting for the data, so a short read leaves the connection unusable
+  int len = read(op->fileFd, conn->session.buffer, BLOCK_SIZE);
+  if (len <= 0) {
+    conn_fail(&conn->session, ERROR_FILE_READ_FAILED, "failed to read %s", op->filename);
+    return;
+  }
+  if ((uint32_t)len > op->fileLength - op->total) {
+    len = op->fileLength - op->total;
+  }
+
+  op->total += len;
+  conn->out = conn->session.buffer;
+  conn->outLength = len;
+  conn->outSent = 0;
+
+  if (op->total < op->fileLength) {
+    async_progress(conn, op, 0);
+  }
+}
+
+
+static int
+async_wouldBlock(void)
+{
+#ifdef _WIN32
+  int error = WSAGetLastError();
+  return error == WSAEWOULDBLOCK || error == WSAEINTR;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+
+static void
+async_write(async_conn_t* conn)
+{
+  while (!conn->session.error && conn->out) {
+    int sent = send(conn->session.fd, conn->out + conn->outSent, conn->outLength - conn->outSent, ASYNC_SEND_FLAGS);
+    if (sent < 0) {
+      if (!async_wouldBlock()) {
+	conn_fail(&conn->session, ERROR_FATAL_SEND_FAILED, "send failed: %s", strerror(errno));
+      }
+      return;
+    }
+    conn->outSent += sent;
+    if (conn->outSent == conn->outLength) {
+      async_sent(conn);
+    }
+  }
+}
+
+
+// "length" bytes of the reply, or 0 if they haven't all arrived yet
+static const char*
+async_take(async_conn_t* conn, size_t length)
+{
+  if (length > ASYNC_IN_SIZE/2) {
+    conn_fail(&conn->session, ERROR_FATAL_RECV_FAILED, "reply item of %u bytes is too long", (unsigned)length);
+    return 0;
+  }
+
+  if (conn->inEnd - conn->inStart < length) {
+    return 0;
+  }
+
+  const char* ptr = conn->in + conn->inStart;
+  conn->inStart += length;
+  return ptr;
+}
+
+
+static uint32_t
+async_u32(const char* ptr)
+{
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return ntohl(value);
+}
+
+
+static char*
+async_utf8(async_conn_t* conn, const char* latin1, size_t length)
+{
+  char* utf8 = malloc(length*2+1);
+  if (!utf8) {
+    conn_fail(&conn->session, ERROR_FATAL_ERROR, "malloc failed");
+    return 0;
+  }
+  latin1_toUtf8(utf8, latin1, length);
+  return utf8;
+}
+
+
+static void
+async_openSuckFile(async_conn_t* conn, async_op_t* op)
+{
+  const char* baseName = op->destFilename ? op->destFilename : util_amigaBaseName(op->filename);
+
+  // Use util_safeName to handle Windows reserved filenames
+  char* safeBaseName = util_safeName(baseName);
+  if (safeBaseName) {
+    op->fileFd = open(safeBaseName, O_WRONLY|O_CREAT|O_TRUNC|_O_BINARY, 0777);
+    free(safeBaseName);
+  }
+
+  // the data still has to be read to keep the connection in step
+  if (op->fileFd < 0) {
+    op->localError = ERROR_FATAL_CREATE_FILE_FAILED;
+  }
+
+  async_startTransfer(conn, op);
+}
+
+
+static void
+async_output(async_conn_t* conn, async_op_t* op)
+{
+  char utf8[1024*2+1];
+  const char* run = conn->in + conn->inStart;
+  size_t runLength = 0;
+
+  // runs of text are converted in one go, the exit sequence is four nul bytes
+  while (conn->inStart < conn->inEnd && op->state == ASYNC_STATE_OUTPUT) {
+    uint8_t c = conn->in[conn->inStart++];
+    if (c != 0 && c != 0x9B && ++runLength < 1024) {
+      continue;
+    }
+    if (runLength) {
+      op->output(op->data, utf8, latin1_toUtf8(utf8, run, runLength));
+    }
+    run = conn->in + conn->inStart;
+    runLength = 0;
+    if (c == 0x9B) {
+      op->output(op->data, "\x1b[", 2);
+    } else if (c == 0 && ++op->exitState == 4) {
+      op->state = ASYNC_STATE_STATUS;
+    }
+  }
+
+  if (runLength) {
+    op->output(op->data, utf8, latin1_toUtf8(utf8, run, runLength));
+  }
+}
+
+
+// Consumes as much of the received data as the current operations can use
+static void
+async_parse(async_conn_t* conn)
+{
+  const char* ptr;
+  async_op_t* op;
+
+  // the states before ASYNC_STATE_LENGTH are still sending
+  while (!conn->session.error && (op = conn->head) && op->state >= ASYNC_STATE_LENGTH) {
+    switch (op->state) {
+    case ASYNC_STATE_LENGTH:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      op->fileLength = async_u32(ptr);
+      op->state = op->fileLength == 0xFFFFFFFF ? ASYNC_STATE_MISSING : ASYNC_STATE_PROTECTION;
+      break;
+    case ASYNC_STATE_MISSING:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      async_finish(conn, async_u32(ptr));
+      break;
+    case ASYNC_STATE_PROTECTION:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      op->protection = async_u32(ptr);
+      async_openSuckFile(conn, op);
+      op->state = op->fileLength ? ASYNC_STATE_DATA_IN : ASYNC_STATE_STATUS;
+      break;
+    case ASYNC_STATE_DATA_IN:
+      {
+	size_t length = conn->inEnd - conn->inStart;
+	if (length == 0) {
+	  return;
+	}
+	if (length > op->fileLength - op->total) {
+	  length = op->fileLength - op->total;
+	}
+	if (op->fileFd >= 0 && write(op->fileFd, conn->in + conn->inStart, length) != (int)length) {
+	  close(op->fileFd);
+	  op->fileFd = -1;
+	  op->localError = ERROR_FATAL_FILE_WRITE_FAILED;
+	}
+	conn->inStart += length;
+	op->total += length;
+	if (op->total == op->fileLength) {
+	  async_progress(conn, op, 1);
+	  op->state = ASYNC_STATE_STATUS;
+	} else {
+	  async_progress(conn, op, 0);
+	}
+      }
+      break;
+    case ASYNC_STATE_ENTRY:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      op->entryLength = async_u32(ptr);
+      if (!op->list) {
+	op->list = dir_newEntryList();
+      }
+      if (op->entryLength == 0xFFFFFFFF) {
+	op->state = ASYNC_STATE_STATUS;
+      } else {
+	op->compact = (op->entryLength & SQUIRT_DIR_COMPACT_ENTRY) != 0;
+	op->entryLength &= ~SQUIRT_DIR_COMPACT_ENTRY;
+	op->state = ASYNC_STATE_NAME;
+      }
+      break;
+    case ASYNC_STATE_NAME:
+      if (!(ptr = async_take(conn, op->entryLength)) || !(op->entryName = async_utf8(conn, ptr, op->entryLength))) {
+	return;
+      }
+      if (op->compact) {
+	dir_pushDirEntry(op->list, op->entryName, 0, 0, 0, 0, 0, 0, 0);
+	op->entryName = 0;
+	op->state = ASYNC_STATE_ENTRY;
+      } else {
+	op->state = ASYNC_STATE_FIELDS;
+      }
+      break;
+    case ASYNC_STATE_FIELDS:
+      if (!(ptr = async_take(conn, sizeof(op->fields)))) {
+	return;
+      }
+      for (int i = 0; i < countof(op->fields); i++) {
+	op->fields[i] = async_u32(ptr + i*4);
+      }
+      op->state = ASYNC_STATE_COMMENT;
+      break;
+    case ASYNC_STATE_COMMENT:
+      {
+	// type, size, protection, days, mins, ticks and the comment length
+	uint32_t* f = op->fields;
+	char* comment = 0;
+	if (f[6] > 0 && (!(ptr = async_take(conn, f[6])) || !(comment = async_utf8(conn, ptr, f[6])))) {
+	  return;
+	}
+	dir_pushDirEntry(op->list, op->entryName, (int32_t)f[0], f[1], f[2], f[3], f[4], f[5], comment);
+	op->entryName = 0;
+	op->state = ASYNC_STATE_ENTRY;
+      }
+      break;
+    case ASYNC_STATE_OUTPUT:
+      async_output(conn, op);
+      if (op->state == ASYNC_STATE_OUTPUT) {
+	return;
+      }
+      break;
+    case ASYNC_STATE_FILEOP:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      async_fileOpReply(conn, op, async_u32(ptr));
+      break;
+    case ASYNC_STATE_STATUS:
+      if (!(ptr = async_take(conn, 4))) {
+	return;
+      }
+      {
+	uint32_t error = async_u32(ptr);
+	async_finish(conn, error ? error : op->localError);
+      }
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+
+static void
+async_read(async_conn_t* conn)
+{
+  if (conn->inStart == conn->inEnd) {
+    conn->inStart = conn->inEnd = 0;
+  } else if (conn->inStart > ASYNC_IN_SIZE/2 || conn->inEnd == ASYNC_IN_SIZE) {
+    memmove(conn->in, conn->in + conn->inStart, conn->inEnd - conn->inStart);
+    conn->inEnd -= conn->inStart;
+    conn->inStart = 0;
+  }
+
+  int got = recv(conn->session.fd, conn->in + conn->inEnd, ASYNC_IN_SIZE - conn->inEnd, 0);
+  if (got > 0) {
+    conn->inEnd += got;
+    async_parse(conn);
+  } else if (got == 0) {
+    conn_fail(&conn->session, ERROR_FATAL_RECV_FAILED, "connection closed by Amiga server");
+  } else if (!async_wouldBlock()) {
+    conn_fail(&conn->session, ERROR_FATAL_RECV_FAILED, "network error: %s", strerror(errno));
+  }
+}
+
+
+static void
+async_connected(async_conn_t* conn)
+{
+  conn->connecting = 0;
+  if (util_connectResult(conn->session.fd) != 0) {
+    conn_fail(&conn->session, ERROR_FATAL_ERROR, "failed to connect to server %s", conn->hostname);
+  }
+}
+
+
+static long
+async_msecsUntil(struct timeval* deadline)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  long msecs = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_usec - now.tv_usec) / 1000;
+  return msecs < 0 ? 0 : msecs;
+}
+
+
+int
+async_run(async_engine_t* engine)
+{
+  struct pollfd* fds = 0;
+  int fdsSize = 0;
+
+  for (;;) {
+    int active = 0;
+    long timeout = -1;
+
+    // connections are looked up by index as callbacks may add more, any added
+    // during this pass are polled on the next one
+    int polled = engine->count;
+    if (fdsSize < polled) {
+      fdsSize = polled;
+      fds = realloc(fds, sizeof(struct pollfd) * fdsSize);
+      if (!fds) {
+	fatalError("malloc failed");
+      }
+    }
+
+    for (int i = 0; i < polled; i++) {
+      async_conn_t* conn = engine->conns[i];
+      fds[i].fd = -1;
+      fds[i].revents = 0;
+
+      while (!conn->session.error && !conn->connecting && conn->head && conn->head->state == ASYNC_STATE_QUEUED) {
+	async_startOp(conn);
+      }
+
+      if (conn->session.error) {
+	async_fail(conn);
+	continue;
+      }
+
+      if (!conn->head) {
+	continue;
+      }
+
+      fds[i].fd = conn->session.fd;
+      fds[i].events = conn->connecting || conn->out ? POLLOUT : POLLIN;
+      active++;
+
+      if (conn->connecting) {
+	long msecs = async_msecsUntil(&conn->deadline);
+	if (timeout < 0 || msecs < timeout) {
+	  timeout = msecs;
+	}
+      }
+    }
+
+    if (active == 0) {
+      if (polled == engine->count) {
+	break;
+      }
+      continue;
+    }
+
+    if (poll(fds, polled, timeout) < 0 && !async_wouldBlock()) {
+      fatalError("poll failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < polled; i++) {
+      async_conn_t* conn = engine->conns[i];
+      if (fds[i].fd < 0) {
+	continue;
+      }
+
+      if (conn->connecting) {
+	if (fds[i].revents) {
+	  async_connected(conn);
+	} else if (async_msecsUntil(&conn->deadline) == 0) {
+	  conn_fail(&conn->session, ERROR_FATAL_ERROR, "failed to connect to server %s", conn->hostname);
+	}
+      } else if (fds[i].revents & POLLOUT) {
+	async_write(conn);
+      } else if (fds[i].revents) {
+	async_read(conn);
+      }
+    }
+  }
+
+  free(fds);
+
+  int failed = 0;
+  for (int i = 0; i < engine->count; i++) {
+    failed += engine->conns[i]->session.error != 0;
+  }
+  return failed;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "conn.h"
+#include "dir.h"
+
+// Drives any number of squirtd sessions from one thread. Each connection runs
+// its queued operations in order, the connections run side by side, and all of
+// the waiting happens in async_run.
+
+typedef struct async_engine async_engine_t;
+typedef struct async_conn async_conn_t;
+
+// Called once an operation has finished. "error" is the remote status, or the
+// connection's error if it failed, conn_errorString(async_session(conn)) says why.
+// A failed connection finishes everything still queued on it the same way.
+typedef void (*async_done_t)(async_conn_t* conn, uint32_t error, void* data);
+
+// An async_done_t that stores "error" in the uint32_t "data" points to
+void
+async_storeError(async_conn_t* conn, uint32_t error, void* data);
+
+typedef void (*async_progress_t)(const char* name, struct timeval* start, uint32_t total, uint32_t fileLength);
+
+async_engine_t*
+async_newEngine(void);
+
+// Closes every connection, operations still queued are dropped without callbacks
+void
+async_freeEngine(async_engine_t* engine);
+
+// Starts connecting to "hostname", operations can be queued straight away
+async_conn_t*
+async_connect(async_engine_t* engine, const char* hostname);
+
+// The connection's state, its error is set once it has failed
+squirt_conn_t*
+async_session(async_conn_t* conn);
+
+// Draws the progress of the connection's transfers, at most 10 times a second.
+// Each transfer is drawn with a total of 0 as it starts, and with its full
+// length once it has finished unless it is empty.
+void
+async_setProgress(async_conn_t* conn, async_progress_t progress);
+
+// Runs until every queued operation has finished. Returns the number of
+// connections that failed.
+int
+async_run(async_engine_t* engine);
+
+// Sends the local file "filename" as "destFilename", or under its own name if
+// that is 0. Fails with ERROR_FILE_READ_FAILED if the file can't be read.
+void
+async_squirt(async_conn_t* conn, const char* filename, const char* destFilename, int writeToCurrentDir, async_done_t done, void* data);
+
+// Fetches "filename" into the local file "destFilename", or into the current
+// directory under its own name if that is 0. "length" is -1 if the remote file
+// doesn't exist. Either may be 0.
+void
+async_suck(async_conn_t* conn, const char* filename, const char* destFilename, int32_t* length, uint32_t* protection, async_done_t done, void* data);
+
+// "list" is set to the listing, or 0 if it failed
+void
+async_dir(async_conn_t* conn, const char* dir, dir_entry_list_t** list, async_done_t done, void* data);
+
+// Runs "command", its output is handed to "output" as it arrives, converted to UTF-8
+void
+async_cli(async_conn_t* conn, const char* command, void (*output)(void* data, const char* utf8, size_t length), async_done_t done, void* data);
+
+void
+async_cd(async_conn_t* conn, const char* dir, async_done_t done, void* data);
+
+// Leaves the remote comment unchanged, setting one needs the server's support
+// negotiated first, which protect_fileWithComment does
+void
+async_setInfo(async_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, async_done_t done, void* data);
+
+// One of the native makedir, delete, rename and copy commands, "dest" is 0
+// unless it is a rename or copy
+void
+async_fileOp(async_conn_t* conn, uint32_t command, const char* name, const char* dest, async_done_t done, void* data);
@@ -10,30 +10,47 @@
 #include <limits.h>
 #include <getopt.h>
 #include <sys/stat.h>
-#include <dirent.h>
 
 #include "main.h"
 #include "common.h"
 #include "exall.h"
-#include "crc32.h"
+
+#define BACKUP_JOURNAL_FILENAME ".__squirt_journal"
+#define BACKUP_JOURNAL_BUCKETS  4096
+
+typedef struct backup_journal_entry {
+  char* path;
+  char type;
+  uint32_t size;
+  dir_datestamp_t ds;
+  struct backup_journal_entry* next;
+} backup_journal_entry_t;
 
 static void
 backup_backupDir(const char* dir);
-static int
-backup_removeDirectoryRecursive(const char* dirname);
 
-static char* backup_currentDir = 0;
+static char backup_currentDir[PATH_MAX];
+static int backup_dirFd = -1;
 static char* backup_skipFile = 0;
 static char* backup_dirBuffer = 0;
 static int backup_prune = 0;
 static int backup_crcVerify = 0;
+static int backup_resume = 0;
+static FILE* backup_journalFp = 0;
+static char* backup_journalPath = 0;
+static backup_journal_entry_t** backup_journal = 0;
+static dir_manifest_t* backup_manifest = 0;
+static dir_manifest_t* backup_manifestTail = 0;
+static dir_manifest_t* backup_manifestNext = 0;
 
 void
 backup_cleanup(void)
 {
-  if (backup_currentDir) {
-    free(backup_currentDir);
-    backup_currentDir = 0;
+  backup_currentDir[0] = 0;
+
+  if (backup_dirFd >= 0) {
+    util_dirClose(backup_dirFd);
+    backup_dirFd = -1;
   }
 
   if (backup_skipFile) {
@@ -45,70 +62,172 @@ backup_cleanup(void)
     free(backup_dirBuffer);
     backup_dirBuffer = 0;
   }
+
+  if (backup_journalFp) {
+    fclose(backup_journalFp);
+    backup_journalFp = 0;
+  }
+
+  if (backup_journalPath) {
+    free(backup_journalPath);
+    backup_journalPath = 0;
+  }
+
+  if (backup_journal) {
+    for (int i = 0; i < BACKUP_JOURNAL_BUCKETS; i++) {
+      backup_journal_entry_t* ptr = backup_journal[i];
+      while (ptr) {
+	backup_journal_entry_t* save = ptr;
+	ptr = ptr->next;
+	free(save->path);
+	free(save);
+      }
+    }
+    free(backup_journal);
+    backup_journal = 0;
+  }
+
+  if (backup_manifest) {
+    dir_freeManifest(backup_manifest);
+    backup_manifest = backup_manifestTail = backup_manifestNext = 0;
+  }
 }
 
 
-static char*
-backup_fullPath(const char* name)
+static uint32_t
+backup_journalHash(const char* path)
 {
-  if (!backup_currentDir) {
-    return strdup(name);
+  uint32_t hash = 5381;
+  while (*path) {
+    hash = (hash * 33) ^ (uint8_t)*path++;
   }
+  return hash % BACKUP_JOURNAL_BUCKETS;
+}
+
 
-  char* path = malloc(strlen(backup_currentDir) + strlen(name) + 2);
-  if (!path) {
-    return NULL;
+static void
+backup_loadJournal(void)
+{
+  backup_journal = calloc(BACKUP_JOURNAL_BUCKETS, sizeof(backup_journal_entry_t*));
+  if (!backup_journal) {
+    fatalError("malloc failed");
   }
-  if (backup_currentDir[strlen(backup_currentDir)-1] != ':') {
-    sprintf(path, "%s/%s", backup_currentDir, name);
-  } else {
-    sprintf(path, "%s%s", backup_currentDir, name);
+
+  FILE* fp = fopen(backup_journalPath, "r");
+  if (!fp) {
+    return;
+  }
+
+  int count = 0;
+  char line[PATH_MAX+64];
+  while (fgets(line, sizeof(line), fp)) {
+    char type;
+    uint32_t size, days, mins, ticks;
+    int pathOffset = 0;
+    line[strcspn(line, "\n")] = 0;
+    if (sscanf(line, "%c %u %u %u %u %n", &type, &size, &days, &mins, &ticks, &pathOffset) != 5 || pathOffset == 0) {
+      // a crash can leave a partial last line, just ignore it
+      continue;
+    }
+
+    backup_journal_entry_t* entry = calloc(1, sizeof(backup_journal_entry_t));
+    if (!entry || !(entry->path = strdup(&line[pathOffset]))) {
+      fatalError("malloc failed");
+    }
+    entry->type = type;
+    entry->size = size;
+    entry->ds.days = days;
+    entry->ds.mins = mins;
+    entry->ds.ticks = ticks;
+
+    uint32_t hash = backup_journalHash(entry->path);
+    entry->next = backup_journal[hash];
+    backup_journal[hash] = entry;
+    count++;
+  }
+
+  fclose(fp);
+
+  printf("resuming backup, %s entries already completed\n", util_formatNumber(count));
+}
+
+
+static void
+backup_openJournal(void)
+{
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    fatalError("getcwd failed");
+  }
+
+  backup_journalPath = malloc(strlen(cwd) + strlen(BACKUP_JOURNAL_FILENAME) + 2);
+  if (!backup_journalPath) {
+    fatalError("malloc failed");
+  }
+  sprintf(backup_journalPath, "%s/%s", cwd, BACKUP_JOURNAL_FILENAME);
+
+  if (backup_resume) {
+    backup_loadJournal();
+  }
+
+  backup_journalFp = fopen(backup_journalPath, backup_resume ? "a" : "w");
+  if (!backup_journalFp) {
+    fatalError("failed to open journal %s", BACKUP_JOURNAL_FILENAME);
   }
-  return path;
 }
 
-// Helper function to recursively remove a directory and all its contents
+
 static int
-backup_removeDirectoryRecursive(const char* dirname)
+backup_journalCompleted(char type, const char* path, dir_entry_t* entry)
 {
-  DIR* dir;
-  struct dirent* entry;
-  char path[PATH_MAX];
-  
-  // Open the directory
-  dir = opendir(dirname);
-  if (dir == NULL) {
-    return -1;
+  if (!backup_journal) {
+    return 0;
   }
-  
-  // Iterate over all entries in the directory
-  while ((entry = readdir(dir)) != NULL) {
-    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-      snprintf(path, PATH_MAX, "%s/%s", dirname, entry->d_name);
-      
-      struct stat st;
-      if (stat(path, &st) == 0) {
-        if (S_ISDIR(st.st_mode)) {
-          // Recursively remove subdirectory
-          if (backup_removeDirectoryRecursive(path) != 0) {
-            closedir(dir);
-            return -1;
-          }
-        } else {
-          // Remove file
-          if (unlink(path) != 0) {
-            closedir(dir);
-            return -1;
-          }
-        }
-      }
+
+  backup_journal_entry_t* ptr = backup_journal[backup_journalHash(path)];
+  while (ptr) {
+    if (ptr->type == type && strcmp(ptr->path, path) == 0) {
+      return
+	(type == 'D' || ptr->size == entry->size) &&
+	ptr->ds.days == entry->ds.days &&
+	ptr->ds.mins == entry->ds.mins &&
+	ptr->ds.ticks == entry->ds.ticks;
     }
+    ptr = ptr->next;
   }
-  
-  closedir(dir);
-  
-  // Remove the now empty directory
-  return rmdir(dirname);
+
+  return 0;
+}
+
+
+static void
+backup_journalComplete(char type, const char* path, dir_entry_t* entry)
+{
+  if (backup_journalFp) {
+    fprintf(backup_journalFp, "%c %u %u %u %u %s\n", type, type == 'D' ? 0 : entry->size, entry->ds.days, entry->ds.mins, entry->ds.ticks, path);
+    fflush(backup_journalFp);
+  }
+}
+
+
+static const char*
+backup_fullPath(char* path, size_t size, const char* name)
+{
+  int length;
+
+  if (!backup_currentDir[0]) {
+    length = snprintf(path, size, "%s", name);
+  } else if (backup_currentDir[strlen(backup_currentDir)-1] != ':') {
+    length = snprintf(path, size, "%s/%s", backup_currentDir, name);
+  } else {
+    length = snprintf(path, size, "%s%s", backup_currentDir, name);
+  }
+
+  if (length < 0 || (size_t)length >= size) {
+    fatalError("path too long %s", name);
+  }
+
+  return path;
 }
 
 static void
@@ -143,214 +262,170 @@ backup_pruneFiles(const char* filename, void* data)
   if (!found) {
     char exFilename[PATH_MAX];
     snprintf(exFilename, sizeof(exFilename), "%s%s", SQUIRT_EXALL_INFO_DIR_NAME, filename);
-    char* path = backup_fullPath(filename);
-    printf("%c[31m%s \xF0\x9F\x92\x80\xF0\x9F\x92\x80\xF0\x9F\x92\x80 REMOVED \xF0\x9F\x92\x80\xF0\x9F\x92\x80\xF0\x9F\x92\x80%c[0m\n", 27, path, 27); // red, utf-8 skulls
-    free(path);
+    char path[PATH_MAX];
+    printf("%c[31m%s \xF0\x9F\x92\x80\xF0\x9F\x92\x80\xF0\x9F\x92\x80 REMOVED \xF0\x9F\x92\x80\xF0\x9F\x92\x80\xF0\x9F\x92\x80%c[0m\n", 27, backup_fullPath(path, sizeof(path), filename), 27); // red, utf-8 skulls
     
-    struct stat st;
-    if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
-      // It's a directory, use recursive removal
-      if (backup_removeDirectoryRecursive(filename) != 0) {
-        fatalError("failed to remove directory %s\n", filename);
-      }
-    } else {
-      // It's a file, use unlink
-      if (unlink(filename) != 0) {
-        fatalError("failed to remove file %s\n", filename);
-      }
+    // directories go with everything in them
+    if (util_dirRemove(backup_dirFd, filename) != 0) {
+      fatalError("failed to remove %s\n", filename);
     }
     
     // Also remove the exall info file
-    if (unlink(exFilename) != 0 && errno != ENOENT) {
+    if (util_dirRemove(backup_dirFd, exFilename) != 0 && errno != ENOENT) {
       // Only error if file exists but couldn't be removed
       fatalError("failed to remove %s\n", exFilename);
     }
   }
 }
 
-uint32_t
-backup_doCrcVerify(const char* path)
+static int
+backup_skip(const char* path)
 {
-  uint32_t error = 0;
-  uint32_t crc;
-  const char* basename = util_amigaBaseName(path);
-  
-  // Use util_safeName to handle Windows reserved filenames
-  char* safeBaseName = util_safeName(basename);
-  if (!safeBaseName) {
-    fatalError("memory allocation failed for safe filename");
-  }
-  
-  // Check if the local file exists
-  FILE* fp = fopen(safeBaseName, "rb");
-  if (!fp) {
-    //printf("\xE2\x9D\x8C Downloaded file not found: %s\n", path); // Red X mark
-    free(safeBaseName);
-    return 2;  // Return code 2 means file not found
+  int skipFile = 0;
+  if (backup_skipFile) {
+    char* found = strstr(backup_skipFile, path);
+    if (found) {
+      found += strlen(path);
+      skipFile = *found == 0 || *found == '\n' || *found == '\r';
+    }
   }
-  fclose(fp);
-  
-  if (crc32_sum(safeBaseName, &crc) != 0) {
-    printf("\xE2\x9D\x8C crc32 failed for %s!\n", basename); // Red X mark
-    free(safeBaseName);
-    fatalError("crc32 failed for %s", basename);
+  return skipFile;
+}
+
+
+static void
+backup_saveFile(const char* path, dir_entry_t* entry)
+{
+  uint32_t protect;
+  uint64_t fileStart = report_start();
+
+  char updateMessage[PATH_MAX];
+  snprintf(updateMessage, sizeof(updateMessage), "%s saving...", path);
+
+  if (squirt_suckFile(path, updateMessage, restore_printProgress, backup_dirFd, 0, &protect) < 0) {
+    /*
+      FILE* fp = fopen("skip-entry", "wb+");
+      fprintf(fp, "%s\n", path);
+      fclose(fp);
+    */
+    fatalError("failed to backup %s", path);
   }
-  
-  free(safeBaseName);
-  
-  char buffer[PATH_MAX];
-  snprintf(buffer, sizeof(buffer), "ssum \"%s\"", path);
+  report_phase(REPORT_PHASE_TRANSFER, fileStart);
+
+  uint64_t start = report_start();
+  exall_saveExAllData(backup_dirFd, entry, path);
+  report_phase(REPORT_PHASE_METADATA, start);
+  report_files(REPORT_FILES_TRANSFERRED, entry->size);
+  report_file(path, fileStart);
+
+#ifndef _WIN32
+  printf("\r%c[K", 27);
+#else
+  printf("\r");
+#endif
+  printf("\xE2\x9C\x85 %s saving...done  \n", path); // utf-8 tick
   fflush(stdout);
-  
-  char* result = util_execCapture(buffer);
-  if (!result) {
-    printf("\xE2\x9D\x8C remote crc32 failed for %s!\n", basename); // Red X mark
-    fatalError("remote crc32 failed for %s", basename);
-  }
-  
-  // Remove trailing newline if present
-  char* newline = strchr(result, '\n');
-  if (newline) *newline = '\0';
-  
-  snprintf(buffer, sizeof(buffer), "%x", crc);
-  if (strcasecmp(buffer, result) != 0) {
-    //     fatalError("crc32 verify failed for %s (%s,%s)", path, buffer, result);
-    printf("\xE2\x9D\x8C CRC doesn't match! %s\n", path); // Red X mark
-    error = 1;
-  }
-  
-  free(result);
-  return error;
 }
 
+
+static void
+backup_redoFile(const char* localName, const char* remotePath, void* data)
+{
+  (void)localName;
+  backup_saveFile(remotePath, data);
+}
+
+
 static void
 backup_backupList(dir_entry_list_t* list)
 {
   dir_entry_t* entry = list->head;
+  verify_batch_t* batch = backup_crcVerify ? verify_newBatch() : 0;
 
   while (entry) {
     if (entry->type < 0) {
-      const char* path = backup_fullPath(entry->name);
-      int skipFile = 0;
-      if (backup_skipFile) {
-	char* found = strstr(backup_skipFile, path);
-	if (found) {
-	  found += strlen(path);
-	  skipFile = *found == 0 || *found == '\n' || *found == '\r';
-	}
+      char pathBuffer[PATH_MAX];
+      const char* path = backup_fullPath(pathBuffer, sizeof(pathBuffer), entry->name);
+      int skipFile = backup_skip(path);
+      if (!skipFile && backup_journalCompleted('F', path, entry)) {
+	printf("\xE2\x9C\x85 %s (resumed)\n", path); // utf-8 tick
+	report_files(REPORT_FILES_SKIPPED, entry->size);
+	entry = entry->next;
+	continue;
       }
+
       int skip = skipFile;
-      int skipReason = 0; // 0=no skip, 1=metadata identical, 2=CRC32 verified identical
 
       if (!skipFile) {
 	dir_entry_t *temp = dir_newDirEntry();
 	struct stat st;
-	if (stat(util_amigaBaseName(path), &st) == 0) {
+	if (util_dirStat(backup_dirFd, util_amigaBaseName(path), &st) == 0) {
 	  if (st.st_size == (off_t)entry->size) {
-	    skip = exall_readExAllData(temp, path);
+	    skip = exall_readExAllData(backup_dirFd, temp, path);
 	    if (skip) {
 	      skip = exall_identicalExAllData(temp, entry);
-	      if (skip) {
-	        skipReason = 1; // Skip due to metadata identical
-	      }
 	    }
 	  }
 	}
 	dir_freeEntry(temp);
-
-	if (backup_crcVerify) {
-	  int crcResult = backup_doCrcVerify(path);
-	  if (crcResult == 1) {
-	    // CRC mismatch, don't skip the download
-	    skip = 0;
-	    skipReason = 0;
-	  } else if (crcResult == 0 && skip) {
-	    // CRC matches and file was going to be skipped - update reason
-	    skipReason = 2; // Skip due to CRC32 verification passed
-	  }
-	  // If crcResult == 2, file doesn't exist yet, we'll verify after download
-	}
       }
 
       if (skip) {
 	if (skipFile) {
 	  printf("\xF0\x9F\x9A\xAB %c[1m%s \xE2\x80\x94\xE2\x80\x94\xE2\x80\x94SKIPPED\xE2\x80\x94\xE2\x80\x94\xE2\x80\x94 %c[0m\n", 27, path, 27); // utf-8 no entry bold
-	} else if (skipReason == 2) {
-	  printf("\xE2\x9C\x85 %s (CRC verified - no change)\n", path); // utf-8 tick with CRC verification message
 	} else {
 	  printf("\xE2\x9C\x85 %s\n", path); // utf-8 tick
 	}
+	report_files(REPORT_FILES_SKIPPED, entry->size);
       } else {
-	uint32_t protect;
-
-	char updateMessage[PATH_MAX];
-	snprintf(updateMessage, sizeof(updateMessage), "%s saving...", path);
-
-	if (squirt_suckFile(path, updateMessage, restore_printProgress, 0, &protect) < 0) {
-	  /*
-	    FILE* fp = fopen("skip-entry", "wb+");
-	    fprintf(fp, "%s\n", path);
-	    fclose(fp);
-	  */
-	    fatalError("failed to backup %s", path);
-	}
-	exall_saveExAllData(entry, path);
-
-	if (backup_crcVerify) {
-	  // Always perform CRC check after download
-	  int crcResult = backup_doCrcVerify(path);
-	  if (crcResult == 1) {
-	    // Don't clear the line when showing errors
-	    printf("\xE2\x9D\x8C CRC32 verification failed for %s!\n", path); // Red X mark
-	    fatalError("CRC32 verification failed for %s", path);
-	  } else if (crcResult == 2) {
-	    // This shouldn't happen after download, but just in case
-	    printf("\xE2\x9D\x8C Downloaded file not found: %s!\n", path); // Red X mark
-	    fatalError("CRC32 verification failed - downloaded file not found: %s", path);
+	backup_saveFile(path, entry);
+      }
+
+      if (!skipFile) {
+	if (batch) {
+	  // hashed in the background, a mismatch is downloaded again in verify_reconcile
+	  char* safeBaseName = util_safeName(entry->name);
+	  if (!safeBaseName) {
+	    fatalError("memory allocation failed for safe filename");
 	  }
-	  
-	  // Only clear the line and show success message if verification succeeded
-#ifndef _WIN32
-	  printf("\r%c[K", 27);
-#else
-	  printf("\r");
-#endif
-	  printf("\xE2\x9C\x85 %s saving...done (CRC OK)\n", path); // utf-8 tick with CRC verification
+	  verify_queue(batch, backup_dirFd, safeBaseName, path, entry);
+	  free(safeBaseName);
 	} else {
-	  // No CRC verification, just show completion message
-#ifndef _WIN32
-	  printf("\r%c[K", 27);
-#else
-	  printf("\r");
-#endif
-	  printf("\xE2\x9C\x85 %s saving...done  \n", path); // utf-8 tick
+	  backup_journalComplete('F', path, entry);
 	}
-	fflush(stdout);
       }
-      free((void*)path);
     }
     entry = entry->next;
   }
 
+  if (batch) {
+    verify_reconcile(batch, backup_redoFile);
+
+    for (entry = list->head; entry; entry = entry->next) {
+      char pathBuffer[PATH_MAX];
+      const char* path = backup_fullPath(pathBuffer, sizeof(pathBuffer), entry->name);
+      if (entry->type < 0 && !backup_skip(path)) {
+	backup_journalComplete('F', path, entry);
+      }
+    }
+  }
+
   entry = list->head;
   while (entry) {
     if (entry->type > 0) {
-      const char* path = backup_fullPath(entry->name);
-      int skipFile = 0;
-      if (backup_skipFile) {
-	char* found = strstr(backup_skipFile, path);
-	if (found) {
-	  found += strlen(path);
-	  skipFile = *found == 0 || *found == '\n' || *found == '\r';
-	}
-      }
+      char pathBuffer[PATH_MAX];
+      const char* path = backup_fullPath(pathBuffer, sizeof(pathBuffer), entry->name);
+      int skipFile = backup_skip(path);
       if (!skipFile) {
-	backup_backupDir(entry->name);
-	exall_saveExAllData(entry, path);
-	free((void*)path);
+	if (backup_journalCompleted('D', path, entry)) {
+	  printf("\xE2\x9C\x85 %s (resumed)\n", path); // utf-8 tick
+	} else {
+	  backup_backupDir(entry->name);
+	  exall_saveExAllData(backup_dirFd, entry, path);
+	  backup_journalComplete('D', path, entry);
+	}
       } else {
 	  printf("\xF0\x9F\x9A\xAB %c[1m%s \xE2\x80\x94\xE2\x80\x94\xE2\x80\x94SKIPPED\xE2\x80\x94\xE2\x80\x94\xE2\x80\x94 %c[0m\n", 27, path, 27); // utf-8 no entry bold
-	free((void*)path);
       }
 
     }
@@ -358,54 +433,42 @@ backup_backupList(dir_entry_list_t* list)
   }
 
   if (backup_prune) {
-    util_dirOperation(".", backup_pruneFiles, list);
+    util_dirOperationAt(backup_dirFd, ".", backup_pruneFiles, list);
   }
 }
 
 
-static char*
+static int
 backup_pushDir(const char* dir)
 {
-  if (backup_currentDir) {
-    char* newDir = backup_fullPath(dir);
-    if (backup_currentDir) {
-      free(backup_currentDir);
-    }
-    backup_currentDir = newDir;
-  } else {
-    backup_currentDir = malloc(strlen(dir)+1);
-    strcpy(backup_currentDir, dir);
-  }
+  char path[PATH_MAX];
+  strcpy(backup_currentDir, backup_fullPath(path, sizeof(path), dir));
 
+  uint64_t start = report_start();
   if (util_cd(backup_currentDir) != 0) {
     fatalError("unable to backup %s", backup_currentDir);
   }
+  report_phase(REPORT_PHASE_ROUNDTRIP, start);
 
   char* safe = util_safeName(dir);
   if (!safe) {
     fatalError("failed to create safe name");
   }
 
-  int mkdirResult = util_mkdir(safe, 0777);
-
-  if (mkdirResult != 0 && errno != EEXIST) {
-    fatalError("failed to mkdir %s", safe);
-  }
-
-  char* cwd = getcwd(0, 0);
-
-  if (chdir(safe) == -1) {
-    fatalError("unable to chdir to %s", safe);
+  int parentFd = backup_dirFd;
+  backup_dirFd = util_dirPush(parentFd, safe, 1);
+  if (backup_dirFd < 0) {
+    fatalError("unable to create/open %s", safe);
   }
 
   free(safe);
 
-  return cwd;
+  return parentFd;
 }
 
 
 static void
-backup_popDir(char* cwd)
+backup_popDir(int parentFd)
 {
   for (int i = strlen(backup_currentDir)-1; i >= 0; --i) {
     if (backup_currentDir[i] == '/' || (i > 0 && backup_currentDir[i-1] == ':')) {
@@ -414,23 +477,137 @@ backup_popDir(char* cwd)
     }
   }
 
-  if (chdir(cwd)) {
-    fatalError("failed to cd to %s", cwd);
+  if (util_dirPop(backup_dirFd, parentFd) != 0) {
+    fatalError("failed to return to parent of %s", backup_currentDir);
+  }
+  backup_dirFd = parentFd;
+}
+
+
+typedef struct {
+  int dirFd;
+  dir_entry_list_t* list;
+} backup_known_t;
+
+
+static void
+backup_addKnownEntry(const char* filename, void* data)
+{
+  if (strcmp(filename, ".") == 0 ||
+      strcmp(filename, "..") == 0) {
+    return;
+  }
+
+  backup_known_t* known = data;
+  dir_entry_t* entry = dir_newDirEntry();
+  if (!entry) {
+    fatalError("malloc failed");
+  }
+
+  if (!exall_readExAllData(known->dirFd, entry, filename) || !entry->name) {
+    dir_freeEntry(entry);
+    return;
+  }
+
+  dir_entry_list_t* list = known->list;
+  if (list->tail == 0) {
+    list->head = list->tail = entry;
+  } else {
+    list->tail->next = entry;
+    list->tail = entry;
+  }
+}
+
+
+// the metadata saved by the last backup of the directory "dirFd"
+static dir_entry_list_t*
+backup_readKnown(int dirFd)
+{
+  backup_known_t known = {dirFd, calloc(1, sizeof(dir_entry_list_t))};
+  if (!known.list) {
+    fatalError("malloc failed");
+  }
+
+  util_dirOperationAt(dirFd, SQUIRT_EXALL_INFO_DIR, backup_addKnownEntry, &known);
+  return known.list;
+}
+
+
+// the metadata saved by the last backup of every directory already on disk is
+// sent as one manifest, so squirtd only lists what changed
+static void
+backup_collectManifest(int parentFd, const char* path, const char* name)
+{
+  if (backup_skip(path)) {
+    return;
+  }
+
+  char* safe = util_safeName(name);
+  if (!safe) {
+    fatalError("failed to create safe name");
+  }
+
+  int dirFd = util_dirPush(parentFd, safe, 0);
+  free(safe);
+  if (dirFd < 0) {
+    return;
+  }
+
+  dir_entry_list_t* known = backup_readKnown(dirFd);
+  dir_addManifest(&backup_manifestTail, path, known);
+  if (!backup_manifest) {
+    backup_manifest = backup_manifestTail;
+  }
+
+  for (dir_entry_t* entry = known->head; entry; entry = entry->next) {
+    if (entry->type > 0) {
+      char childPath[PATH_MAX];
+      int length = snprintf(childPath, sizeof(childPath), path[strlen(path)-1] == ':' ? "%s%s" : "%s/%s", path, entry->name);
+      if (length < 0 || (size_t)length >= sizeof(childPath)) {
+	fatalError("path too long %s", entry->name);
+      }
+      backup_collectManifest(dirFd, childPath, entry->name);
+    }
+  }
+
+  if (util_dirPop(dirFd, parentFd) != 0) {
+    fatalError("failed to return to parent of %s", path);
   }
-  free((void*)cwd);
 }
 
 
 static void
 backup_backupDir(const char* dir)
 {
-  char* cwd = backup_pushDir(dir);
+  uint64_t dirStart = report_dirBegin();
+  int parentFd = backup_pushDir(dir);
   printf("\xE2\x9C\x85 %s\n", backup_currentDir); // utf-8 tick
-  if (dir_process(backup_currentDir, backup_backupList) != 0) {
+
+  dir_entry_list_t* list = 0;
+  dir_manifest_t* manifest = dir_findManifest(backup_manifest, backup_manifestNext, backup_currentDir);
+  if (manifest) {
+    list = manifest->remote;
+    manifest->remote = 0;
+    backup_manifestNext = manifest->next;
+  } else {
+    // the metadata saved by the last backup lets squirtd skip unchanged entries
+    dir_entry_list_t* known = backup_readKnown(backup_dirFd);
+
+    uint64_t start = report_start();
+    list = dir_readChanged(backup_currentDir, 0, known);
+    report_phase(REPORT_PHASE_LIST, start);
+    dir_freeEntryList(known);
+  }
+
+  if (!list) {
     fatalError("unable to read %s", dir);
   }
 
-  backup_popDir(cwd);
+  backup_backupList(list);
+  dir_freeEntryList(list);
+
+  report_dirEnd(backup_currentDir, dirStart);
+  backup_popDir(parentFd);
 }
 
 
@@ -469,7 +646,7 @@ backup_loadSkipFile(const char* filename, int ignoreErrors)
 _Noreturn static void
 backup_usage(void)
 {
-  fatalError("invalid arguments\nusage: %s [--crc32] [--prune] [--skipfile=skipfile] hostname dir_name", main_argv0);
+  fatalError("invalid arguments\nusage: %s [--crc32] [--prune] [--resume] [--skipfile=skipfile] [--report=json[:filename]] hostname dir_name\n--crc32 waits for each directory's remote ssum before the next directory", main_argv0);
 }
 
 
@@ -477,7 +654,7 @@ void
 backup_main(int argc, char* argv[])
 {
   backup_skipFile = 0;
-  backup_currentDir = 0;
+  backup_currentDir[0] = 0;
   const char* hostname = 0;
   char* path = 0;
   char* skipfile = 0;
@@ -488,7 +665,9 @@ backup_main(int argc, char* argv[])
       {
        {"prune",    no_argument, &backup_prune, 'p'},
        {"crc32",    no_argument, &backup_crcVerify, 'c'},
+       {"resume",   no_argument, &backup_resume, 'r'},
        {"skipfile", required_argument, 0, 's'},
+       {"report",   required_argument, 0, 'j'},
        {0, 0, 0, 0}
       };
     int option_index = 0;
@@ -504,6 +683,12 @@ backup_main(int argc, char* argv[])
 	}
 	skipfile = optarg;
 	break;
+      case 'j':
+	if (optarg == 0 || strlen(optarg) == 0) {
+	  backup_usage();
+	}
+	report_enable(optarg);
+	break;
       case '?':
       default:
 	backup_usage();
@@ -530,8 +715,15 @@ backup_main(int argc, char* argv[])
     backup_skipFile = backup_loadSkipFile(".skip", 1);
   }
 
+  backup_openJournal();
+
   util_connect(hostname);
 
+  backup_dirFd = util_dirOpenCwd();
+  if (backup_dirFd < 0) {
+    fatalError("unable to open current directory");
+  }
+
   char* token = strtok(path, ":");
   char* dir = 0;
   if (token) {
@@ -543,12 +735,12 @@ backup_main(int argc, char* argv[])
 	fatalError("malloc failed");
       }
       sprintf(backup_dirBuffer, "%s:", dir);
-      free(backup_pushDir(backup_dirBuffer));
+      util_dirClose(backup_pushDir(backup_dirBuffer));
       do {
 	dir = token;
 	token = strtok(0, "/");
 	if (token) {
-	  free(backup_pushDir(dir));
+	  util_dirClose(backup_pushDir(dir));
 	}
       } while (token);
     } else {
@@ -562,6 +754,14 @@ backup_main(int argc, char* argv[])
   }
 
   if (dir) {
+    char rootPath[PATH_MAX];
+    backup_collectManifest(backup_dirFd, backup_fullPath(rootPath, sizeof(rootPath), dir), dir);
+    if (backup_manifest) {
+      uint64_t start = report_start();
+      dir_readManifest(backup_manifest);
+      report_phase(REPORT_PHASE_LIST, start);
+    }
+
     backup_backupDir(dir);
     
     // Change back to parent directory to release lock on last backed up directory
@@ -584,5 +784,12 @@ backup_main(int argc, char* argv[])
     }
   }
 
+  if (backup_journalFp) {
+    fclose(backup_journalFp);
+    backup_journalFp = 0;
+  }
+  unlink(backup_journalPath);
+
   printf("\nbackup complete!\n");
+  report_write("backup");
 }
@@ -8,8 +8,5 @@ backup_loadSkipFile(const char* filename, int ignoreErrors);
 void
 backup_main(int argc, char* argv[]);
 
-uint32_t
-backup_doCrcVerify(const char* path);
-
 void
 backup_cleanup(void);
@@ -10,6 +10,7 @@
 #include <time.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "main.h"
 #include "common.h"
@@ -19,23 +20,36 @@
 
 typedef struct hostfile {
   char* localFilename;
-  char* backupFilename;
   char** argv;
   char* remoteFilename;
+  char* path;
+  char* comment;
+  int exists;
+  int isDirectory;
+  uint32_t error;         // why it couldn't be fetched or written back
+  struct hostfile* same;  // earlier argument naming the same remote file
   struct hostfile* next;
-  dir_datestamp_t dateStamp;
   uint32_t remoteProtection;
 } cli_hostfile_t;
 
+#define CLI_MAX_TRANSFERS 4
+
 // Forward declarations
 static int cli_isLocalFileArgumentForExecution(const char* arg);
 static char* cli_expandLocalPath(const char* path);
 
 static char* cli_currentDir = 0;
 static dir_entry_list_t *cli_dirEntryList = 0;
+static complete_index_t* cli_completeIndex = 0;
 static char* cli_readLineBase = 0;
 static char* cli_reconstructedText = 0;
 static int cli_isLocalCompletion = 0;  // Flag for local filesystem completion
+static int cli_hasDosList = 0;
+static int cli_cwdStale = 1;
+static char* cli_hostname = 0;
+static pthread_mutex_t cli_transferMutex = PTHREAD_MUTEX_INITIALIZER;
+static cli_hostfile_t* cli_transferNext = 0;
+static uint32_t (*cli_transferFunction)(squirt_conn_t* conn, cli_hostfile_t* file) = 0;
 
 void
 cli_cleanup(void)
@@ -71,166 +85,175 @@ cli_changeDir(const char* dir)
 }
 
 
-static const char*
-cli_prompt(void)
+// Remote paths relative to the cwd made absolute, so completion listings and
+// cached files can be keyed by them
+static void
+cli_absolutePath(char* buffer, size_t size, const char* path)
 {
-  static char buffer[256];
-  snprintf(buffer, sizeof(buffer), "1.%s> ", cli_currentDir);
-  return buffer;
+  if (strchr(path, ':') || !cli_currentDir) {
+    snprintf(buffer, size, "%s", path);
+  } else {
+    snprintf(buffer, size, "%s", cli_currentDir);
+    // each leading slash is the parent directory
+    while (*path == '/') {
+      char* separator = strrchr(buffer, '/');
+      if (separator) {
+	*separator = 0;
+      } else if ((separator = strchr(buffer, ':'))) {
+	separator[1] = 0;
+      }
+      path++;
+    }
+    int length = strlen(buffer);
+    if (*path) {
+      snprintf(buffer+length, size-length, "%s%s", length && buffer[length-1] != ':' ? "/" : "", path);
+    }
+  }
+
+  int length = strlen(buffer);
+  if (length > 1 && buffer[length-1] == '/' && buffer[length-2] != '/' && buffer[length-2] != ':') {
+    buffer[length-1] = 0;
+  }
 }
 
 
+// the cd reply carries the new cwd, so the prompt is kept without asking again
 static int
-cli_compareFile(const char* one, const char* two)
+cli_cd(const char* dir)
 {
-  int identical = 1, fd1 = -1, fd2 = -1;
-
-  if (one == NULL && two == NULL) {
-    identical = 1;
-    goto cleanup;
-  }
-
-  if (one) {
-    fd1 = open(one, O_RDONLY|_O_BINARY);
-  }
+  char* cwd;
+  int error = cwd_change(dir, &cwd);
 
-  if (two) {
-    fd2 = open(two, O_RDONLY|_O_BINARY);
+  if (error == 0) {
+    if (cwd) {
+      cli_changeDir(cwd);
+      free(cwd);
+    } else {
+      cli_cwdStale = 1;
+    }
   }
 
-  if (fd1 == -1 && fd2 == -1) {
-    identical = 1;
-    goto cleanup;
-  } else if (fd1 == -1 || fd2 == -1) {
-    identical = 0;
-    goto cleanup;
-  }
+  return error;
+}
 
-  unsigned char c1, c2;
-  int r1, r2;
-  do {
-    r1 = read(fd1, &c1, sizeof(c1));
-    r2 = read(fd2, &c2, sizeof(c2));
-    if (r1 != r2 || c1 != c2) {
-      identical = 0;
-      goto cleanup;
-    }
-  } while (r1 && r2);
 
- cleanup:
+static const char*
+cli_prompt(void)
+{
+  static char buffer[256];
+  snprintf(buffer, sizeof(buffer), "1.%s> ", cli_currentDir);
+  return buffer;
+}
 
-  if (fd1 >= 0) {
-    close(fd1);
-  }
 
-  if (fd2 >= 0) {
-    close(fd2);
+static void
+cli_freeHostFile(cli_hostfile_t* file)
+{
+  if (file) {
+    // the local copy stays in the host cache
+    if (file->localFilename) {
+      free(file->localFilename);
+    }
+    if (file->remoteFilename) {
+      free(file->remoteFilename);
+    }
+    if (file->path) {
+      free(file->path);
+    }
+    if (file->comment) {
+      free(file->comment);
+    }
+    free(file);
   }
-
-  return identical;
 }
 
 
-static char*
-cli_duplicateFile(const char* from)
+// Entry for the remote file "path" from a listing of its directory, which is
+// returned in "dirInfo" for the caller to free
+static dir_entry_t*
+cli_readRemoteEntry(squirt_conn_t* conn, const char* path, dir_entry_list_t** dirInfo)
 {
-  int toLength = strlen(from) + strlen(".orig") + 1;
-  char *to = malloc(toLength);
-  snprintf(to, toLength, "%s.orig", from);
-
-  int fd_to, fd_from;
-  char buf[4096];
-  ssize_t nread;
-  int saved_errno;
-
-  fd_from = open(from, O_RDONLY|_O_BINARY);
-  if (fd_from < 0) {
-    free(to);
-    return 0;
-  }
-
-  fd_to = open(to, O_TRUNC|O_WRONLY|O_CREAT|_O_BINARY , 0666);
-  if (fd_to < 0) {
-    goto out_error;
+  char dirPath[PATH_MAX];
+  const char* fileName = path;
+  const char* separator = strrchr(path, '/');
+  if (!separator) {
+    separator = strrchr(path, ':');
+  }
+
+  *dirInfo = 0;
+  dirPath[0] = 0;
+  if (separator) {
+    // keep the colon of a volume, drop the slash of a subdirectory
+    int dirLength = separator - path + (*separator == ':');
+    if (dirLength >= (int)sizeof(dirPath)) {
+      return 0;
+    }
+    strncpy(dirPath, path, dirLength);
+    dirPath[dirLength] = 0;
+    fileName = separator + 1;
   }
 
-  while (nread = read(fd_from, buf, sizeof buf), nread > 0) {
-    char *out_ptr = buf;
-    ssize_t nwritten;
-
-    do {
-      nwritten = write(fd_to, out_ptr, nread);
-
-      if (nwritten >= 0) {
-	nread -= nwritten;
-	out_ptr += nwritten;
-      } else if (errno != EINTR) {
-	goto out_error;
+  *dirInfo = dir_connRead(conn, dirPath);
+  if (*dirInfo) {
+    for (dir_entry_t* entry = (*dirInfo)->head; entry; entry = entry->next) {
+      if (strcasecmp(entry->name, fileName) == 0) {
+	return entry;
       }
-    } while (nread > 0);
-  }
-
-  if (nread == 0) {
-    if (close(fd_to) < 0) {
-      fd_to = -1;
-      goto out_error;
     }
-    close(fd_from);
-
-    /* Success! */
-    return to;
   }
 
- out_error:
-  saved_errno = errno;
-
-  if (to) {
-    free(to);
-  }
-
-  close(fd_from);
-  if (fd_to >= 0)
-    close(fd_to);
-
-  errno = saved_errno;
   return 0;
 }
 
 
-static char*
-cli_replaceChar(char* str, char find, char replace)
+// Returns 0, the remote status or the connection's error
+static uint32_t
+cli_saveFileIfModified(squirt_conn_t* conn, cli_hostfile_t* file)
 {
-  char *current_pos = strchr(str,find);
-  while (current_pos){
-    *current_pos = replace;
-    current_pos = strchr(current_pos,find);
+  int error = 0;
+  
+  // Check if the local file still exists (might have been deleted by local command)
+  struct stat st;
+  if (stat(file->localFilename, &st) != 0) {
+    // File was deleted by local command, skip upload
+    hostcache_forget(file->path);
+    return 0; // Consider this "successful" - the file was intentionally removed
   }
-  return str;
-}
-
-
-static void
-cli_freeHostFile(cli_hostfile_t* file)
-{
-  if (file) {
-    if (file->localFilename) {
-      unlink(file->localFilename);
-      free(file->localFilename);
+  
+  if (!file->exists) {
+    // created by the local command, it was never on the amiga so isn't sent there
+    unlink(file->localFilename);
+    return 0;
+  }
+  
+  if (hostcache_isModified(file->path)) {
+    // the upload replaces the remote file, so its comment is set again with the protection
+    // the absolute path, as the write-back may be on a session that never changed directory
+    error = squirt_connFile(conn, UTIL_DIR_CWD, file->localFilename, 0, file->path, 1, 0);
+    if (error < 0) {
+      error = ERROR_FILE_READ_FAILED;
+    } else if (error == 0) {
+      error = protect_connFileWithComment(conn, file->path, file->remoteProtection, 0, file->comment);
     }
-    if (file->backupFilename) {
-      unlink(file->backupFilename);
-      free(file->backupFilename);
+
+    // the new datestamp comes from the amiga, so the cached copy is recorded against a fresh listing
+    dir_entry_list_t* dirInfo = 0;
+    dir_entry_t* entry = error == 0 ? cli_readRemoteEntry(conn, file->path, &dirInfo) : 0;
+    if (entry) {
+      hostcache_update(file->path, entry);
+    } else {
+      hostcache_forget(file->path);
     }
-    if (file->remoteFilename) {
-      free(file->remoteFilename);
+    if (dirInfo) {
+      dir_freeEntryList(dirInfo);
     }
-    free(file);
   }
-}
 
+  return error ? (uint32_t)error : conn->error;
+}
 
 static cli_hostfile_t*
-cli_convertFileToHost(cli_hostfile_t** list, const char* remote)
+cli_addHostFile(cli_hostfile_t** list, const char* remote)
 {
   cli_hostfile_t *file = calloc(1, sizeof(cli_hostfile_t));
   
@@ -247,83 +270,145 @@ cli_convertFileToHost(cli_hostfile_t** list, const char* remote)
   } else {
     file->remoteFilename = strdup(remote);
   }
-  
-  char* local = strdup(file->remoteFilename);
-  cli_replaceChar(local, ':', '/');
-
-#ifdef _WIN32
-  // On Windows, convert forward slashes to backslashes for proper path handling
-  cli_replaceChar(local, '/', '\\');
-#endif
-
-  // Apply Windows reserved name handling to the local filename
-  char* safeName = util_safeName(local);
-  free(local);
-  local = safeName;
-
-  const char *tempPath = util_getTempFolder();
-  int localFilenameLength = strlen(local) + strlen(tempPath) + 1;
-  file->localFilename = malloc(localFilenameLength);
-  snprintf(file->localFilename, localFilenameLength, "%s%s", tempPath, local);
-  free(local);
-  util_mkpath(file->localFilename);
-
-  memset(&file->dateStamp, 0, sizeof(file->dateStamp));
-  int error = squirt_suckFile(file->remoteFilename, 0, 0, file->localFilename, &file->remoteProtection);
-  if (error == -ERROR_SUCK_ON_DIR) {
-    fprintf(stderr, "error: failed to access remote directory %s\n", file->remoteFilename);
-    free(file);
+
+  char path[PATH_MAX];
+  cli_absolutePath(path, sizeof(path), file->remoteFilename);
+  file->path = strdup(path);
+
+  cli_hostfile_t** ptr = list;
+  while (*ptr) {
+    // the same file twice is only fetched and written back once
+    if (!file->same && strcasecmp((*ptr)->path, path) == 0) {
+      file->same = *ptr;
+    }
+    ptr = &(*ptr)->next;
+  }
+  *ptr = file;
+
+  return file;
+}
+
+
+static uint32_t
+cli_fetchHostFile(squirt_conn_t* conn, cli_hostfile_t* file)
+{
+  if (file->same) {
     return 0;
+  }
+
+  // one listing of its directory is enough to tell if the cached copy is current
+  dir_entry_list_t* dirInfo;
+  dir_entry_t* entry = cli_readRemoteEntry(conn, file->path, &dirInfo);
+  if (conn->error) {
+    // a failed listing can't be told from a missing file
+  } else if (entry && entry->type > 0) {
+    file->isDirectory = 1;
   } else {
-    if (error < 0) {
-      unlink(file->localFilename);
+    if (entry) {
+      file->exists = 1;
+      file->remoteProtection = entry->prot;
+      file->comment = strdup(entry->comment ? entry->comment : "");
     }
-    file->backupFilename = cli_duplicateFile(file->localFilename);
-    if (*list) {
-      cli_hostfile_t* ptr = *list;
-      while (ptr->next) {
-	ptr = ptr->next;
-      }
-      ptr->next = file;
-    } else {
-      *list = file;
+
+    file->localFilename = hostcache_fetch(conn, file->path, entry);
+    if (!file->localFilename && !conn->error) {
+      // the command sees a missing file, as it would have before the cache
+      file->exists = 0;
+      file->localFilename = hostcache_fetch(conn, file->path, 0);
     }
   }
 
-  return file;
+  if (dirInfo) {
+    dir_freeEntryList(dirInfo);
+  }
+
+  return conn->error;
 }
 
 
-static int
-cli_saveFileIfModified(cli_hostfile_t* file)
+static uint32_t
+cli_saveHostFile(squirt_conn_t* conn, cli_hostfile_t* file)
 {
-  int success = 0;
-  
-  // Check if the local file still exists (might have been deleted by local command)
-  struct stat st;
-  if (stat(file->localFilename, &st) != 0) {
-    // File was deleted by local command, skip upload
-    return 1; // Consider this "successful" - the file was intentionally removed
+  return file->same ? 0 : cli_saveFileIfModified(conn, file);
+}
+
+
+// Works through the list on "conn" until it is empty or the connection fails,
+// the files left are taken by the other sessions
+static void
+cli_transferRun(squirt_conn_t* conn)
+{
+  pthread_mutex_lock(&cli_transferMutex);
+  while (cli_transferNext && !conn->error) {
+    cli_hostfile_t* file = cli_transferNext;
+    cli_transferNext = file->next;
+    pthread_mutex_unlock(&cli_transferMutex);
+
+    file->error = cli_transferFunction(conn, file);
+
+    pthread_mutex_lock(&cli_transferMutex);
   }
-  
-  if (!file->backupFilename) {
-    return 1;
+  pthread_mutex_unlock(&cli_transferMutex);
+}
+
+
+// Extra workers have squirtd sessions of their own. If squirtd won't serve
+// one the cli's own works through the list alone.
+static void*
+cli_transferWorker(void* arg)
+{
+  (void)arg;
+
+  squirt_conn_t* conn = conn_openSession(cli_hostname);
+  if (conn) {
+    cli_transferRun(conn);
+    conn_close(conn);
   }
-  
-  int comparison = cli_compareFile(file->localFilename, file->backupFilename);
-  
-  if (comparison == 0) {
-    success = squirt_file(file->localFilename, 0, file->remoteFilename, 1, 0) == 0;
-    if (success) {
-      success = protect_file(file->remoteFilename, file->remoteProtection, 0);
+
+  return 0;
+}
+
+
+// Runs "transfer" on every file in "list", with extra sessions working through
+// the list alongside the cli's own when there is more than one file and
+// squirtd serves them. Each file's error is left in it, nothing exits until
+// every worker has finished.
+static void
+cli_transferFiles(cli_hostfile_t* list, uint32_t (*transfer)(squirt_conn_t* conn, cli_hostfile_t* file))
+{
+  pthread_t threads[CLI_MAX_TRANSFERS];
+  int threadCount = 0;
+  int count = 0;
+
+  for (cli_hostfile_t* file = list; file; file = file->next) {
+    if (!file->same) {
+      count++;
     }
-  } else {
-    success = 1; // No upload needed, but this is "successful"
   }
 
-  return success;
+  cli_transferNext = list;
+  cli_transferFunction = transfer;
+
+  for (int i = 1; i < CLI_MAX_TRANSFERS && i < count; i++) {
+    if (pthread_create(&threads[threadCount], 0, cli_transferWorker, 0) != 0) {
+      break;
+    }
+    threadCount++;
+  }
+
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+  cli_transferRun(&conn);
+
+  for (int i = 0; i < threadCount; i++) {
+    pthread_join(threads[i], 0);
+  }
+
+  // the cli can't carry on without its own session
+  conn_detach(&conn);
 }
 
+
 static int
 cli_hostCommand(int argc, char** argv)
 {
@@ -365,16 +450,27 @@ cli_hostCommand(int argc, char** argv)
       // Skip local files, destinations, command options, and shell operators
       if (!isLocal && !isDestination &&
           argv[i][0] != '-' && argv[i][0] != '|' && argv[i][0] != '>') {
-        // This is a remote source file - transfer it to local temp directory
-        cli_hostfile_t* hostFile = cli_convertFileToHost(&list, argv[i]);
-        if (hostFile) {
-	  hostFile->argv = &argv[i];
-	  argv[i] = hostFile->localFilename;
-        } else {
-	  goto error;
-        }
+        // This is a remote source file - fetched with the others below
+        cli_hostfile_t* hostFile = cli_addHostFile(&list, argv[i]);
+        hostFile->argv = &argv[i];
       }
     }
+
+    // all the files are fetched at once, rather than one round trip after another
+    cli_transferFiles(list, cli_fetchHostFile);
+
+    for (cli_hostfile_t* file = list; file; file = file->next) {
+      cli_hostfile_t* fetched = file->same ? file->same : file;
+      if (fetched->isDirectory) {
+	fprintf(stderr, "error: failed to access remote directory %s\n", file->remoteFilename);
+	goto error;
+      }
+      if (fetched->error) {
+	fprintf(stderr, "error: failed to fetch %s: %s\n", file->remoteFilename, util_getErrorString(fetched->error));
+	goto error;
+      }
+      *file->argv = fetched->localFilename;
+    }
   }
 
   char** newArgv = malloc(sizeof(char*)*(argc+1));
@@ -633,14 +729,14 @@ cli_hostCommand(int argc, char** argv)
         }
         
         uint32_t protection;
-        success = squirt_suckFile(remoteSourcePath, 0, 0, finalDestPath, &protection) >= 0;
+        success = squirt_suckFile(remoteSourcePath, 0, 0, UTIL_DIR_CWD, finalDestPath, &protection) >= 0;
         if (localDestPath != originalArgv[2]) {
           free(localDestPath);
         }
       } else {
         // Local-to-remote or remote-to-remote: upload using squirt_file
 
-        success = squirt_file(sourcePath, 0, fullDestPath, 1, 0) == 0;
+        success = squirt_file(UTIL_DIR_CWD, sourcePath, 0, fullDestPath, 1, 0) == 0;
       }
       
       if (success) {
@@ -716,11 +812,17 @@ cli_hostCommand(int argc, char** argv)
   free(newArgv);
   
   // Process transfer-back after successful command execution
+  cli_transferFiles(list, cli_saveHostFile);
+
   cli_hostfile_t* file = list;
   while (file) {
-    cli_saveFileIfModified(file);
     cli_hostfile_t* save = file;
     file = file->next;
+
+    if (save->error) {
+      fprintf(stderr, "\n**FAILED** to write back %s\n%s\n", save->path, util_getErrorString(save->error));
+      success = 0;
+    }
     
     // Restore original argv value (find it in originalArgv)
     for (int i = 1; i < argc; i++) {
@@ -746,15 +848,43 @@ cli_hostCommand(int argc, char** argv)
     free(originalSourcePath);
   }
   
+  hostcache_save();
   util_rmdir(util_getTempFolder());
   return success;
 
  error:
-  // Transfer-back is now handled in main flow above
+  // nothing ran, so there is nothing to transfer back
+  while (list) {
+    cli_hostfile_t* next = list->next;
+    *list->argv = originalArgv[list->argv - argv];
+    cli_freeHostFile(list);
+    list = next;
+  }
+  free(originalArgv);
   goto cleanup;
 }
 
 
+// Commands that never change the remote filesystem, anything else may have
+// touched any directory in the completion cache
+static int
+cli_isReadOnlyCommand(const char* command)
+{
+  static const char* readOnly[] = {
+    "dir", "list", "type", "echo", "cls", "clear", "version", "date", "info",
+    "which", "assign", "help", "?", "status", "avail", "path", "ssum", "cd",
+    NULL
+  };
+
+  for (int i = 0; readOnly[i] != NULL; i++) {
+    if (strcasecmp(command, readOnly[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
 static int
 cli_runCommand(char* line)
 {
@@ -775,21 +905,16 @@ cli_runCommand(char* line)
       slash_count++;
     }
     
-    for (int i = 0; i < slash_count; i++) {
-      if (exec_cmd(2, (char*[]){"cd", "/"}) != 0) {
-        fprintf(stderr, "cd: / failed\n");
-        return code;
-      }
-    }
-
-    const char* new_path = cwd_read();
-    if (new_path != NULL) {
-      cli_changeDir(new_path);
-      code = 1;
-    } else {
-      fprintf(stderr, "Failed to get new working directory\n");
+    // AmigaDOS climbs one level per slash, so this is a single cd
+    char slashes[slash_count+1];
+    memset(slashes, '/', slash_count);
+    slashes[slash_count] = 0;
+
+    if (cli_cd(slashes) != 0) {
+      fprintf(stderr, "cd: %s failed\n", slashes);
+      return code;
     }
-    return code;
+    return 1;
   } else if (strncasecmp(line, "cd ", 3) == 0 || 
              (strchr(line, ':') != NULL && strchr(line, ' ') == NULL) || 
              (line[end] == '/' && strchr(line, ' ') == NULL) || 
@@ -822,12 +947,8 @@ cli_runCommand(char* line)
     }
 
     // Attempt to change directory
-    if (exec_cmd(2, (char*[]){"cd", arg}) == 0) {
-      const char* new_path = cwd_read();
-      if (new_path) {
-        cli_changeDir(new_path);
-        code = 1;
-      }
+    if (cli_cd(arg) == 0) {
+      code = 1;
     } else {
       fprintf(stderr, "cd: %s failed\n", arg);
       // code remains 0 (failure)
@@ -844,6 +965,8 @@ cli_runCommand(char* line)
     main_cleanupAndExit(EXIT_SUCCESS);
   } else if (argv[0][0] == '!') {
     code = cli_hostCommand(argc, argv);
+    // remote files may have been written back
+    dircache_invalidate(0);
   } else {
     // Authentic Amiga behavior: for single words, try directory navigation first
     // if it's not a known command
@@ -869,13 +992,9 @@ cli_runCommand(char* line)
       
       if (!is_known_command) {
         // Try as directory navigation first
-        if (exec_cmd(2, (char*[]){"cd", argv[0]}) == 0) {
-          const char* new_path = cwd_read();
-          if (new_path) {
-            cli_changeDir(new_path);
-            code = 1; // Success
-            return code; // Don't try as command
-          }
+        if (cli_cd(argv[0]) == 0) {
+          argv_free(argv);
+          return 1; // Don't try as command
         }
         // If directory change failed, fall through to try as command
       }
@@ -883,6 +1002,16 @@ cli_runCommand(char* line)
     
     // Execute as regular command
     code = exec_cmd(argc, argv);
+
+    if (!cli_isReadOnlyCommand(argv[0])) {
+      dircache_invalidate(0);
+      // renaming a parent, or a script, can leave the prompt out of date,
+      // creating, copying and deleting can't
+      if (strcasecmp(argv[0], "makedir") != 0 && strcasecmp(argv[0], "copy") != 0 &&
+          strcasecmp(argv[0], "delete") != 0) {
+        cli_cwdStale = 1;
+      }
+    }
   }
 
   argv_free(argv);
@@ -1076,6 +1205,28 @@ cli_queryAmigaAssigns(int* count)
 }
 
 
+// Range of the completion index matching "match_text", whose names are
+// offered after cli_readLineBase
+static int
+cli_findCompletions(const char* match_text, int match_len, int* first)
+{
+  *first = 0;
+  if (!cli_completeIndex) {
+    return 0;
+  }
+
+  int baseLength = strlen(cli_readLineBase);
+  if (match_len < baseLength) {
+    return strncasecmp(cli_readLineBase, match_text, match_len) == 0 ? cli_completeIndex->count : 0;
+  }
+  if (strncasecmp(cli_readLineBase, match_text, baseLength) != 0) {
+    return 0;
+  }
+
+  return complete_find(cli_completeIndex, match_text + baseLength, match_len - baseLength, first);
+}
+
+
 static char*
 cli_getAmigaAssignSuggestion(int* list_index, const char* match_text, int match_len)
 {
@@ -1087,9 +1238,13 @@ cli_getAmigaAssignSuggestion(int* list_index, const char* match_text, int match_
   static int cached_count = 0;
   static time_t last_cache_time = 0;
   
-  // Refresh cache every 30 seconds or on first call
+  // squirtd lists the dos list natively and the names are refreshed in the
+  // background, older servers have their assign and info output parsed here
+  // every 30 seconds or on first call
+  int native_count = 0;
+  const char** native_assigns = cli_hasDosList ? doslist_names(&native_count) : NULL;
   time_t current_time = time(NULL);
-  if (!cached_assigns || (current_time - last_cache_time) > 30) {
+  if (!native_assigns && (!cached_assigns || (current_time - last_cache_time) > 30)) {
     // Free previous cache
     if (cached_assigns) {
       for (int i = 0; i < cached_count; i++) {
@@ -1107,7 +1262,10 @@ cli_getAmigaAssignSuggestion(int* list_index, const char* match_text, int match_
   const char** assigns_to_use;
   int assign_count;
   
-  if (cached_assigns && cached_count > 0) {
+  if (native_assigns && native_count > 0) {
+    assigns_to_use = native_assigns;
+    assign_count = native_count;
+  } else if (cached_assigns && cached_count > 0) {
     assigns_to_use = (const char**)cached_assigns;
     assign_count = cached_count;
 
@@ -1134,30 +1292,9 @@ cli_getAmigaAssignSuggestion(int* list_index, const char* match_text, int match_
   // Simple assign completion - the caller manages the list_index properly
   // We just need to return the assign at the current relative position
   
-  // Count how many file/directory matches we've already processed
-  // by checking how many matches exist in the file list
-  int file_matches = 0;
-  if (cli_dirEntryList) {
-    dir_entry_t* ptr = cli_dirEntryList->head;
-    while (ptr) {
-      // Skip .info files
-      int name_len = strlen(ptr->name);
-      if (name_len >= 5) {
-        const char* extension = &ptr->name[name_len - 5];
-        if (strcasecmp(extension, ".info") == 0) {
-          ptr = ptr->next;
-          continue;
-        }
-      }
-      
-      char buffer[PATH_MAX];
-      snprintf(buffer, sizeof(buffer), "%s%s", cli_readLineBase, ptr->name);
-      if (strncasecmp(buffer, match_text, match_len) == 0) {
-        file_matches++;
-      }
-      ptr = ptr->next;
-    }
-  }
+  // The file/directory matches come first
+  int first;
+  int file_matches = cli_findCompletions(match_text, match_len, &first);
   
   // The assign index should be relative to the number of file matches
   int assign_relative_index = *list_index - file_matches;
@@ -1280,21 +1417,17 @@ static char*
 cli_getLocalFileSuggestion(int* list_index, const char* text, int len)
 {
   (void)len; // Unused parameter
-  static DIR* dir_handle = NULL;
+  static complete_index_t* dir_index = NULL;
   static char* dir_path = NULL;
-  static int current_index = 0;
   
   // Reset on new completion
   if (*list_index == 0) {
-    if (dir_handle) {
-      closedir(dir_handle);
-      dir_handle = NULL;
-    }
+    complete_freeIndex(dir_index);
+    dir_index = NULL;
     if (dir_path) {
       free(dir_path);
       dir_path = NULL;
     }
-    current_index = 0;
     
     // Extract directory path from text
     char* expanded_text = cli_expandLocalPath(text);
@@ -1313,7 +1446,7 @@ cli_getLocalFileSuggestion(int* list_index, const char* text, int len)
       dir_path = strdup(".");
     }
     
-    dir_handle = opendir(dir_path);
+    DIR* dir_handle = opendir(dir_path);
     free(expanded_text);
     
     if (!dir_handle) {
@@ -1323,9 +1456,21 @@ cli_getLocalFileSuggestion(int* list_index, const char* text, int len)
       }
       return NULL;
     }
+
+    // the directory is read once per completion, each call then finds its match in the index
+    dir_index = complete_newIndex();
+    struct dirent* entry;
+    while ((entry = readdir(dir_handle)) != NULL) {
+      // Skip . and ..
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        complete_add(dir_index, entry->d_name, 0);
+      }
+    }
+    closedir(dir_handle);
+    complete_sort(dir_index);
   }
   
-  if (!dir_handle) return NULL;
+  if (!dir_index) return NULL;
   
   // Get filename portion for matching
   char* expanded_text = cli_expandLocalPath(text);
@@ -1339,114 +1484,101 @@ cli_getLocalFileSuggestion(int* list_index, const char* text, int len)
   }
   int filename_len = strlen(filename_part);
   
-  struct dirent* entry;
-  while ((entry = readdir(dir_handle)) != NULL) {
-    // Skip . and ..
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
+  int first;
+  int count = complete_find(dir_index, filename_part, filename_len, &first);
+  if (*list_index < count) {
+    complete_candidate_t* entry = &dir_index->candidates[first + *list_index];
+    (*list_index)++;
+    
+    // Build full path
+    char* result = malloc(PATH_MAX);
+    
+    // Preserve the original prefix (! or ~) in completion results
+    const char* prefix = "";
+    if (text[0] == '!') {
+      prefix = "!";
+    } else if (text[0] == '~') {
+      prefix = "~";
     }
     
-    // Check if entry matches prefix (case-insensitive)
-    if (strncasecmp(entry->d_name, filename_part, filename_len) == 0) {
-      if (current_index == *list_index) {
-        (*list_index)++;
-        current_index++;
-        
-        // Build full path
-        char* result = malloc(PATH_MAX);
-        
-        // Preserve the original prefix (! or ~) in completion results
-        const char* prefix = "";
-        if (text[0] == '!') {
-          prefix = "!";
-        } else if (text[0] == '~') {
-          prefix = "~";
-        }
-        
-        if (strcmp(dir_path, ".") == 0) {
-          snprintf(result, PATH_MAX, "%s%s", prefix, entry->d_name);
-        } else {
-          // For ~ paths, we need to construct the path relative to the original ~ prefix
-          if (text[0] == '~') {
-            // Extract the path after ~ from the original text
-            const char* home = getenv("HOME");
-            if (home && strncmp(dir_path, home, strlen(home)) == 0) {
-              // dir_path starts with home directory, so we can reconstruct with ~
-              const char* relative_path = dir_path + strlen(home);
-              if (strlen(relative_path) > 0) {
-                snprintf(result, PATH_MAX, "~%s/%s", relative_path, entry->d_name);
-              } else {
-                snprintf(result, PATH_MAX, "~/%s", entry->d_name);
-              }
-            } else {
-              // Fallback to full path with ~ prefix
-              snprintf(result, PATH_MAX, "~/%s", entry->d_name);
-            }
+    if (strcmp(dir_path, ".") == 0) {
+      snprintf(result, PATH_MAX, "%s%s", prefix, entry->name);
+    } else {
+      // For ~ paths, we need to construct the path relative to the original ~ prefix
+      if (text[0] == '~') {
+        // Extract the path after ~ from the original text
+        const char* home = getenv("HOME");
+        if (home && strncmp(dir_path, home, strlen(home)) == 0) {
+          // dir_path starts with home directory, so we can reconstruct with ~
+          const char* relative_path = dir_path + strlen(home);
+          if (strlen(relative_path) > 0) {
+            snprintf(result, PATH_MAX, "~%s/%s", relative_path, entry->name);
           } else {
-            // Handle root directory to avoid double slashes
-            if (strcmp(dir_path, "/") == 0) {
-              snprintf(result, PATH_MAX, "%s/%s", prefix, entry->d_name);
-            } else {
-              snprintf(result, PATH_MAX, "%s%s/%s", prefix, dir_path, entry->d_name);
-            }
+            snprintf(result, PATH_MAX, "~/%s", entry->name);
           }
+        } else {
+          // Fallback to full path with ~ prefix
+          snprintf(result, PATH_MAX, "~/%s", entry->name);
         }
-        
-        // Check if it's a directory and add trailing slash
-        char full_path[PATH_MAX];
+      } else {
+        // Handle root directory to avoid double slashes
         if (strcmp(dir_path, "/") == 0) {
-          snprintf(full_path, PATH_MAX, "/%s", entry->d_name);
+          snprintf(result, PATH_MAX, "%s/%s", prefix, entry->name);
         } else {
-          snprintf(full_path, PATH_MAX, "%s/%s", dir_path, entry->d_name);
+          snprintf(result, PATH_MAX, "%s%s/%s", prefix, dir_path, entry->name);
         }
-        struct stat st;
-        int is_directory = (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode));
-        
-        // Add quoting for paths with spaces (like Amiga completion does)
-        int already_quoted = srl_insideQuotesFlag;
-        
-        if (strchr(result, ' ') != NULL) {
-          // Path contains spaces - needs quoting
-          char* quoted_result = malloc(strlen(result) + 10);
-          if (is_directory) {
-            if (already_quoted) {
-              sprintf(quoted_result, "%s/\"", result);
-            } else {
-              sprintf(quoted_result, "\"%s/\"", result);
-            }
-          } else {
-            if (already_quoted) {
-              sprintf(quoted_result, "%s\"", result);
-            } else {
-              sprintf(quoted_result, "\"%s\"", result);
-            }
-          }
-          free(result);
-          result = quoted_result;
+      }
+    }
+    
+    // Check if it's a directory and add trailing slash
+    char full_path[PATH_MAX];
+    if (strcmp(dir_path, "/") == 0) {
+      snprintf(full_path, PATH_MAX, "/%s", entry->name);
+    } else {
+      snprintf(full_path, PATH_MAX, "%s/%s", dir_path, entry->name);
+    }
+    struct stat st;
+    int is_directory = (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode));
+    
+    // Add quoting for paths with spaces (like Amiga completion does)
+    int already_quoted = srl_insideQuotesFlag;
+    
+    if (strchr(result, ' ') != NULL) {
+      // Path contains spaces - needs quoting
+      char* quoted_result = malloc(strlen(result) + 10);
+      if (is_directory) {
+        if (already_quoted) {
+          sprintf(quoted_result, "%s/\"", result);
         } else {
-          // No spaces - just add trailing slash for directories
-          if (is_directory) {
-            strcat(result, "/");
-          }
+          sprintf(quoted_result, "\"%s/\"", result);
+        }
+      } else {
+        if (already_quoted) {
+          sprintf(quoted_result, "%s\"", result);
+        } else {
+          sprintf(quoted_result, "\"%s\"", result);
         }
-        
-        free(expanded_text);
-        return result;
       }
-      current_index++;
+      free(result);
+      result = quoted_result;
+    } else {
+      // No spaces - just add trailing slash for directories
+      if (is_directory) {
+        strcat(result, "/");
+      }
     }
+    
+    free(expanded_text);
+    return result;
   }
   
   // Cleanup when done
-  if (dir_handle) {
-    closedir(dir_handle);
-    dir_handle = NULL;
-  }
+  complete_freeIndex(dir_index);
+  dir_index = NULL;
   if (dir_path) {
     free(dir_path);
     dir_path = NULL;
   }
-  current_index = 0;
   
   free(expanded_text);
   return NULL;
@@ -1465,68 +1597,45 @@ cli_completeGenerator(int* list_index, const char* text, int len)
   const char* match_text = cli_reconstructedText ? cli_reconstructedText : text;
   int match_len = cli_reconstructedText ? (int)strlen(cli_reconstructedText) : len;
   
-  dir_entry_t* ptr;
-  if (cli_dirEntryList) {
-    ptr = cli_dirEntryList->head;
-  } else {
-    ptr = 0;
-  }
-
-  // Process all matches (directories and files) for ambiguous completion
-  int current_index = 0;
-  while (ptr) {
-    dir_entry_t* entry = ptr;
-    ptr = ptr->next;
-
-    // Skip .info files (authentic Amiga shell behavior)
-    int name_len = strlen(entry->name);
-    if (name_len >= 5) {
-      const char* extension = &entry->name[name_len - 5];
-      if (strcasecmp(extension, ".info") == 0) {
-        continue; // Skip .info files
-      }
-    }
+  // the sorted index gives the matches without walking the listing
+  int first;
+  int count = cli_findCompletions(match_text, match_len, &first);
+  if (*list_index < count) {
+    complete_candidate_t* entry = &cli_completeIndex->candidates[first + *list_index];
+    (*list_index)++;
 
     char buffer[PATH_MAX];
     snprintf(buffer, sizeof(buffer), "%s%s", cli_readLineBase, entry->name);
 
-    // Check both directories and files in the same loop
-    if (strncasecmp(buffer, match_text, match_len) == 0) {
-      if (current_index == *list_index) {
-        (*list_index)++;
-        
-        int already_quoted = srl_insideQuotesFlag;
-        
-        if (entry->type > 0) {
-          // Directory match
-          char* result = malloc(strlen(buffer) + 10);
-          if (strchr(buffer, ' ') != NULL) {
-            if (already_quoted) {
-              sprintf(result, "%s/\"", buffer);
-            } else {
-              sprintf(result, "\"%s/\"", buffer);
-            }
-          } else {
-            strcpy(result, buffer);
-            strcat(result, "/");
-          }
-          return result;
-        } else {
-          // File match
-          if (strchr(buffer, ' ') != NULL) {
-            char* result = malloc(strlen(buffer) + 3);
-            if (already_quoted) {
-              sprintf(result, "%s\"", buffer);
-            } else {
-              sprintf(result, "\"%s\"", buffer);
-            }
-            return result;
-          } else {
-            return strdup(buffer);
-          }
-        }
+    int already_quoted = srl_insideQuotesFlag;
+
+    if (entry->type > 0) {
+      // Directory match
+      char* result = malloc(strlen(buffer) + 10);
+      if (strchr(buffer, ' ') != NULL) {
+	if (already_quoted) {
+	  sprintf(result, "%s/\"", buffer);
+	} else {
+	  sprintf(result, "\"%s/\"", buffer);
+	}
+      } else {
+	strcpy(result, buffer);
+	strcat(result, "/");
+      }
+      return result;
+    } else {
+      // File match
+      if (strchr(buffer, ' ') != NULL) {
+	char* result = malloc(strlen(buffer) + 3);
+	if (already_quoted) {
+	  sprintf(result, "%s\"", buffer);
+	} else {
+	  sprintf(result, "\"%s\"", buffer);
+	}
+	return result;
+      } else {
+	return strdup(buffer);
       }
-      current_index++;
     }
   }
 
@@ -1564,6 +1673,8 @@ cli_completeHook(const char* text, const char* full_command_line)
   if (cli_readLineBase) {
     free(cli_readLineBase);
   }
+  // names from the background refresh are only swapped in between completions
+  cli_hasDosList = doslist_refresh() == 0;
   if (cli_reconstructedText) {
     free(cli_reconstructedText);
     cli_reconstructedText = 0;
@@ -1583,17 +1694,15 @@ cli_completeHook(const char* text, const char* full_command_line)
       ei--;
     }
     
-    if (cli_dirEntryList) {
-      dir_freeEntryList(cli_dirEntryList);
-    }
-
-    cli_dirEntryList = dir_read(cli_readLineBase);
+    // the listing belongs to the completion cache
+    char path[PATH_MAX];
+    cli_absolutePath(path, sizeof(path), cli_readLineBase);
+    cli_dirEntryList = dircache_read(path);
+    cli_completeIndex = cli_dirEntryList ? dircache_index(path) : 0;
   } else {
     // For local completion, we don't need Amiga directory listing
-    if (cli_dirEntryList) {
-      dir_freeEntryList(cli_dirEntryList);
-      cli_dirEntryList = NULL;
-    }
+    cli_dirEntryList = NULL;
+    cli_completeIndex = 0;
   }
   
   free(full_path);
@@ -1615,18 +1724,35 @@ cli_main(int argc, char* argv[])
 
   util_connect(argv[1]);
   util_onCtrlC(cli_onExit);
+  dircache_enablePrefetch(argv[1]);
+  doslist_init(argv[1]);
+  hostcache_init(argv[1]);
+  cli_hostname = argv[1];
+  char* prefetched = 0;
 
   srl_init(cli_prompt, cli_completeHook, cli_completeGenerator);
 
   do {
-    const char* cwd = cwd_read();
-    if (!cwd) {
-      fatalError("failed to get cwd");
+    // only asked again after a command that may have moved it
+    if (cli_cwdStale) {
+      const char* cwd = cwd_read();
+      if (!cwd) {
+	fatalError("failed to get cwd");
+      }
+      cli_changeDir(cwd);
+      free((void*)cwd);
+      cli_cwdStale = 0;
+    }
+    if (!prefetched || strcmp(prefetched, cli_currentDir) != 0) {
+      // the next Tab usually descends into the new directory
+      dircache_prefetch(cli_currentDir);
+      free(prefetched);
+      prefetched = strdup(cli_currentDir);
     }
-    cli_changeDir(cwd);
-    free((void*)cwd);
     char* command = srl_gets();
     if (command && strlen(command)) {
+      // the command gets the link to itself
+      dircache_cancelPrefetch();
       cli_runCommand(command);
     }
   } while (1);
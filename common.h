@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 
 typedef enum {
   SQUIRT_COMMAND_SQUIRT,
@@ -8,7 +9,16 @@ typedef enum {
   SQUIRT_COMMAND_SUCK,
   SQUIRT_COMMAND_DIR,
   SQUIRT_COMMAND_CWD,
-  SQUIRT_COMMAND_SET_INFO
+  SQUIRT_COMMAND_SET_INFO,
+  SQUIRT_COMMAND_DIR_SINCE,
+  SQUIRT_COMMAND_SET_INFO_COMMENT,
+  SQUIRT_COMMAND_MAKEDIR,
+  SQUIRT_COMMAND_DELETE,
+  SQUIRT_COMMAND_RENAME,
+  SQUIRT_COMMAND_COPY,
+  SQUIRT_COMMAND_MANIFEST,
+  SQUIRT_COMMAND_DOSLIST,
+  SQUIRT_COMMAND_CD_CWD
 } command_t;
 
 typedef enum {
@@ -26,7 +36,89 @@ typedef enum {
   ERROR_FATAL_CREATE_FILE_FAILED,
   ERROR_FATAL_FILE_WRITE_FAILED,
   ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE,
+
+  // codes are only ever added here, so older clients and servers still agree
+  // on what each one means
+  ERROR_SET_COMMENT_FAILED,
+  ERROR_CREATE_DIR_FAILED,
+  ERROR_DELETE_FAILED,
+  ERROR_RENAME_FAILED,
+  ERROR_COPY_FAILED,
 } _error_t;
 
+#define SQUIRT_ERROR_IS_FATAL(error) ((error) >= ERROR_FATAL_ERROR && (error) <= ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE)
+
 static const int BLOCK_SIZE = 8192;
 static const int NETWORK_PORT = 6969;
+
+// SQUIRT_COMMAND_DIR_SINCE: squirtd answers the directory name with
+// SQUIRT_FILEOP_REPLY before reading the datestamp and digests that follow,
+// a server without the command sends just a status and is listed with a plain
+// DIR instead. Entries matching one of the client's digests are not sent,
+// instead a bit is set in a bitmap returned after the listing
+#define SQUIRT_DIR_MAX_DIGESTS   16384
+#define SQUIRT_DIR_COMPACT_ENTRY 0x80000000
+#define SQUIRT_DIGEST_SEED       2166136261U
+
+// SQUIRT_COMMAND_SET_INFO_COMMENT: accepted with SQUIRT_FILEOP_REPLY as
+// DIR_SINCE is, then the SET_INFO payload followed by a length prefixed
+// latin1 comment. SetComment() accepts at most 79 characters
+#define SQUIRT_MAX_COMMENT_LENGTH 79
+
+// SQUIRT_COMMAND_MAKEDIR/DELETE/RENAME/COPY: squirtd answers the name with
+// SQUIRT_FILEOP_REPLY, a server without the commands sends just a status
+// instead, so the client falls back to the AmigaDOS command. For RENAME/COPY
+// the name is the source, and only once the reply has arrived is the length
+// prefixed destination sent. A destination directory receives the source name
+#define SQUIRT_FILEOP_REPLY 0x80000000
+
+// SQUIRT_COMMAND_MANIFEST: accepted with SQUIRT_FILEOP_REPLY as DIR_SINCE is,
+// then a u32 byte count, then for each directory a u32 path length, the latin1
+// path nul padded to a multiple of 4, a u32 digest count and the sorted
+// digests. Each directory is answered in turn with a DIR_SINCE reply, one that
+// can't be read with an empty listing and an error status
+#define SQUIRT_MANIFEST_MAX_LENGTH (1024*1024)
+
+// SQUIRT_COMMAND_DOSLIST: one u32 type, u32 length and latin1 name per
+// mounted device, assign and volume, then 0xFFFFFFFF and the status. Servers
+// without the command reply with just the status, which reads as type 0
+#define SQUIRT_DOSLIST_DEVICE 1
+#define SQUIRT_DOSLIST_ASSIGN 2
+#define SQUIRT_DOSLIST_VOLUME 3
+
+// SQUIRT_COMMAND_CD_CWD: a CD that replies with the new current directory the
+// way SQUIRT_COMMAND_CWD does, its length flagged so the bare status of a
+// server without the command can be told apart. The length is 0 on failure
+#define SQUIRT_CD_CWD_REPLY 0x80000000
+
+// FNV-1a, integers are fed most significant byte first so both ends agree
+static inline uint32_t
+squirt_digest(uint32_t hash, const void* data, uint32_t length)
+{
+  const uint8_t* ptr = data;
+  while (length--) {
+    hash = (hash ^ *ptr++) * 16777619U;
+  }
+  return hash;
+}
+
+static inline uint32_t
+squirt_digestU32(uint32_t hash, uint32_t value)
+{
+  uint8_t bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+  return squirt_digest(hash, bytes, sizeof(bytes));
+}
+
+// name and comment are latin1 as they are on the amiga
+static inline uint32_t
+squirt_digestEntry(const char* name, uint32_t nameLength, int32_t type, uint32_t size, uint32_t prot, uint32_t days, uint32_t mins, uint32_t ticks, const char* comment, uint32_t commentLength)
+{
+  uint32_t hash = squirt_digest(SQUIRT_DIGEST_SEED, name, nameLength);
+  hash = squirt_digestU32(hash, (uint32_t)type);
+  hash = squirt_digestU32(hash, size);
+  hash = squirt_digestU32(hash, prot);
+  hash = squirt_digestU32(hash, days);
+  hash = squirt_digestU32(hash, mins);
+  hash = squirt_digestU32(hash, ticks);
+  return squirt_digest(hash, comment, commentLength);
+}
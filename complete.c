@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "main.h"
+#include "common.h"
+#include "complete.h"
+
+
+complete_index_t*
+complete_newIndex(void)
+{
+  complete_index_t* index = calloc(1, sizeof(complete_index_t));
+  if (!index) {
+    fatalError("malloc failed");
+  }
+  return index;
+}
+
+
+void
+complete_freeIndex(complete_index_t* index)
+{
+  if (index) {
+    for (int i = 0; i < index->count; i++) {
+      free(index->candidates[i].name);
+    }
+    if (index->candidates) {
+      free(index->candidates);
+    }
+    free(index);
+  }
+}
+
+
+void
+complete_add(complete_index_t* index, const char* name, int type)
+{
+  if (index->count == index->size) {
+    index->size = index->size ? index->size * 2 : 64;
+    index->candidates = realloc(index->candidates, sizeof(complete_candidate_t) * index->size);
+    if (!index->candidates) {
+      fatalError("malloc failed");
+    }
+  }
+
+  complete_candidate_t* candidate = &index->candidates[index->count++];
+  if (!(candidate->name = strdup(name))) {
+    fatalError("malloc failed");
+  }
+  candidate->type = type;
+}
+
+
+static int
+complete_compare(const void* a, const void* b)
+{
+  const complete_candidate_t* one = a;
+  const complete_candidate_t* two = b;
+  int diff = strcasecmp(one->name, two->name);
+  return diff ? diff : strcmp(one->name, two->name);
+}
+
+
+void
+complete_sort(complete_index_t* index)
+{
+  if (index->count > 1) {
+    qsort(index->candidates, index->count, sizeof(complete_candidate_t), complete_compare);
+  }
+}
+
+
+// first candidate that doesn't sort before "prefix", or with "after" set, the
+// first one past every name starting with it
+static int
+complete_search(complete_index_t* index, const char* prefix, int len, int after)
+{
+  int low = 0, high = index->count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    int diff = strncasecmp(index->candidates[middle].name, prefix, len);
+    if (diff < 0 || (after && diff == 0)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+
+int
+complete_find(complete_index_t* index, const char* prefix, int len, int* first)
+{
+  *first = complete_search(index, prefix, len, 0);
+  return complete_search(index, prefix, len, 1) - *first;
+}
+
@@ -0,0 +1,32 @@
+#pragma once
+
+typedef struct {
+  char* name;
+  int type;  // as in dir_entry_t, or 0 if not known
+} complete_candidate_t;
+
+// Tab completion candidates sorted case insensitively, so the names sharing a
+// prefix are found with a binary search rather than a scan of the listing
+typedef struct {
+  complete_candidate_t* candidates;
+  int count;
+  int size;
+} complete_index_t;
+
+complete_index_t*
+complete_newIndex(void);
+
+void
+complete_freeIndex(complete_index_t* index);
+
+void
+complete_add(complete_index_t* index, const char* name, int type);
+
+// Sorts the candidates once they have all been added
+void
+complete_sort(complete_index_t* index);
+
+// Number of candidates starting with the first "len" characters of "prefix",
+// the first of which is "*first"
+int
+complete_find(complete_index_t* index, const char* prefix, int len, int* first);
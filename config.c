@@ -42,11 +42,14 @@ struct {
   char defaultHostname[CONFIG_STRING_MAX];
   string_pair_t aliases[CONFIG_MAX_ALIASES];
   size_t aliasCount;
+  string_pair_t fleets[CONFIG_MAX_ALIASES];  // name, hosts separated by spaces or commas
+  size_t fleetCount;
 } config = {0};
 
 config_item_t config_items[] = {
   {"default", CONFIG_STRING, &config.defaultHostname, 0},
   { "alias", CONFIG_STRING_PAIRS, config.aliases, &config.aliasCount },
+  { "fleet", CONFIG_STRING_PAIRS, config.fleets, &config.fleetCount },
 };
 
 static const char*
@@ -255,49 +258,49 @@ config_setDefaultHost(const char* hostname)
 }
 
 static int
-config_addAlias(const char* from, const char* to)
+config_addPair(string_pair_t* pairs, size_t* count, const char* from, const char* to)
 {
-  for (size_t i = 0; i < config.aliasCount; i++) {
-    if (config.aliases[i].value && config.aliases[i].key) {    
-      if (strcmp(config.aliases[i].key, from) == 0) {
-	free((void*)config.aliases[i].value);
-	config.aliases[i].value = strdup(to);
+  for (size_t i = 0; i < *count; i++) {
+    if (pairs[i].value && pairs[i].key) {
+      if (strcmp(pairs[i].key, from) == 0) {
+	free((void*)pairs[i].value);
+	pairs[i].value = strdup(to);
 	config_save();
 	return 1;
       }
     }
   }
-    
-  if (config.aliasCount < countof(config.aliases)) {    
-    config.aliases[config.aliasCount].key = strdup(from);
-    config.aliases[config.aliasCount].value = strdup(to);
-    config.aliasCount++;
-    config_save();    
+
+  if (*count < CONFIG_MAX_ALIASES) {
+    pairs[*count].key = strdup(from);
+    pairs[*count].value = strdup(to);
+    (*count)++;
+    config_save();
     return 1;
   }
-  
+
   return 0;
 }
 
 
 static int
-config_rmAlias(const char* from)
+config_rmPair(string_pair_t* pairs, size_t* count, const char* from, const char* type)
 {
-  const size_t total = config.aliasCount;
-  for (size_t i = 0, j = 0; i < total; i++) {
-    if (config.aliases[i].value && config.aliases[i].key) {    
-      if (strcmp(config.aliases[i].key, from) != 0) {
-	config.aliases[i].key = config.aliases[j].key;
-	config.aliases[i].value = config.aliases[j++].value;	
-      } else {
-	printf("Removing alias %s\n", from);
-	config.aliasCount--;
-      }
+  const size_t total = *count;
+  size_t j = 0;
+  for (size_t i = 0; i < total; i++) {
+    if (pairs[i].key && strcmp(pairs[i].key, from) == 0) {
+      printf("Removing %s %s\n", type, from);
+      free((void*)pairs[i].key);
+      free((void*)pairs[i].value);
+    } else {
+      pairs[j++] = pairs[i];
     }
   }
+  *count = j;
 
   config_save();
-      
+
   return 0;
 }
 
@@ -309,6 +312,26 @@ config_listAlias(void)
   }
 }
 
+static void
+config_listFleet(void)
+{
+  for (size_t i = 0; i < config.fleetCount; i++) {
+    printf("  fleet: @%s => %s\n", config.fleets[i].key, config.fleets[i].value);
+  }
+}
+
+const char*
+config_getFleet(const char* name)
+{
+  for (size_t i = 0; i < config.fleetCount; i++) {
+    if (strcmp(name, config.fleets[i].key) == 0) {
+      return config.fleets[i].value;
+    }
+  }
+
+  return 0;
+}
+
 const char *
 config_getAlias(const char* hostname)
 {
@@ -331,6 +354,7 @@ config_dump(void)
   printf("\n");
   printf("default hostname: %s\n", config.defaultHostname[0] == 0 ? "--== no default ==--" : config.defaultHostname);
   config_listAlias();
+  config_listFleet();
   for (int i = 0; i < n-1; i++) {
     printf("=");
   }
@@ -350,6 +374,9 @@ config_main(int argc, char* argv[])
     } else if (strcmp(argv[1], "--alias") == 0) {
       config_listAlias();
       return;
+    } else if (strcmp(argv[1], "--fleet") == 0) {
+      config_listFleet();
+      return;
     } else if (strcmp(argv[1], "--default") == 0) {
       printf("default hostname: %s\n", config.defaultHostname);
       return;
@@ -364,19 +391,26 @@ config_main(int argc, char* argv[])
       printf("default hostname: %s\n", defaultHostname);
       return;
     } else if (strcmp(argv[1], "--remove-alias") == 0) {
-      config_rmAlias(argv[2]);
+      config_rmPair(config.aliases, &config.aliasCount, argv[2], "alias");
+      return;
+    } else if (strcmp(argv[1], "--remove-fleet") == 0) {
+      config_rmPair(config.fleets, &config.fleetCount, argv[2], "fleet");
       return;
     }
   } else if (argc == 4) {
     if (strcmp(argv[1], "--alias") == 0) {
-      config_addAlias(argv[2], argv[3]);
+      config_addPair(config.aliases, &config.aliasCount, argv[2], argv[3]);
       printf("Added alias: %s=%s\n", argv[2], argv[3]);
       return;
+    } else if (strcmp(argv[1], "--fleet") == 0) {
+      config_addPair(config.fleets, &config.fleetCount, argv[2], argv[3]);
+      printf("Added fleet: @%s=%s\n", argv[2], argv[3]);
+      return;
     }
   }
 
   config_dump();
-  fatalError("usage: %s [--clear-default] [--default hostname] --alias [alias hostname] --remove-alias [alias] --show-config", main_argv0);
+  fatalError("usage: %s [--clear-default] [--default hostname] --alias [alias hostname] --remove-alias [alias] --fleet [name \"hostname ...\"] --remove-fleet [name] --show-config", main_argv0);
  
 }
 
@@ -419,7 +453,7 @@ void
 config_patchDefaultHostname(int* argc, char*** argv)
 {
   const char* defaultHostname = 0;
-  if ((*argc > 1 && !util_isHostname((*argv)[1])) || *argc == 1) {
+  if ((*argc > 1 && !util_isHostname((*argv)[1]) && !fleet_isFleet((*argv)[1])) || *argc == 1) {
     defaultHostname = config_getDefaultHost();    
     if (defaultHostname) {
       config_patchArgv(argc, argv, defaultHostname, 1);
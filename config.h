@@ -11,6 +11,10 @@ config_main(int argc, char* argv[]);
 const char *
 config_getAlias(const char* hostname);
 
+// The hosts of the fleet "name", or 0
+const char*
+config_getFleet(const char* name);
+
 void
 config_patchDefaultHostname(int* argc, char*** argv);
 
@@ -20,5 +24,6 @@ config_patchDefaultHostname(int* argc, char*** argv);
 #define config_main(c, v)
 #define config_patchDefaultHostname(c, v)
 #define config_getAlias(hostname) (hostname)
+#define config_getFleet(name) ((const char*)0)
 
 #endif
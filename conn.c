@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#endif
+
+#include "main.h"
+#include "common.h"
+#include "latin1.h"
+
+#define CONN_SESSION_TIMEOUT 2 // seconds for an extra session to be answered
+
+// a standalone squirtd only serves one session at a time, once an extra
+// session has gone unanswered no more are tried
+static pthread_mutex_t conn_sessionMutex = PTHREAD_MUTEX_INITIALIZER;
+static int conn_sessionsUnserved = 0;
+
+
+squirt_conn_t*
+conn_open(const char* hostname)
+{
+  squirt_conn_t* conn = malloc(sizeof(squirt_conn_t));
+  if (!conn) {
+    return 0;
+  }
+
+  conn_attach(conn, util_connectSocket(hostname));
+  if (conn->fd < 0) {
+    conn_fail(conn, ERROR_FATAL_ERROR, "failed to connect to server %s", hostname);
+  }
+
+  return conn;
+}
+
+
+// A CWD round trip, which a server that isn't serving this session yet leaves
+// unanswered
+static int
+conn_probe(squirt_conn_t* conn)
+{
+  fd_set readfds;
+  struct timeval timeout;
+  uint32_t length, error;
+
+  conn_sendCommand(conn, SQUIRT_COMMAND_CWD);
+  conn_sendString(conn, "cwd", "command");
+  if (conn->error) {
+    return conn->error;
+  }
+
+  FD_ZERO(&readfds);
+  FD_SET(conn->fd, &readfds);
+  timeout.tv_sec = CONN_SESSION_TIMEOUT;
+  timeout.tv_usec = 0;
+
+  if (select(conn->fd + 1, &readfds, NULL, NULL, &timeout) <= 0) {
+    return conn_fail(conn, ERROR_FATAL_RECV_FAILED, "session not served by squirtd");
+  }
+
+  if (conn_recvU32(conn, &length, "cwd length") == 0) {
+    free(conn_recvString(conn, length, "cwd"));
+    conn_recvU32(conn, &error, "remote status");
+  }
+
+  return conn->error;
+}
+
+
+squirt_conn_t*
+conn_openSession(const char* hostname)
+{
+  pthread_mutex_lock(&conn_sessionMutex);
+  int unserved = conn_sessionsUnserved;
+  pthread_mutex_unlock(&conn_sessionMutex);
+
+  if (unserved) {
+    return 0;
+  }
+
+  squirt_conn_t* conn = conn_open(hostname);
+  if (conn && !conn->error && conn_probe(conn) == 0) {
+    return conn;
+  }
+
+  if (conn) {
+    conn_close(conn);
+  }
+
+  pthread_mutex_lock(&conn_sessionMutex);
+  conn_sessionsUnserved = 1;
+  pthread_mutex_unlock(&conn_sessionMutex);
+
+  return 0;
+}
+
+
+void
+conn_close(squirt_conn_t* conn)
+{
+  if (conn->fd >= 0) {
+    close(conn->fd);
+  }
+  if (conn->buffer) {
+    free(conn->buffer);
+  }
+  free(conn);
+}
+
+
+void
+conn_attach(squirt_conn_t* conn, int fd)
+{
+  conn->fd = fd;
+  conn->error = 0;
+  conn->message[0] = 0;
+  conn->buffer = 0;
+  conn->start.tv_sec = conn->start.tv_usec = 0;
+}
+
+
+void
+conn_detach(squirt_conn_t* conn)
+{
+  if (conn->buffer) {
+    free(conn->buffer);
+    conn->buffer = 0;
+  }
+
+  if (conn->error) {
+    fflush(stdout);
+    fatalError("%s", conn->message);
+  }
+}
+
+
+uint32_t
+conn_fail(squirt_conn_t* conn, uint32_t error, const char* format, ...)
+{
+  if (!conn->error) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(conn->message, sizeof(conn->message), format, args);
+    va_end(args);
+    conn->error = error;
+  }
+
+  return conn->error;
+}
+
+
+const char*
+conn_errorString(squirt_conn_t* conn)
+{
+  return conn->error ? conn->message : util_getErrorString(0);
+}
+
+
+char*
+conn_buffer(squirt_conn_t* conn)
+{
+  if (!conn->buffer) {
+    conn->buffer = malloc(BLOCK_SIZE);
+    if (!conn->buffer) {
+      conn_fail(conn, ERROR_FATAL_ERROR, "malloc failed");
+    }
+  }
+
+  return conn->buffer;
+}
+
+
+int
+conn_send(squirt_conn_t* conn, const void* data, size_t length, const char* what)
+{
+  const char* ptr = data;
+
+  while (!conn->error && length > 0) {
+    int sent = send(conn->fd, ptr, length, 0);
+    if (sent <= 0) {
+      conn_fail(conn, ERROR_FATAL_SEND_FAILED, "failed to send %s: %s", what, sent < 0 ? strerror(errno) : "connection closed");
+    } else {
+      ptr += sent;
+      length -= sent;
+    }
+  }
+
+  return conn->error;
+}
+
+
+int
+conn_recv(squirt_conn_t* conn, void* buffer, size_t length, const char* what)
+{
+  char* ptr = buffer;
+
+  while (!conn->error && length > 0) {
+    int got = recv(conn->fd, ptr, length, 0);
+    if (got > 0) {
+      ptr += got;
+      length -= got;
+    } else if (got == 0) {
+      conn_fail(conn, ERROR_FATAL_RECV_FAILED, "failed to read %s: connection closed by Amiga server", what);
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      conn_fail(conn, ERROR_FATAL_RECV_FAILED, "failed to read %s: connection timeout - Amiga may have crashed or network connection lost", what);
+    } else {
+      conn_fail(conn, ERROR_FATAL_RECV_FAILED, "failed to read %s: %s", what, strerror(errno));
+    }
+  }
+
+  return conn->error;
+}
+
+
+int
+conn_sendU32(squirt_conn_t* conn, uint32_t value, const char* what)
+{
+  uint32_t networkValue = htonl(value);
+  return conn_send(conn, &networkValue, sizeof(networkValue), what);
+}
+
+
+int
+conn_recvU32(squirt_conn_t* conn, uint32_t* value, const char* what)
+{
+  if (conn_recv(conn, value, sizeof(uint32_t), what) == 0) {
+    *value = ntohl(*value);
+  }
+
+  return conn->error;
+}
+
+
+int
+conn_recvAccepted(squirt_conn_t* conn, int* support)
+{
+  uint32_t reply;
+
+  if (conn_recvU32(conn, &reply, "remote reply") != 0) {
+    return 0;
+  }
+
+  if (reply == SQUIRT_FILEOP_REPLY) {
+    *support = 1;
+    return 1;
+  }
+
+  if (*support > 0) {
+    conn_fail(conn, ERROR_FATAL_RECV_FAILED, "unexpected reply 0x%x", reply);
+    return 0;
+  }
+
+  *support = -1;
+  return 0;
+}
+
+
+int
+conn_sendString(squirt_conn_t* conn, const char* str, const char* what)
+{
+  char buffer[1024];
+  size_t utf8Length = strlen(str);
+
+  // the length goes in front of the name so both are sent at once
+  char* latin1 = utf8Length + 5 <= sizeof(buffer) ? buffer : malloc(utf8Length + 5);
+  if (!latin1) {
+    return conn_fail(conn, ERROR_FATAL_ERROR, "malloc failed");
+  }
+
+  size_t length;
+  latin1_fromUtf8(latin1 + 4, &length, str, utf8Length);
+  uint32_t networkLength = htonl(length);
+  memcpy(latin1, &networkLength, sizeof(networkLength));
+
+  conn_send(conn, latin1, length + 4, what);
+
+  if (latin1 != buffer) {
+    free(latin1);
+  }
+  return conn->error;
+}
+
+
+char*
+conn_recvString(squirt_conn_t* conn, uint32_t length, const char* what)
+{
+  // received into the second half of the buffer and converted in place
+  char* buffer = malloc(length*2+1);
+  if (!buffer) {
+    conn_fail(conn, ERROR_FATAL_ERROR, "malloc failed");
+    return 0;
+  }
+
+  if (conn_recv(conn, buffer + length, length, what) != 0) {
+    free(buffer);
+    return 0;
+  }
+
+  size_t utf8Length = latin1_toUtf8(buffer, buffer + length, length);
+  if (utf8Length < length*2) {
+    char* shrunk = realloc(buffer, utf8Length+1);
+    if (shrunk) {
+      buffer = shrunk;
+    }
+  }
+  return buffer;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+// A session with squirtd. Everything that talks to the server through one of
+// these hands errors back instead of exiting, so a process can drive several
+// connections at once, from any thread.
+typedef struct squirt_conn {
+  int fd;
+  uint32_t error;         // first fatal error, nothing more is sent once it is set
+  char message[256];      // what failed, for conn_errorString
+  char* buffer;           // BLOCK_SIZE transfer buffer, allocated on first use
+  struct timeval start;   // when the last file transfer started
+} squirt_conn_t;
+
+// Connects to squirtd on "hostname" ("host[:port]" or an alias). Returns 0 only
+// if out of memory, a failed connection has its error set.
+squirt_conn_t*
+conn_open(const char* hostname);
+
+// Opens a session alongside the one the process already has. A standalone
+// squirtd only serves one session at a time, so this returns 0 if the server
+// doesn't answer straight away or can't be reached, and from then on without
+// trying again. Nothing that only speeds things up should need more.
+squirt_conn_t*
+conn_openSession(const char* hostname);
+
+// Closes the connection and frees it
+void
+conn_close(squirt_conn_t* conn);
+
+// Wraps a socket that is already connected, such as the thread's main_socketFd
+void
+conn_attach(squirt_conn_t* conn, int fd);
+
+// Releases an attached connection without closing its socket. The command line
+// tools can't carry on after a connection error, so this exits if there was one.
+void
+conn_detach(squirt_conn_t* conn);
+
+// Records "error" unless the connection already failed, returns the first error
+uint32_t
+conn_fail(squirt_conn_t* conn, uint32_t error, const char* format, ...);
+
+const char*
+conn_errorString(squirt_conn_t* conn);
+
+char*
+conn_buffer(squirt_conn_t* conn);
+
+// These return 0 or the connection's error, "what" names the item for the error
+// message. Once the connection has failed they return straight away.
+
+int
+conn_send(squirt_conn_t* conn, const void* data, size_t length, const char* what);
+
+int
+conn_recv(squirt_conn_t* conn, void* buffer, size_t length, const char* what);
+
+int
+conn_sendU32(squirt_conn_t* conn, uint32_t value, const char* what);
+
+int
+conn_recvU32(squirt_conn_t* conn, uint32_t* value, const char* what);
+
+#define conn_sendCommand(c, x) conn_sendU32(c, x, "command")
+
+// The reply to the name of a request that carries more after it. squirtd
+// answers with SQUIRT_FILEOP_REPLY before reading the rest, an older squirtd
+// that doesn't have the command with just its status. "support" starts at 0
+// and records which was seen, 1 or -1. Returns 1 if the rest is to be sent, 0
+// if the server doesn't have the command or the connection failed.
+int
+conn_recvAccepted(squirt_conn_t* conn, int* support);
+
+// Sends the length and then the Latin-1 form of "str"
+int
+conn_sendString(squirt_conn_t* conn, const char* str, const char* what);
+
+// Receives "length" Latin-1 bytes as a UTF-8 string for the caller to free
+char*
+conn_recvString(squirt_conn_t* conn, uint32_t length, const char* what);
@@ -79,11 +79,17 @@ crc32_init(crc32_ctx_t* ctx)
 }
 
 
+// the whole block in a register, rather than a call and a store for every byte
 static void
-crc32_computeUint8(crc32_ctx_t* ctx, uint8_t data)
+crc32_computeBlock(crc32_ctx_t* ctx, const uint8_t* data, int len)
 {
-  COMPUTE(ctx->crc, data);
-  ctx->length++;
+  uint32_t crc = ctx->crc;
+  const uint8_t* end = data + len;
+  while (data < end) {
+    COMPUTE(crc, *data++);
+  }
+  ctx->crc = crc;
+  ctx->length += len;
 }
 
 
@@ -97,46 +103,68 @@ crc32_finilize(crc32_ctx_t* ctx)
   ctx->crc = ~ctx->crc;
 }
 
+#ifdef AMIGA
 static char buffer[4096];
 
 int
 crc32_sum(const char* filename, uint32_t *outCrc)
 {
-#ifdef AMIGA
   int fd = Open((APTR)filename, MODE_OLDFILE);
   if (!fd) {
     return -1;
   }
-#else
-  FILE* fp = fopen(filename, "rb");
-  if (!fp) {
-    return -1;
-  }
-#endif
 
   int len;
 
   crc32_ctx_t crc;
   crc32_init(&crc);
 
-#ifdef AMIGA
   while((len = Read(fd, buffer, sizeof(buffer))) > 0) {
-#else
-  while((len = fread(buffer, 1, sizeof(buffer), fp))) {
-#endif
-    char* ptr = buffer;
-    while (len--) {
-      crc32_computeUint8(&crc, *ptr++);
-    }
+    crc32_computeBlock(&crc, (uint8_t*)buffer, len);
   }
 
   crc32_finilize(&crc);
 
   *outCrc = crc.crc;
-#ifdef AMIGA
   Close(fd);
+  return 0;
+}
 #else
-  fclose(fp);
-#endif
+int
+crc32_sumFile(FILE* fp, uint32_t *outCrc)
+{
+  // on the stack as the host hashes files from several threads
+  uint8_t buffer[32768];
+  int len;
+
+  crc32_ctx_t crc;
+  crc32_init(&crc);
+
+  while((len = fread(buffer, 1, sizeof(buffer), fp))) {
+    crc32_computeBlock(&crc, buffer, len);
+  }
+
+  if (ferror(fp)) {
+    return -1;
+  }
+
+  crc32_finilize(&crc);
+
+  *outCrc = crc.crc;
   return 0;
 }
+
+
+int
+crc32_sum(const char* filename, uint32_t *outCrc)
+{
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    return -1;
+  }
+
+  int error = crc32_sumFile(fp, outCrc);
+  fclose(fp);
+  return error;
+}
+#endif
@@ -4,5 +4,12 @@
 int
 crc32_sum(const char* filename, uint32_t *outCrc);
 
+#ifndef AMIGA
+#include <stdio.h>
+
+int
+crc32_sumFile(FILE* fp, uint32_t *outCrc);
+#endif
+
 int
 chsum32_sum(const char* filename, uint32_t *outCrc);
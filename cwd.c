@@ -15,41 +15,103 @@ cwd_cleanup(void)
 }
 
 
-const char*
-cwd_read(void)
+char*
+cwd_connRead(squirt_conn_t* conn)
 {
-  static const char* command = "cwd";
+  uint32_t nameLength, error;
 
-  if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_CWD) != 0) {
-    fatalError("failed to connect to squirtd server");
-  }
+  conn_sendCommand(conn, SQUIRT_COMMAND_CWD);
+  conn_sendString(conn, "cwd", "command");
 
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, command) != 0) {
-    fatalError("send() command failed");
+  if (conn_recvU32(conn, &nameLength, "cwd length") != 0) {
+    return 0;
   }
 
-  uint32_t nameLength;
-  if (util_recvU32(main_socketFd, &nameLength) != 0) {
-    fatalError("failed to get cwd length");
+  char *cwd = conn_recvString(conn, nameLength, "cwd");
+
+  if (cwd && conn_recvU32(conn, &error, "remote status") != 0) {
+    free(cwd);
+    cwd = 0;
   }
 
-  char *cwd = util_recvLatin1AsUtf8(main_socketFd, nameLength);
+  return cwd;
+}
 
-  if (!cwd) {
-    fatalError("failed to get cwd");
-  }
 
-  uint32_t error;
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("cwd: failed to read remote status");
-  }
+const char*
+cwd_read(void)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  char* cwd = cwd_connRead(&conn);
 
+  conn_detach(&conn);
   cwd_cleanup();
 
   return cwd;
 }
 
 
+// servers without SQUIRT_COMMAND_CD_CWD get a CD followed by a CWD
+static int cwd_noCdCwd = 0;
+
+
+int
+cwd_connChange(squirt_conn_t* conn, const char* dir, char** cwd)
+{
+  uint32_t word, error;
+
+  *cwd = 0;
+
+  if (!cwd_noCdCwd) {
+    conn_sendCommand(conn, SQUIRT_COMMAND_CD_CWD);
+    conn_sendString(conn, dir, "directory");
+
+    if (conn_recvU32(conn, &word, "remote reply") != 0) {
+      return conn->error;
+    }
+
+    if (word & SQUIRT_CD_CWD_REPLY) {
+      uint32_t nameLength = word & ~SQUIRT_CD_CWD_REPLY;
+      char* name = nameLength ? conn_recvString(conn, nameLength, "cwd") : 0;
+
+      if (conn_recvU32(conn, &error, "remote status") != 0 || error) {
+	free(name);
+	return conn->error ? conn->error : error;
+      }
+
+      *cwd = name;
+      return 0;
+    }
+
+    // that was the status of an older squirtd, which didn't change directory
+    cwd_noCdCwd = 1;
+  }
+
+  if ((error = exec_connCd(conn, dir)) != 0) {
+    return error;
+  }
+
+  *cwd = cwd_connRead(conn);
+  return conn->error;
+}
+
+
+int
+cwd_change(const char* dir, char** cwd)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  int error = cwd_connChange(&conn, dir, cwd);
+
+  conn_detach(&conn);
+
+  return error;
+}
+
+
 void
 cwd_main(int argc, char* argv[])
 {
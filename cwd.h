@@ -1,10 +1,23 @@
 #pragma once
+#include "conn.h"
 
 void
 cwd_cleanup(void);
 
+// Returns the current directory for the caller to free, or 0 if the
+// connection failed
+char*
+cwd_connRead(squirt_conn_t* conn);
+
 const char*
 cwd_read(void);
 
+// changes directory and returns the new canonical cwd in one round trip
+int
+cwd_connChange(squirt_conn_t* conn, const char* dir, char** cwd);
+
+int
+cwd_change(const char* dir, char** cwd);
+
 void
 cwd_main(int argc, char* argv[]);
@@ -7,11 +7,21 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "main.h"
 #include "common.h"
+#include "latin1.h"
+#include "async.h"
+
+typedef struct {
+  uint32_t digest;
+  dir_entry_t* entry;
+} dir_digest_t;
 
 static dir_entry_list_t* dir_entryLists = 0;
+// the cli completion prefetch reads listings from its own thread
+static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 dir_entry_list_t*
@@ -21,6 +31,7 @@ dir_newEntryList(void)
   list->next = NULL;
   list->prev = NULL;
 
+  pthread_mutex_lock(&dir_mutex);
   if (dir_entryLists == 0) {
     dir_entryLists = list;
   } else {
@@ -31,6 +42,7 @@ dir_newEntryList(void)
     ptr->next = list;
     list->prev = ptr;
   }
+  pthread_mutex_unlock(&dir_mutex);
   return list;
 }
 
@@ -49,7 +61,7 @@ dir_newDirEntry(void)
 }
 
 
-static void
+void
 dir_pushDirEntry(dir_entry_list_t* list, const char* name, int32_t type, uint32_t size, uint32_t prot, uint32_t days, uint32_t mins, uint32_t ticks, const char* comment)
 {
   dir_entry_t* entry = dir_newDirEntry();
@@ -91,6 +103,7 @@ dir_freeEntry(dir_entry_t* ptr)
 void
 dir_freeEntryLists(void)
 {
+  pthread_mutex_lock(&dir_mutex);
   dir_entry_list_t* ptr = dir_entryLists;
 
   while (ptr) {
@@ -106,12 +119,14 @@ dir_freeEntryLists(void)
     free(save);
   }
   dir_entryLists = 0;
+  pthread_mutex_unlock(&dir_mutex);
 }
 
 
 void
 dir_freeEntryList(dir_entry_list_t* list)
 {
+  pthread_mutex_lock(&dir_mutex);
   dir_entry_list_t* ptr = dir_entryLists;
   while (ptr) {
     if (ptr == list) {
@@ -128,6 +143,7 @@ dir_freeEntryList(dir_entry_list_t* list)
     }
     ptr = ptr->next;
   }
+  pthread_mutex_unlock(&dir_mutex);
 
   dir_entry_t* entry = list->head;
 
@@ -210,108 +226,516 @@ squirt_dirPrintEntryList( dir_entry_list_t* list)
 }
 
 
-static uint32_t
-dir_getDirEntry(dir_entry_list_t* entryList)
+// Returns 0 at the end of the listing or once the connection has failed
+static int
+dir_connGetDirEntry(squirt_conn_t* conn, dir_entry_list_t* entryList)
 {
   uint32_t nameLength;
 
-  if (util_recvU32(main_socketFd, &nameLength) != 0) {
-    fatalError("failed to read name length");
+  if (conn_recvU32(conn, &nameLength, "name length") != 0 || nameLength == 0xFFFFFFFF) {
+    return 0;
   }
 
-  if (nameLength == 0xFFFFFFFF) {
+  int compact = (nameLength & SQUIRT_DIR_COMPACT_ENTRY) != 0;
+  nameLength &= ~SQUIRT_DIR_COMPACT_ENTRY;
+
+  char* buffer = conn_recvString(conn, nameLength, "name");
+
+  if (!buffer) {
     return 0;
   }
 
-  char* buffer = util_recvLatin1AsUtf8(main_socketFd, nameLength);
+  if (compact) {
+    dir_pushDirEntry(entryList, buffer, 0, 0, 0, 0, 0, 0, 0);
+    return 1;
+  }
 
-  if (!buffer) {
-    fatalError("failed to read name");
+  // type, size, protection, days, mins, ticks and the comment length
+  uint32_t fields[7];
+  if (conn_recv(conn, fields, sizeof(fields), "entry") != 0) {
+    free(buffer);
+    return 0;
+  }
+  for (int i = 0; i < countof(fields); i++) {
+    fields[i] = ntohl(fields[i]);
   }
 
-  int32_t type;
-  if (util_recv32(main_socketFd, &type) != 0) {
-    fatalError("failed to read type");
+  char* comment = 0;
+  if (fields[6] > 0 && !(comment = conn_recvString(conn, fields[6], "comment"))) {
+    free(buffer);
+    return 0;
   }
 
-  uint32_t size;
-  if (util_recvU32(main_socketFd, &size) != 0) {
-    fatalError("failed to read file size");
+  dir_pushDirEntry(entryList, buffer, (int32_t)fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], comment);
+
+  return 1;
+}
+
+
+dir_entry_list_t*
+dir_connRead(squirt_conn_t* conn, const char* command)
+{
+  conn_sendCommand(conn, SQUIRT_COMMAND_DIR);
+  conn_sendString(conn, command, "directory");
+
+  dir_entry_list_t *entryList = dir_newEntryList();
+  while (dir_connGetDirEntry(conn, entryList));
+
+  uint32_t error;
+
+  if (conn_recvU32(conn, &error, "remote status") != 0 || error != 0) {
+    dir_freeEntryList(entryList);
+    entryList = 0;
   }
 
-  uint32_t prot;
-  if (util_recvU32(main_socketFd, &prot) != 0) {
-    fatalError("failed to read file prot");
+  return entryList;
+}
+
+
+dir_entry_list_t*
+dir_read(const char* command)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  dir_entry_list_t* entryList = dir_connRead(&conn, command);
+
+  conn_detach(&conn);
+  dir_cleanup();
+
+  return entryList;
+}
+
+
+static int
+dir_compareDigests(const void* a, const void* b)
+{
+  uint32_t one = ((const dir_digest_t*)a)->digest;
+  uint32_t two = ((const dir_digest_t*)b)->digest;
+  return one < two ? -1 : one > two;
+}
+
+
+// Latin-1 form of "utf8" in "buffer", or in an allocation if it doesn't fit
+static char*
+dir_toLatin1(char* buffer, size_t size, const char* utf8, size_t* length)
+{
+  size_t utf8Length = strlen(utf8);
+  char* latin1 = utf8Length < size ? buffer : malloc(utf8Length+1);
+  if (!latin1) {
+    fatalError("malloc failed");
   }
+  latin1_fromUtf8(latin1, length, utf8, utf8Length);
+  return latin1;
+}
+
+
+static uint32_t
+dir_digestEntry(dir_entry_t* entry)
+{
+  // every known entry is digested, so names and comments are converted on the stack
+  char nameBuffer[256], commentBuffer[256];
+  size_t nameLength, commentLength;
+  char* name = dir_toLatin1(nameBuffer, sizeof(nameBuffer), entry->name, &nameLength);
+  char* comment = dir_toLatin1(commentBuffer, sizeof(commentBuffer), entry->comment ? entry->comment : "", &commentLength);
+
+  uint32_t digest = squirt_digestEntry(name, nameLength, entry->type, entry->size, entry->prot, entry->ds.days, entry->ds.mins, entry->ds.ticks, comment, commentLength);
 
-  uint32_t days;
-  if (util_recvU32(main_socketFd, &days) != 0) {
-    fatalError("failed to read file days");
+  if (name != nameBuffer) {
+    free(name);
+  }
+  if (comment != commentBuffer) {
+    free(comment);
   }
 
+  return digest;
+}
 
-  uint32_t mins;
-  if (util_recvU32(main_socketFd, &mins) != 0) {
-    fatalError("failed to read file mins");
+
+static uint32_t
+dir_buildDigests(dir_entry_list_t* known, dir_digest_t** digests)
+{
+  uint32_t count = 0;
+  *digests = 0;
+
+  for (dir_entry_t* entry = known ? known->head : 0; entry; entry = entry->next) {
+    count++;
   }
 
-  uint32_t ticks;
-  if (util_recvU32(main_socketFd, &ticks) != 0) {
-    fatalError("failed to read file ticks");
+  if (count == 0 || count > SQUIRT_DIR_MAX_DIGESTS) {
+    return 0;
   }
 
-  uint32_t commentLength;
-  if (util_recvU32(main_socketFd, &commentLength) != 0) {
-    fatalError("failed to read comment length");
+  *digests = malloc(count * sizeof(dir_digest_t));
+  if (!*digests) {
+    fatalError("malloc failed");
   }
 
-  char* comment;
-  if (commentLength > 0) {
-    comment = util_recvLatin1AsUtf8(main_socketFd, commentLength);
-  } else {
-    comment = 0;
+  uint32_t i = 0;
+  for (dir_entry_t* entry = known->head; entry; entry = entry->next, i++) {
+    (*digests)[i].digest = dir_digestEntry(entry);
+    (*digests)[i].entry = entry;
   }
 
-  dir_pushDirEntry(entryList, buffer, type, size, prot, days, mins, ticks, comment);
+  qsort(*digests, count, sizeof(dir_digest_t), dir_compareDigests);
 
-  return 1;
+  // a collision would make the server match the wrong entry, so send neither
+  uint32_t unique = 0;
+  for (i = 0; i < count; i++) {
+    int duplicate =
+      (i > 0 && (*digests)[i-1].digest == (*digests)[i].digest) ||
+      (i < count-1 && (*digests)[i+1].digest == (*digests)[i].digest);
+    if (!duplicate) {
+      (*digests)[unique++] = (*digests)[i];
+    }
+  }
+
+  return unique;
+}
+
+
+static dir_entry_list_t*
+dir_connRecvChanged(squirt_conn_t* conn, dir_digest_t* digests, uint32_t count)
+{
+  dir_entry_list_t *entryList = dir_newEntryList();
+  while (dir_connGetDirEntry(conn, entryList));
+
+  if (count) {
+    uint32_t matchedLength = (count + 7) / 8;
+    uint8_t* matched = malloc(matchedLength);
+    if (!matched) {
+      fatalError("malloc failed");
+    }
+    if (conn_recv(conn, matched, matchedLength, "unchanged entries") == 0) {
+      for (uint32_t i = 0; i < count; i++) {
+	if (matched[i/8] & (1 << (i%8))) {
+	  dir_entry_t* entry = digests[i].entry;
+	  char* name = strdup(entry->name);
+	  char* comment = entry->comment ? strdup(entry->comment) : 0;
+	  if (!name || (entry->comment && !comment)) {
+	    fatalError("malloc failed");
+	  }
+	  dir_pushDirEntry(entryList, name, entry->type, entry->size, entry->prot, entry->ds.days, entry->ds.mins, entry->ds.ticks, comment);
+	}
+      }
+    }
+    free(matched);
+  }
+
+  return entryList;
 }
 
 
+// Until squirtd has answered a DIR_SINCE, the filter waits for its reply. Once
+// it's known to have the command the filter follows the name straight away,
+// and an older squirtd is sent a plain DIR.
+static int dir_sinceSupport = 0;
+
+
 dir_entry_list_t*
-dir_read(const char* command)
+dir_connReadChanged(squirt_conn_t* conn, const char* command, dir_datestamp_t* since, dir_entry_list_t* known)
 {
-  if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_DIR) != 0) {
-    fatalError("failed to connect to squirtd server %d", main_socketFd);
+  if (dir_sinceSupport < 0) {
+    return dir_connRead(conn, command);
   }
 
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, command) != 0) {
-    fatalError("send() command failed");
+  dir_digest_t* digests;
+  uint32_t count = dir_buildDigests(known, &digests);
+
+  conn_sendCommand(conn, SQUIRT_COMMAND_DIR_SINCE);
+  conn_sendString(conn, command, "directory");
+
+  int waited = dir_sinceSupport == 0;
+  if (waited && !conn_recvAccepted(conn, &dir_sinceSupport)) {
+    if (digests) {
+      free(digests);
+    }
+    // that was the status of a squirtd without the command
+    return conn->error ? 0 : dir_connRead(conn, command);
   }
 
-  uint32_t more;
-  dir_entry_list_t *entryList = dir_newEntryList();
-  do {
-    more = dir_getDirEntry(entryList);
-  } while (more);
+  // the datestamp, the digest count and the digests go in one send
+  uint32_t* filter = malloc((4 + count) * sizeof(uint32_t));
+  if (!filter) {
+    fatalError("malloc failed");
+  }
+  filter[0] = htonl(since ? since->days : 0);
+  filter[1] = htonl(since ? since->mins : 0);
+  filter[2] = htonl(since ? since->ticks : 0);
+  filter[3] = htonl(count);
+  for (uint32_t i = 0; i < count; i++) {
+    filter[4+i] = htonl(digests[i].digest);
+  }
+  conn_send(conn, filter, (4 + count) * sizeof(uint32_t), "filter");
+  free(filter);
 
-  uint32_t error;
+  if (!waited && !conn_recvAccepted(conn, &dir_sinceSupport)) {
+    if (digests) {
+      free(digests);
+    }
+    return 0;
+  }
 
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("dir: failed to read remote status: %s", command);
+  dir_entry_list_t *entryList = dir_connRecvChanged(conn, digests, count);
+  if (digests) {
+    free(digests);
   }
 
-  if (error != 0) {
+  uint32_t error;
+
+  if (conn_recvU32(conn, &error, "remote status") != 0 || error != 0) {
     dir_freeEntryList(entryList);
     entryList = 0;
   }
 
-  dir_cleanup();
+  return entryList;
+}
+
+
+dir_entry_list_t*
+dir_readChanged(const char* command, dir_datestamp_t* since, dir_entry_list_t* known)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  dir_entry_list_t* entryList = dir_connReadChanged(&conn, command, since, known);
+
+  conn_detach(&conn);
 
   return entryList;
 }
 
 
+typedef struct {
+  dir_manifest_t* dir;
+  char* path;
+  dir_digest_t* digests;
+  uint32_t count;
+} dir_manifest_block_t;
+
+
+// As with DIR_SINCE, the first manifest waits for squirtd to accept it, and
+// an older squirtd has each directory listed in turn instead
+static int dir_manifestSupport = 0;
+
+
+static void
+dir_freeManifestBlocks(dir_manifest_block_t* blocks, int blockCount)
+{
+  for (int i = 0; i < blockCount; i++) {
+    free(blocks[i].path);
+    if (blocks[i].digests) {
+      free(blocks[i].digests);
+    }
+  }
+  free(blocks);
+}
+
+
+static dir_manifest_t*
+dir_connSendManifest(squirt_conn_t* conn, dir_manifest_t* manifest, dir_manifest_block_t** blocks, int* blockCount, int waited)
+{
+  dir_manifest_t* first = manifest;
+
+  uint32_t length = 0;
+  int allocated = 0;
+  *blocks = 0;
+  *blockCount = 0;
+
+  for (; manifest; manifest = manifest->next) {
+    char* path = util_utf8ToLatin1(manifest->path);
+    if (!path) {
+      fatalError("malloc failed");
+    }
+
+    dir_digest_t* digests;
+    uint32_t count = dir_buildDigests(manifest->known, &digests);
+    uint32_t size = 8 + ((strlen(path)+4) & ~3) + count*sizeof(uint32_t);
+
+    // a manifest too big for squirtd to hold is sent as several requests
+    if (*blockCount && length + size > SQUIRT_MANIFEST_MAX_LENGTH) {
+      free(path);
+      if (digests) {
+	free(digests);
+      }
+      break;
+    }
+
+    if (*blockCount == allocated) {
+      allocated = allocated ? allocated*2 : 64;
+      *blocks = realloc(*blocks, allocated * sizeof(dir_manifest_block_t));
+      if (!*blocks) {
+	fatalError("malloc failed");
+      }
+    }
+
+    dir_manifest_block_t* block = &(*blocks)[(*blockCount)++];
+    block->dir = manifest;
+    block->path = path;
+    block->digests = digests;
+    block->count = count;
+    length += size;
+  }
+
+  uint8_t* buffer = calloc(1, length + sizeof(uint32_t));
+  if (!buffer) {
+    fatalError("malloc failed");
+  }
+
+  uint32_t* ptr = (uint32_t*)buffer;
+  *ptr++ = htonl(length);
+  for (int i = 0; i < *blockCount; i++) {
+    dir_manifest_block_t* block = &(*blocks)[i];
+    uint32_t pathLength = strlen(block->path);
+    *ptr++ = htonl(pathLength);
+    memcpy(ptr, block->path, pathLength);
+    ptr += (pathLength+4)/4;
+    *ptr++ = htonl(block->count);
+    for (uint32_t d = 0; d < block->count; d++) {
+      *ptr++ = htonl(block->digests[d].digest);
+    }
+  }
+
+  conn_sendCommand(conn, SQUIRT_COMMAND_MANIFEST);
+  conn_sendString(conn, "", "name");
+
+  if (waited && !conn_recvAccepted(conn, &dir_manifestSupport)) {
+    free(buffer);
+    dir_freeManifestBlocks(*blocks, *blockCount);
+    *blocks = 0;
+    *blockCount = 0;
+    return first;
+  }
+
+  conn_send(conn, buffer, length + sizeof(uint32_t), "manifest");
+  free(buffer);
+
+  return manifest;
+}
+
+
+uint32_t
+dir_connReadManifest(squirt_conn_t* conn, dir_manifest_t* manifest)
+{
+  uint32_t error = 0;
+
+  while (manifest && !error) {
+    if (dir_manifestSupport < 0) {
+      for (; manifest && !conn->error; manifest = manifest->next) {
+	manifest->remote = dir_connReadChanged(conn, manifest->path, 0, manifest->known);
+      }
+      return conn->error;
+    }
+
+    dir_manifest_block_t* blocks;
+    int blockCount;
+    int waited = dir_manifestSupport == 0;
+    manifest = dir_connSendManifest(conn, manifest, &blocks, &blockCount, waited);
+    if (blockCount == 0) {
+      // the connection failed or that was the status of a squirtd without the command
+      if (conn->error) {
+	return conn->error;
+      }
+      continue;
+    }
+
+    if (!waited && !conn_recvAccepted(conn, &dir_manifestSupport)) {
+      dir_freeManifestBlocks(blocks, blockCount);
+      return conn->error;
+    }
+
+    for (int i = 0; i < blockCount && !conn->error; i++) {
+      dir_manifest_block_t* block = &blocks[i];
+      dir_entry_list_t* list = dir_connRecvChanged(conn, block->digests, block->count);
+      uint32_t status;
+      if (conn_recvU32(conn, &status, "directory status") == 0 && status == 0) {
+	block->dir->remote = list;
+      } else {
+	dir_freeEntryList(list);
+      }
+    }
+    dir_freeManifestBlocks(blocks, blockCount);
+
+    if (conn_recvU32(conn, &error, "remote status") != 0) {
+      return conn->error;
+    }
+  }
+
+  return error;
+}
+
+
+void
+dir_readManifest(dir_manifest_t* manifest)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  uint32_t error = dir_connReadManifest(&conn, manifest);
+
+  conn_detach(&conn);
+
+  if (error != 0) {
+    fatalError("dir: manifest failed: %s", util_getErrorString(error));
+  }
+}
+
+
+dir_manifest_t*
+dir_addManifest(dir_manifest_t** tail, const char* path, dir_entry_list_t* known)
+{
+  dir_manifest_t* manifest = calloc(1, sizeof(dir_manifest_t));
+  if (!manifest || !(manifest->path = strdup(path))) {
+    fatalError("malloc failed");
+  }
+  manifest->known = known;
+
+  if (*tail) {
+    (*tail)->next = manifest;
+  }
+  *tail = manifest;
+
+  return manifest;
+}
+
+
+dir_manifest_t*
+dir_findManifest(dir_manifest_t* manifest, dir_manifest_t* from, const char* path)
+{
+  for (dir_manifest_t* ptr = from; ptr; ptr = ptr->next) {
+    if (strcmp(ptr->path, path) == 0) {
+      return ptr;
+    }
+  }
+
+  for (; manifest != from; manifest = manifest->next) {
+    if (strcmp(manifest->path, path) == 0) {
+      return manifest;
+    }
+  }
+
+  return 0;
+}
+
+
+void
+dir_freeManifest(dir_manifest_t* manifest)
+{
+  while (manifest) {
+    dir_manifest_t* save = manifest;
+    manifest = manifest->next;
+    if (save->known) {
+      dir_freeEntryList(save->known);
+    }
+    if (save->remote) {
+      dir_freeEntryList(save->remote);
+    }
+    free(save->path);
+    free(save);
+  }
+}
+
+
 int
 dir_process(const char* command, void(*process)(dir_entry_list_t*))
 {
@@ -338,8 +762,22 @@ dir_main(int argc, char* argv[])
     fatalError("incorrect number of arguments\nusage: %s hostname dir_name", main_argv0);
   }
 
-  util_connect(argv[1]);
-  if (dir_process(argv[2], squirt_dirPrintEntryList) != 0) {
+  async_engine_t* engine = async_newEngine();
+  async_conn_t* conn = async_connect(engine, argv[1]);
+  dir_entry_list_t* list = 0;
+  uint32_t error = 0;
+
+  async_dir(conn, argv[2], &list, async_storeError, &error);
+
+  if (async_run(engine) != 0) {
+    fatalError("%s", conn_errorString(async_session(conn)));
+  }
+
+  if (!list) {
     fatalError("unable to read %s", argv[2]);
   }
+
+  squirt_dirPrintEntryList(list);
+  dir_freeEntryList(list);
+  async_freeEngine(engine);
 }
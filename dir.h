@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include "conn.h"
 
 #define DIR_AMIGA_EPOC_ADJUSTMENT_DAYS 2922
 
@@ -45,9 +46,60 @@ dir_freeEntry(dir_entry_t* ptr);
 dir_entry_t*
 dir_newDirEntry(void);
 
+dir_entry_list_t*
+dir_newEntryList(void);
+
+// Appends an entry to "list", which takes ownership of "name" and "comment"
+void
+dir_pushDirEntry(dir_entry_list_t* list, const char* name, int32_t type, uint32_t size, uint32_t prot, uint32_t days, uint32_t mins, uint32_t ticks, const char* comment);
+
 dir_entry_list_t*
 dir_read(const char* command);
 
+// dir_read on "conn", returns 0 if the directory can't be read or the
+// connection failed, which sets its error
+dir_entry_list_t*
+dir_connRead(squirt_conn_t* conn, const char* command);
+
+// Only entries that changed since "since" (may be 0) or that don't match an
+// entry in "known" (may be 0) are sent in full. Entries in "known" that are
+// unchanged are copied into the returned list. Unchanged entries that aren't in
+// "known" are returned with only a name and type 0.
+dir_entry_list_t*
+dir_readChanged(const char* command, dir_datestamp_t* since, dir_entry_list_t* known);
+
+dir_entry_list_t*
+dir_connReadChanged(squirt_conn_t* conn, const char* command, dir_datestamp_t* since, dir_entry_list_t* known);
+
+// A directory in a SQUIRT_COMMAND_MANIFEST request. "known" is what the client
+// expects to find, "remote" is filled in by dir_readManifest the way
+// dir_readChanged would return it, or left 0 if the directory can't be read.
+typedef struct dir_manifest {
+  char* path;
+  dir_entry_list_t* known;
+  dir_entry_list_t* remote;
+  struct dir_manifest* next;
+} dir_manifest_t;
+
+// takes ownership of "known"
+dir_manifest_t*
+dir_addManifest(dir_manifest_t** tail, const char* path, dir_entry_list_t* known);
+
+void
+dir_readManifest(dir_manifest_t* manifest);
+
+// Returns the remote status or the connection's error
+uint32_t
+dir_connReadManifest(squirt_conn_t* conn, dir_manifest_t* manifest);
+
+// looks from "from" (may be 0) onwards first, so a walk in the order the
+// manifest was built finds each directory straight away
+dir_manifest_t*
+dir_findManifest(dir_manifest_t* manifest, dir_manifest_t* from, const char* path);
+
+void
+dir_freeManifest(dir_manifest_t* manifest);
+
 int
 dir_process(const char* command, void(*process)(dir_entry_list_t*));
 
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "common.h"
+
+#define DIRCACHE_MAX_ENTRIES  32
+#define DIRCACHE_MAX_BYTES    (4*1024*1024)
+#define DIRCACHE_MAX_AGE      5  // seconds a listing is trusted without asking squirtd
+#define DIRCACHE_MAX_PREFETCH 16 // child directories queued per listing
+
+typedef struct dircache_entry {
+  char* path;
+  dir_entry_list_t* list;
+  complete_index_t* index;  // built the first time the listing is completed against
+  size_t bytes;
+  time_t validated;
+  struct dircache_entry* next;
+} dircache_entry_t;
+
+typedef struct dircache_prefetch {
+  char* path;
+  int depth;
+  struct dircache_prefetch* next;
+} dircache_prefetch_t;
+
+// most recently used first
+static dircache_entry_t* dircache_head = 0;
+static int dircache_count = 0;
+static size_t dircache_bytes = 0;
+
+// Listings are prefetched by a thread with its own squirtd session, when the
+// server will serve one. The thread only ever adds listings, so lists handed
+// out by dircache_read stay valid while it runs.
+static pthread_mutex_t dircache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dircache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t dircache_thread;
+static int dircache_threadStarted = 0;
+static int dircache_fetching = 0;
+static int dircache_shutdown = 0;
+static uint32_t dircache_generation = 0;
+static char* dircache_hostname = 0;
+static dircache_prefetch_t* dircache_queue = 0;
+static dircache_prefetch_t* dircache_queueTail = 0;
+
+
+static void
+dircache_freeEntry(dircache_entry_t* entry)
+{
+  if (entry->list) {
+    dir_freeEntryList(entry->list);
+  }
+  complete_freeIndex(entry->index);
+  free(entry->path);
+  free(entry);
+}
+
+
+static void
+dircache_clearQueue(void)
+{
+  while (dircache_queue) {
+    dircache_prefetch_t* next = dircache_queue->next;
+    free(dircache_queue->path);
+    free(dircache_queue);
+    dircache_queue = next;
+  }
+  dircache_queueTail = 0;
+}
+
+
+void
+dircache_cleanup(void)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  dircache_shutdown = 1;
+  dircache_clearQueue();
+  pthread_cond_signal(&dircache_cond);
+  int fetching = dircache_fetching;
+  pthread_mutex_unlock(&dircache_mutex);
+
+  if (dircache_threadStarted) {
+    // a listing in flight may take a slow round trip, the thread drops it on the floor
+    if (fetching) {
+      pthread_detach(dircache_thread);
+    } else {
+      pthread_join(dircache_thread, 0);
+    }
+    dircache_threadStarted = 0;
+  }
+
+  pthread_mutex_lock(&dircache_mutex);
+  while (dircache_head) {
+    dircache_entry_t* next = dircache_head->next;
+    dircache_freeEntry(dircache_head);
+    dircache_head = next;
+  }
+  dircache_count = 0;
+  dircache_bytes = 0;
+
+  if (dircache_hostname) {
+    free(dircache_hostname);
+    dircache_hostname = 0;
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+}
+
+
+static size_t
+dircache_listBytes(dir_entry_list_t* list)
+{
+  size_t bytes = sizeof(dir_entry_list_t);
+  for (dir_entry_t* entry = list->head; entry; entry = entry->next) {
+    bytes += sizeof(dir_entry_t) + strlen(entry->name) + 1;
+    if (entry->comment) {
+      bytes += strlen(entry->comment) + 1;
+    }
+  }
+  return bytes;
+}
+
+
+// caller holds dircache_mutex, leaves the LRU order alone
+static dircache_entry_t*
+dircache_lookup(const char* path)
+{
+  for (dircache_entry_t* entry = dircache_head; entry; entry = entry->next) {
+    // AmigaDOS paths are case insensitive
+    if (strcasecmp(entry->path, path) == 0) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+
+// caller holds dircache_mutex
+static dircache_entry_t*
+dircache_find(const char* path)
+{
+  dircache_entry_t** ptr = &dircache_head;
+  while (*ptr) {
+    dircache_entry_t* entry = *ptr;
+    if (strcasecmp(entry->path, path) == 0) {
+      *ptr = entry->next;
+      entry->next = dircache_head;
+      dircache_head = entry;
+      return entry;
+    }
+    ptr = &entry->next;
+  }
+  return 0;
+}
+
+
+// caller holds dircache_mutex
+static void
+dircache_remove(dircache_entry_t* entry)
+{
+  dircache_entry_t** ptr = &dircache_head;
+  while (*ptr != entry) {
+    ptr = &(*ptr)->next;
+  }
+  *ptr = entry->next;
+  dircache_count--;
+  dircache_bytes -= entry->bytes;
+  dircache_freeEntry(entry);
+}
+
+
+// caller holds dircache_mutex
+// prefetched listings go behind everything the user has touched, so they are
+// the first to go when space is needed
+static dircache_entry_t*
+dircache_add(const char* path, dir_entry_list_t* list, int prefetched)
+{
+  dircache_entry_t* entry = malloc(sizeof(dircache_entry_t));
+  if (!entry || !(entry->path = strdup(path))) {
+    fatalError("malloc failed");
+  }
+  entry->list = list;
+  entry->index = 0;
+  entry->bytes = dircache_listBytes(list);
+  entry->validated = time(0);
+
+  dircache_entry_t** ptr = &dircache_head;
+  while (prefetched && *ptr) {
+    ptr = &(*ptr)->next;
+  }
+  entry->next = *ptr;
+  *ptr = entry;
+  dircache_count++;
+  dircache_bytes += entry->bytes;
+
+  while (dircache_count > DIRCACHE_MAX_ENTRIES || (dircache_bytes > DIRCACHE_MAX_BYTES && dircache_count > 1)) {
+    dircache_entry_t* last = dircache_head;
+    while (last->next) {
+      last = last->next;
+    }
+    dircache_remove(last);
+  }
+
+  return entry;
+}
+
+
+// caller holds dircache_mutex
+static void
+dircache_queuePrefetch(const char* path, int depth)
+{
+  dircache_prefetch_t* item = malloc(sizeof(dircache_prefetch_t));
+  if (!item || !(item->path = strdup(path))) {
+    fatalError("malloc failed");
+  }
+  item->depth = depth;
+  item->next = 0;
+
+  if (dircache_queueTail) {
+    dircache_queueTail->next = item;
+  } else {
+    dircache_queue = item;
+  }
+  dircache_queueTail = item;
+}
+
+
+// caller holds dircache_mutex
+static int
+dircache_isQueued(const char* path)
+{
+  for (dircache_prefetch_t* item = dircache_queue; item; item = item->next) {
+    if (strcasecmp(item->path, path) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+// caller holds dircache_mutex
+static void
+dircache_queueChildren(const char* path, dir_entry_list_t* list, int depth)
+{
+  int queued = 0;
+  char child[PATH_MAX];
+  int length = strlen(path);
+
+  for (dir_entry_t* entry = list->head; entry && queued < DIRCACHE_MAX_PREFETCH; entry = entry->next) {
+    if (entry->type <= 0) {
+      continue;
+    }
+    snprintf(child, sizeof(child), "%s%s%s", path, length && path[length-1] != ':' ? "/" : "", entry->name);
+    if (!dircache_lookup(child) && !dircache_isQueued(child)) {
+      dircache_queuePrefetch(child, depth);
+      queued++;
+    }
+  }
+
+  if (queued) {
+    pthread_cond_signal(&dircache_cond);
+  }
+}
+
+
+// caller holds dircache_mutex
+static void
+dircache_disable(void)
+{
+  dircache_clearQueue();
+  if (dircache_hostname) {
+    free(dircache_hostname);
+    dircache_hostname = 0;
+  }
+}
+
+
+static void*
+dircache_prefetchThread(void* arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&dircache_mutex);
+  char* hostname = dircache_hostname ? strdup(dircache_hostname) : 0;
+  dircache_fetching = 1;
+  pthread_mutex_unlock(&dircache_mutex);
+
+  squirt_conn_t* conn = hostname ? conn_openSession(hostname) : 0;
+  free(hostname);
+
+  pthread_mutex_lock(&dircache_mutex);
+  dircache_fetching = 0;
+  if (!conn) {
+    // prefetching is only ever a head start, so it quietly stops
+    dircache_disable();
+  }
+
+  while (conn && !dircache_shutdown) {
+    if (!dircache_queue) {
+      pthread_cond_wait(&dircache_cond, &dircache_mutex);
+      continue;
+    }
+
+    dircache_prefetch_t* item = dircache_queue;
+    dircache_queue = item->next;
+    if (!dircache_queue) {
+      dircache_queueTail = 0;
+    }
+
+    // prefetching never pushes out a listing that was actually used
+    if (!dircache_lookup(item->path) && dircache_count < DIRCACHE_MAX_ENTRIES && dircache_bytes < DIRCACHE_MAX_BYTES) {
+      uint32_t generation = dircache_generation;
+      dircache_fetching = 1;
+      pthread_mutex_unlock(&dircache_mutex);
+
+      dir_entry_list_t* list = dir_connRead(conn, item->path);
+
+      pthread_mutex_lock(&dircache_mutex);
+      dircache_fetching = 0;
+      if (dircache_shutdown || conn->error) {
+	// cleanup is freeing the dir lists, leave this one alone
+	if (list) {
+	  dir_freeEntryList(list);
+	}
+	if (!dircache_shutdown) {
+	  dircache_disable();
+	}
+	free(item->path);
+	free(item);
+	break;
+      }
+
+      if (list) {
+	size_t bytes = dircache_listBytes(list);
+	int stale = generation != dircache_generation;
+	int exists = dircache_lookup(item->path) != 0;
+	if (stale || exists || dircache_count >= DIRCACHE_MAX_ENTRIES || dircache_bytes + bytes > DIRCACHE_MAX_BYTES) {
+	  dir_freeEntryList(list);
+	} else {
+	  dircache_add(item->path, list, 1);
+	  if (item->depth > 0) {
+	    dircache_queueChildren(item->path, list, item->depth-1);
+	  }
+	}
+      }
+    }
+
+    free(item->path);
+    free(item);
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+
+  if (conn) {
+    conn_close(conn);
+  }
+
+  return 0;
+}
+
+
+void
+dircache_enablePrefetch(const char* hostname)
+{
+  dircache_hostname = strdup(hostname);
+  if (!dircache_hostname) {
+    fatalError("malloc failed");
+  }
+}
+
+
+// caller holds dircache_mutex
+static void
+dircache_startThread(void)
+{
+  if (!dircache_threadStarted && dircache_hostname) {
+    if (pthread_create(&dircache_thread, 0, dircache_prefetchThread, 0) != 0) {
+      fatalError("failed to start prefetch thread");
+    }
+    dircache_threadStarted = 1;
+  }
+}
+
+
+void
+dircache_prefetch(const char* path)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  if (dircache_hostname && !dircache_shutdown) {
+    dircache_startThread();
+    dircache_entry_t* entry = dircache_find(path);
+    if (entry) {
+      dircache_queueChildren(path, entry->list, 0);
+    } else {
+      dircache_queuePrefetch(path, 1);
+      pthread_cond_signal(&dircache_cond);
+    }
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+}
+
+
+void
+dircache_cancelPrefetch(void)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  dircache_clearQueue();
+  dircache_generation++;
+  pthread_mutex_unlock(&dircache_mutex);
+}
+
+
+dir_entry_list_t*
+dircache_read(const char* path)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  dircache_entry_t* entry = dircache_find(path);
+  dir_entry_list_t* known = entry ? entry->list : 0;
+  time_t now = time(0);
+
+  if (entry && now - entry->validated < DIRCACHE_MAX_AGE) {
+    if (dircache_hostname && !dircache_shutdown) {
+      dircache_startThread();
+      dircache_queueChildren(path, known, 0);
+    }
+    pthread_mutex_unlock(&dircache_mutex);
+    return known;
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+
+  // only entries that don't match the cached digests are sent in full
+  dir_entry_list_t* list = known ? dir_readChanged(path, 0, known) : dir_read(path);
+
+  pthread_mutex_lock(&dircache_mutex);
+  // the prefetch thread never removes entries, so "entry" is still cached
+  if (entry) {
+    if (!list) {
+      dircache_remove(entry);
+    } else {
+      dir_freeEntryList(entry->list);
+      complete_freeIndex(entry->index);
+      entry->index = 0;
+      dircache_bytes -= entry->bytes;
+      entry->list = list;
+      entry->bytes = dircache_listBytes(list);
+      dircache_bytes += entry->bytes;
+      entry->validated = now;
+    }
+  } else if (list) {
+    if ((entry = dircache_find(path))) {
+      // prefetched while this read was in flight
+      dir_freeEntryList(entry->list);
+      complete_freeIndex(entry->index);
+      entry->index = 0;
+      dircache_bytes -= entry->bytes;
+      entry->list = list;
+      entry->bytes = dircache_listBytes(list);
+      dircache_bytes += entry->bytes;
+      entry->validated = now;
+    } else {
+      dircache_add(path, list, 0);
+    }
+  }
+
+  if (list && dircache_hostname && !dircache_shutdown) {
+    dircache_startThread();
+    dircache_queueChildren(path, list, 0);
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+
+  return list;
+}
+
+
+complete_index_t*
+dircache_index(const char* path)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  dircache_entry_t* entry = dircache_lookup(path);
+  if (entry && !entry->index) {
+    entry->index = complete_newIndex();
+    for (dir_entry_t* ptr = entry->list->head; ptr; ptr = ptr->next) {
+      // icons aren't offered, as in the Amiga shell
+      int length = strlen(ptr->name);
+      if (length < 5 || strcasecmp(&ptr->name[length-5], ".info") != 0) {
+	complete_add(entry->index, ptr->name, ptr->type);
+      }
+    }
+    complete_sort(entry->index);
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+  return entry ? entry->index : 0;
+}
+
+
+void
+dircache_invalidate(const char* path)
+{
+  pthread_mutex_lock(&dircache_mutex);
+  for (dircache_entry_t* entry = dircache_head; entry; entry = entry->next) {
+    if (!path || strcasecmp(entry->path, path) == 0) {
+      entry->validated = 0;
+    }
+  }
+  pthread_mutex_unlock(&dircache_mutex);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "dir.h"
+#include "complete.h"
+
+void
+dircache_cleanup(void);
+
+// Listing of "path" for tab completion. Fresh listings come straight from the
+// cache, older ones are revalidated with a single DIR_SINCE round trip. The list
+// belongs to the cache and is only valid until the next dircache_read call.
+dir_entry_list_t*
+dircache_read(const char* path);
+
+// Completion index of the listing of "path" last returned by dircache_read,
+// built once per listing and valid for as long as the listing is
+complete_index_t*
+dircache_index(const char* path);
+
+// Child directories of listings handed out by dircache_read are prefetched in
+// the background on a second session with "hostname". If squirtd won't serve
+// one, prefetching is quietly turned off.
+void
+dircache_enablePrefetch(const char* hostname);
+
+// Fetches "path" and its child directories in the background
+void
+dircache_prefetch(const char* path);
+
+// Drops queued prefetches and discards any listing already in flight
+void
+dircache_cancelPrefetch(void);
+
+// Forces "path", or every cached listing if path is 0, to be revalidated before
+// it is used again
+void
+dircache_invalidate(const char* path);
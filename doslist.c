@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "common.h"
+
+#define DOSLIST_MAX_AGE  30 // seconds between background refreshes
+#define DOSLIST_MAX_NAME 256
+
+typedef struct {
+  char** names;
+  int count;
+} doslist_t;
+
+static pthread_mutex_t doslist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char* doslist_hostname = 0;
+static doslist_t doslist_current = {0, 0};
+static doslist_t doslist_pending = {0, 0};
+static int doslist_refreshing = 0;
+static int doslist_unsupported = 0;
+static int doslist_mainSession = 0; // squirtd won't serve a second session
+static int doslist_shutdown = 0;
+static time_t doslist_refreshed = 0;
+
+
+static void
+doslist_free(doslist_t* list)
+{
+  if (list->names) {
+    for (int i = 0; i < list->count; i++) {
+      free(list->names[i]);
+    }
+    free(list->names);
+  }
+  list->names = 0;
+  list->count = 0;
+}
+
+
+void
+doslist_cleanup(void)
+{
+  pthread_mutex_lock(&doslist_mutex);
+  // a refresh still in flight is detached and drops its result
+  doslist_shutdown = 1;
+  doslist_free(&doslist_current);
+  doslist_free(&doslist_pending);
+  if (doslist_hostname) {
+    free(doslist_hostname);
+    doslist_hostname = 0;
+  }
+  pthread_mutex_unlock(&doslist_mutex);
+}
+
+
+static void
+doslist_add(doslist_t* list, const char* name)
+{
+  // a volume is often also mounted under its device name
+  for (int i = 0; i < list->count; i++) {
+    if (strcasecmp(list->names[i], name) == 0) {
+      return;
+    }
+  }
+
+  char** names = realloc(list->names, (list->count+1) * sizeof(char*));
+  if (!names) {
+    fatalError("malloc failed");
+  }
+  list->names = names;
+  list->names[list->count] = strdup(name);
+  if (!list->names[list->count]) {
+    fatalError("malloc failed");
+  }
+  list->count++;
+}
+
+
+static const char*
+doslist_getCacheFile(void)
+{
+  static char buffer[PATH_MAX];
+  snprintf(buffer, sizeof(buffer), "%s/.squirt_doslist_%s", util_getHomeDir(), doslist_hostname);
+
+  // one file per host, and the port separator isn't welcome in file names everywhere
+  for (char* ptr = buffer + strlen(buffer) - strlen(doslist_hostname); *ptr; ptr++) {
+    if (*ptr == ':' || *ptr == '/' || *ptr == '\\') {
+      *ptr = '_';
+    }
+  }
+  return buffer;
+}
+
+
+static void
+doslist_load(doslist_t* list)
+{
+  FILE* fp = fopen(doslist_getCacheFile(), "r");
+  if (!fp) {
+    return;
+  }
+
+  char line[DOSLIST_MAX_NAME+2];
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0]) {
+      doslist_add(list, line);
+    }
+  }
+  fclose(fp);
+}
+
+
+static void
+doslist_save(doslist_t* list)
+{
+  FILE* fp = fopen(doslist_getCacheFile(), "w");
+  if (fp) {
+    for (int i = 0; i < list->count; i++) {
+      fprintf(fp, "%s\n", list->names[i]);
+    }
+    fclose(fp);
+  }
+}
+
+
+// returns -1 if squirtd doesn't know SQUIRT_COMMAND_DOSLIST, or the
+// connection's error
+static int
+doslist_connRead(squirt_conn_t* conn, doslist_t* list)
+{
+  conn_sendCommand(conn, SQUIRT_COMMAND_DOSLIST);
+  conn_sendString(conn, "", "command");
+
+  uint32_t type;
+  while (1) {
+    if (conn_recvU32(conn, &type, "doslist entry") != 0) {
+      return conn->error;
+    }
+
+    if (type == 0) {
+      // that was the status of an older squirtd
+      return -1;
+    } else if (type == 0xFFFFFFFF) {
+      break;
+    }
+
+    uint32_t length;
+    if (conn_recvU32(conn, &length, "doslist entry") != 0) {
+      return conn->error;
+    }
+
+    if (length > DOSLIST_MAX_NAME) {
+      return conn_fail(conn, ERROR_FATAL_RECV_FAILED, "doslist: bad entry length %u", length);
+    }
+
+    char* name = conn_recvString(conn, length, "doslist entry");
+    if (!name) {
+      return conn->error;
+    }
+
+    char buffer[DOSLIST_MAX_NAME*2+2];
+    snprintf(buffer, sizeof(buffer), "%s:", name);
+    doslist_add(list, buffer);
+    free(name);
+  }
+
+  uint32_t error;
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
+  }
+
+  return error == 0 ? 0 : -1;
+}
+
+
+// caller holds doslist_mutex
+static void
+doslist_adopt(doslist_t* list, int error)
+{
+  if (error) {
+    doslist_unsupported = 1;
+    doslist_free(list);
+  } else {
+    doslist_free(&doslist_pending);
+    doslist_pending = *list;
+  }
+}
+
+
+// Without a second session the names are read on the cli's own, which is idle
+// between commands. Caller holds doslist_mutex.
+static void
+doslist_readOnMainSession(void)
+{
+  doslist_t list = {0, 0};
+  squirt_conn_t conn;
+
+  conn_attach(&conn, main_socketFd);
+  int error = doslist_connRead(&conn, &list);
+  conn_detach(&conn);
+
+  doslist_refreshed = time(0);
+  doslist_adopt(&list, error);
+}
+
+
+static void*
+doslist_refreshThread(void* arg)
+{
+  (void)arg;
+  doslist_t list = {0, 0};
+
+  pthread_mutex_lock(&doslist_mutex);
+  char* hostname = doslist_hostname ? strdup(doslist_hostname) : 0;
+  pthread_mutex_unlock(&doslist_mutex);
+
+  squirt_conn_t* conn = hostname ? conn_openSession(hostname) : 0;
+  free(hostname);
+
+  int error = conn ? doslist_connRead(conn, &list) : 0;
+  int failed = !conn || conn->error;
+  if (conn) {
+    conn_close(conn);
+  }
+
+  pthread_mutex_lock(&doslist_mutex);
+  if (doslist_shutdown) {
+    doslist_free(&list);
+  } else {
+    if (failed) {
+      doslist_mainSession = 1;
+      doslist_free(&list);
+    } else {
+      doslist_adopt(&list, error);
+    }
+    doslist_refreshing = 0;
+  }
+  pthread_mutex_unlock(&doslist_mutex);
+
+  return 0;
+}
+
+
+// caller holds doslist_mutex
+static void
+doslist_startRefresh(void)
+{
+  pthread_t thread;
+
+  if (doslist_refreshing || doslist_unsupported) {
+    return;
+  }
+
+  if (doslist_mainSession) {
+    doslist_readOnMainSession();
+    return;
+  }
+
+  doslist_refreshed = time(0);
+  doslist_refreshing = 1;
+  if (pthread_create(&thread, 0, doslist_refreshThread, 0) != 0) {
+    fatalError("failed to start doslist thread");
+  }
+  pthread_detach(thread);
+}
+
+
+void
+doslist_init(const char* hostname)
+{
+  doslist_hostname = strdup(hostname);
+  if (!doslist_hostname) {
+    fatalError("malloc failed");
+  }
+
+  doslist_load(&doslist_current);
+
+  pthread_mutex_lock(&doslist_mutex);
+  if (doslist_current.count) {
+    doslist_startRefresh();
+  } else {
+    // nothing cached from an earlier session, one round trip now saves the
+    // first Tab waiting on a second session
+    doslist_readOnMainSession();
+  }
+  pthread_mutex_unlock(&doslist_mutex);
+}
+
+
+int
+doslist_refresh(void)
+{
+  if (!doslist_hostname) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&doslist_mutex);
+
+  if (time(0) - doslist_refreshed > DOSLIST_MAX_AGE) {
+    doslist_startRefresh();
+  }
+
+  if (doslist_pending.names) {
+    doslist_free(&doslist_current);
+    doslist_current = doslist_pending;
+    doslist_pending.names = 0;
+    doslist_pending.count = 0;
+    doslist_save(&doslist_current);
+  }
+
+  int error = doslist_unsupported ? -1 : 0;
+  pthread_mutex_unlock(&doslist_mutex);
+
+  return error;
+}
+
+
+const char**
+doslist_names(int* count)
+{
+  *count = doslist_current.count;
+  return (const char**)doslist_current.names;
+}
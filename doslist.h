@@ -0,0 +1,22 @@
+#pragma once
+
+void
+doslist_cleanup(void);
+
+// Loads the names cached for "hostname" by an earlier session and starts a
+// background refresh on a second session. With nothing cached the names are
+// read on the thread's own session instead.
+void
+doslist_init(const char* hostname);
+
+// Adopts a finished background refresh and starts another one if the names
+// are getting old, or rereads them on the thread's own session if squirtd
+// won't serve a second one. Returns -1 if squirtd can't list the dos list
+// natively.
+int
+doslist_refresh(void);
+
+// Mounted devices, assigns and volumes with a trailing colon, valid until the
+// next doslist_refresh
+const char**
+doslist_names(int* count);
@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <utime.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -70,11 +69,11 @@ exall_scanComment(FILE* fp)
 
 
 int
-exall_saveExAllData(dir_entry_t* entry, const char* path)
+exall_saveExAllData(int dirFd, dir_entry_t* entry, const char* path)
 {
   const char* baseName = util_amigaBaseName(path);
   const char* ident = SQUIRT_EXALL_INFO_DIR_NAME;
-  util_mkdir(ident, 0777);
+  util_dirMkdir(dirFd, SQUIRT_EXALL_INFO_DIR);
   
   // Use util_safeName to handle Windows reserved filenames for metadata files
   char* safeBaseName = util_safeName(baseName);
@@ -88,7 +87,7 @@ exall_saveExAllData(dir_entry_t* entry, const char* path)
     return 0;
   }
   sprintf(name, "%s%s", ident, safeBaseName);
-  FILE *fp = fopen(name, "w");
+  FILE *fp = util_dirFopen(dirFd, name, "w");
 
   if (!fp) {
     free(name);
@@ -103,32 +102,20 @@ exall_saveExAllData(dir_entry_t* entry, const char* path)
   time_t _time = tv.tv_sec;
 
   struct tm *tm = gmtime(&_time);
-  struct utimbuf ut;
 
   struct stat st;
   
-  // Use util_safeName to handle Windows reserved filenames
-  char* safeBaseNameForFile = util_safeName(baseName);
-  if (!safeBaseNameForFile) {
-    fatalError("memory allocation failed for safe filename");
-  }
-
-  if (stat(safeBaseNameForFile, &st) != 0) {
+  if (util_dirStat(dirFd, safeBaseName, &st) != 0) {
     fatalError("failed to get file attributes of %s\n", baseName);
   }
 
-  ut.actime = st.st_atime;
-  ut.modtime = mktime(tm);
-
   if (
 #ifdef _WIN32
       !S_ISDIR(st.st_mode) &&
 #endif
-      utime(safeBaseNameForFile, &ut) != 0) {
+      util_dirSetModTime(dirFd, safeBaseName, mktime(tm)) != 0) {
     fatalError("failed to set file attributes of %s\n", baseName);
   }
-  
-  free(safeBaseNameForFile); // Free the allocated safe name
 
   fprintf(fp, "name:%s\n", entry->name);
   fprintf(fp, "type:%d\n", entry->type);
@@ -152,14 +139,14 @@ exall_saveExAllData(dir_entry_t* entry, const char* path)
 
 
 int
-exall_readExAllData(dir_entry_t* entry, const char* path)
+exall_readExAllData(int dirFd, dir_entry_t* entry, const char* path)
 {
    if (!entry) {
     fatalError("readExAllData called with null entry");
   }
   const char* baseName = util_amigaBaseName(path);
   const char* ident = SQUIRT_EXALL_INFO_DIR_NAME;
-  util_mkdir(ident, 0777);
+  util_dirMkdir(dirFd, SQUIRT_EXALL_INFO_DIR);
   
   // Use util_safeName to handle Windows reserved filenames for metadata files
   char* safeBaseName = util_safeName(baseName);
@@ -174,7 +161,7 @@ exall_readExAllData(dir_entry_t* entry, const char* path)
     return 0;
   }
   sprintf(name, "%s%s", ident, safeBaseName);
-  FILE *fp = fopen(name, "r+");
+  FILE *fp = util_dirFopen(dirFd, name, "r");
   
   // If file not found, try with the original name (backward compatibility)
   if (!fp) {
@@ -185,16 +172,12 @@ exall_readExAllData(dir_entry_t* entry, const char* path)
       return 0;
     }
     sprintf(name, "%s%s", ident, baseName);
-    fp = fopen(name, "r+");
+    fp = util_dirFopen(dirFd, name, "r");
   }
   
   free(safeBaseName);
   if (!fp) {
-    char* cwd = getcwd(0, 0);
-    if (!cwd) {
-      perror("cwd failed");
-    }
-    fprintf(stderr, "unable to open %s cwd = %s\n", name, cwd);
+    fprintf(stderr, "unable to open %s\n", name);
     free(name);
     return 0;
   }
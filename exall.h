@@ -5,11 +5,13 @@
 #define SQUIRT_EXALL_INFO_DIR  ".__squirt"
 #define SQUIRT_EXALL_INFO_DIR_NAME  SQUIRT_EXALL_INFO_DIR"/"
 
+// "path" names the file's metadata in the SQUIRT_EXALL_INFO_DIR of "dirFd"
 int
-exall_readExAllData(dir_entry_t* entry, const char* path);
+exall_readExAllData(int dirFd, dir_entry_t* entry, const char* path);
 
 int
 exall_identicalExAllData(dir_entry_t* one, dir_entry_t* two);
 
+// Also gives the file in "dirFd" the entry's date
 int
-exall_saveExAllData(dir_entry_t* entry, const char* path);
+exall_saveExAllData(int dirFd, dir_entry_t* entry, const char* path);
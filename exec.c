@@ -7,192 +7,366 @@
 #include "argv.h"
 #include "main.h"
 #include "common.h"
-
-static char* exec_command = 0;
-
+#include "latin1.h"
+#include "async.h"
 
 void
 exec_cleanup(void)
 {
-  if (exec_command) {
-    free(exec_command);
-    exec_command = 0;
-  }
+
 }
 
 
-int
-exec_cmd(int argc, char** argv)
+static char*
+exec_unquote(const char* arg)
 {
-  uint8_t commandCode;
-  int commandLength = 0;
-  exec_command = 0;
-
-  if (argc == 2 && strcmp("cd", argv[0]) == 0) {
-    commandLength = strlen(argv[1]);
-    exec_command = malloc(commandLength+1);
-    strcpy(exec_command, argv[1]);
-    commandCode = SQUIRT_COMMAND_CD;
+  int length = strlen(arg);
+  char* unquoted;
+  if (length > 1 && arg[0] == '"' && arg[length-1] == '"') {
+    unquoted = strdup(arg+1);
+    unquoted[length-2] = 0;
   } else {
-    for (int i = 0; i < argc; i++) {
-      commandLength += strlen(argv[i]);
-      commandLength++;
-    }
+    unquoted = strdup(arg);
+  }
+  if (!unquoted) {
+    fatalError("malloc failed");
+  }
+  return unquoted;
+}
 
-    exec_command = malloc(commandLength+1);
-    strcpy(exec_command, argv[0]);
-    for (int i = 1; i < argc; i++) {
-      strcat(exec_command, " ");
-      strcat(exec_command, argv[i]);
-    }
-    commandCode = SQUIRT_COMMAND_CLI;
-  }
-
-  if (util_sendCommand(main_socketFd, commandCode) != 0) {
-    fatalError("failed to connect to squirtd server");
-  }
-
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, exec_command) != 0) {
-    fatalError("send() command failed");
-  }
-
-  if (commandCode != SQUIRT_COMMAND_CD) {
-    uint8_t c;
-    char buffer[1024];
-    int bindex = 0;
-    int exitState = 0;
-    while (util_recv(main_socketFd, &c, 1, 0) == 1) {
-      if (c == 0) {
-	exitState++;
-	if (exitState == 4) {
-	  break;
-	}
-      } else if (c == 0x9B) {
-	//write(1, buffer, bindex);
-	buffer[bindex] = 0;
-	char* utf8 = util_latin1ToUtf8(buffer);
-	size_t ignored __attribute__((unused)) = write(1, utf8, strlen(utf8));
-	free(utf8);
-	bindex = 0;
-	fprintf(stdout, "%c[", 27);
-	fflush(stdout);
-      } else {
-	buffer[bindex++] = c;
-	if (c == '\n' || bindex == sizeof(buffer)) {
-	  //write(1, buffer, bindex);
-	  buffer[bindex] = 0;
-	  char* utf8 = util_latin1ToUtf8(buffer);
-	  size_t ignored __attribute__((unused)) = write(1, utf8, strlen(utf8));
-	  free(utf8);
-	  bindex = 0;
-	}
-      }
-    }
 
-    if (bindex) {
-      size_t ignored __attribute__((unused)) = write(1, buffer, bindex);
+// plain makedir, delete, rename and copy lines are run by squirtd directly
+// instead of spawning a shell, anything with options or patterns is not.
+// Returns the command with its unquoted arguments in "args", or -1.
+static int
+exec_parseNative(int argc, char** argv, char** args)
+{
+  int command;
+
+  for (int i = 1; i < argc; i++) {
+    if (strpbrk(argv[i], "#?*") || strchr(argv[i], '=')) {
+      return -1;
     }
   }
 
-  uint32_t error;
+  if (argc == 2 && strcasecmp(argv[0], "makedir") == 0) {
+    command = SQUIRT_COMMAND_MAKEDIR;
+  } else if (argc == 2 && strcasecmp(argv[0], "delete") == 0) {
+    command = SQUIRT_COMMAND_DELETE;
+  } else if (strcasecmp(argv[0], "rename") == 0 &&
+	     (argc == 3 || (argc == 4 && (strcasecmp(argv[2], "to") == 0 || strcasecmp(argv[2], "as") == 0)))) {
+    command = SQUIRT_COMMAND_RENAME;
+  } else if (strcasecmp(argv[0], "copy") == 0 &&
+	     (argc == 3 || (argc == 4 && strcasecmp(argv[2], "to") == 0))) {
+    command = SQUIRT_COMMAND_COPY;
+  } else {
+    return -1;
+  }
+
+  args[0] = exec_unquote(argv[1]);
+  args[1] = argc > 2 ? exec_unquote(argv[argc-1]) : 0;
+
+  return command;
+}
 
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("exec: failed to read remote status");
+
+static int
+exec_nativeCmd(int argc, char** argv)
+{
+  char* args[2];
+  int command = exec_parseNative(argc, argv, args);
+
+  if (command < 0) {
+    return 0;
   }
 
-  exec_cleanup();
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+  int error = fileop_connSend(&conn, command, args[0], args[1]);
+  conn_detach(&conn);
 
-  return error;
+  free(args[0]);
+  if (args[1]) {
+    free(args[1]);
+  }
+
+  // a failure is run again by the amiga command so the user sees its usual message
+  return error == 0;
 }
 
 
-char*
-exec_captureCmd(uint32_t* errorCode, int argc, char** argv)
+static char*
+exec_join(int argc, char** argv)
 {
-  uint8_t commandCode;
   int commandLength = 0;
-  exec_command = 0;
-
-  int outputLength = 255;
-  int outputSize = 0;
-  char* output = malloc(outputLength);
 
   for (int i = 0; i < argc; i++) {
     commandLength += strlen(argv[i]);
     commandLength++;
   }
 
-  exec_command = malloc(commandLength+1);
-  strcpy(exec_command, argv[0]);
+  char* command = malloc(commandLength+1);
+  if (!command) {
+    fatalError("malloc failed");
+  }
+  strcpy(command, argv[0]);
   for (int i = 1; i < argc; i++) {
-    strcat(exec_command, " ");
-    strcat(exec_command, argv[i]);
-  }
-  commandCode = SQUIRT_COMMAND_CLI;
-
-  if (util_sendCommand(main_socketFd, commandCode) != 0) {
-    fatalError("failed to connect to squirtd server");
-  }
-
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, exec_command) != 0) {
-    fatalError("send() command failed");
-  }
-
-  if (commandCode != SQUIRT_COMMAND_CD) {
-    uint8_t c;
-    int exitState = 0;
-    while (util_recv(main_socketFd, &c, 1, 0) == 1) {
-      if (c == 0) {
-        exitState++;
-        if (exitState == 4) {
-          if (outputSize >= outputLength) {
-            outputLength = outputLength*2;
-            output = realloc(output, outputLength);
-          }
-          output[outputSize++] = 0;
-          break;
-        }
-      } else {
-	if (outputSize >= outputLength) {
-	  outputLength = outputLength*2;
-	  output = realloc(output, outputLength);
-	}
-	output[outputSize++] = c;
+    strcat(command, " ");
+    strcat(command, argv[i]);
+  }
+  return command;
+}
+
+
+uint32_t
+exec_connCd(squirt_conn_t* conn, const char* dir)
+{
+  uint32_t error;
+
+  conn_sendCommand(conn, SQUIRT_COMMAND_CD);
+  conn_sendString(conn, dir, "directory");
+
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
+  }
+
+  return error;
+}
+
+
+uint32_t
+exec_connRun(squirt_conn_t* conn, const char* command, void (*output)(void* data, const char* utf8, size_t length), void* data)
+{
+  conn_sendCommand(conn, SQUIRT_COMMAND_CLI);
+  conn_sendString(conn, command, "command");
+
+  return exec_connRecvOutput(conn, output, data);
+}
+
+
+uint32_t
+exec_connRecvOutput(squirt_conn_t* conn, void (*output)(void* data, const char* utf8, size_t length), void* data)
+{
+  uint8_t c;
+  char buffer[1024];
+  char utf8[sizeof(buffer)*2+1];
+  int bindex = 0;
+  int exitState = 0;
+
+  while (conn_recv(conn, &c, 1, "command output") == 0) {
+    if (c == 0) {
+      exitState++;
+      if (exitState == 4) {
+	break;
+      }
+    } else if (c == 0x9B) {
+      output(data, utf8, latin1_toUtf8(utf8, buffer, bindex));
+      bindex = 0;
+      output(data, "\x1b[", 2);
+    } else {
+      buffer[bindex++] = c;
+      if (c == '\n' || bindex == sizeof(buffer)) {
+	output(data, utf8, latin1_toUtf8(utf8, buffer, bindex));
+	bindex = 0;
       }
     }
   }
 
+  if (bindex) {
+    output(data, utf8, latin1_toUtf8(utf8, buffer, bindex));
+  }
+
   uint32_t error;
 
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("exec: failed to read remote status");
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
   }
 
-  exec_cleanup();
+  return error;
+}
+
+
+static void
+exec_writeOutput(void* data, const char* utf8, size_t length)
+{
+  (void)data;
+  size_t ignored __attribute__((unused)) = write(1, utf8, length);
+}
+
+
+int
+exec_cmd(int argc, char** argv)
+{
+  uint32_t error;
+
+  if (exec_nativeCmd(argc, argv)) {
+    return 0;
+  }
+
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  if (argc == 2 && strcmp("cd", argv[0]) == 0) {
+    error = exec_connCd(&conn, argv[1]);
+  } else {
+    char* command = exec_join(argc, argv);
+    fflush(stdout);
+    error = exec_connRun(&conn, command, exec_writeOutput, 0);
+    free(command);
+  }
+
+  conn_detach(&conn);
+
+  return error;
+}
+
+
+typedef struct {
+  char* output;
+  size_t size;
+  size_t length;
+} exec_capture_t;
+
+
+static void
+exec_captureOutput(void* data, const char* utf8, size_t length)
+{
+  exec_capture_t* capture = data;
+
+  if (capture->length + length >= capture->size) {
+    while (capture->length + length >= capture->size) {
+      capture->size *= 2;
+    }
+    capture->output = realloc(capture->output, capture->size);
+    if (!capture->output) {
+      fatalError("malloc failed");
+    }
+  }
+
+  memcpy(capture->output + capture->length, utf8, length);
+  capture->length += length;
+  capture->output[capture->length] = 0;
+}
+
+
+char*
+exec_connCapture(squirt_conn_t* conn, const char* command, uint32_t* errorCode)
+{
+  exec_capture_t capture = {malloc(256), 256, 0};
+  if (!capture.output) {
+    fatalError("malloc failed");
+  }
+  capture.output[0] = 0;
+
+  *errorCode = exec_connRun(conn, command, exec_captureOutput, &capture);
+
+  return capture.output;
+}
+
+
+char*
+exec_captureCmd(uint32_t* errorCode, int argc, char** argv)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  char* command = exec_join(argc, argv);
+  char* output = exec_connCapture(&conn, command, errorCode);
+  free(command);
+
+  conn_detach(&conn);
 
-  *errorCode = error;
   return output;
 }
 
 
+typedef struct {
+  char* command;
+  uint32_t error;
+} exec_job_t;
+
+
+static void
+exec_nativeDone(async_conn_t* conn, uint32_t error, void* data)
+{
+  exec_job_t* job = data;
+
+  // a failure is run again by the amiga command so the user sees its usual message
+  if (error != 0 && !async_session(conn)->error) {
+    async_cli(conn, job->command, exec_writeOutput, async_storeError, &job->error);
+  }
+}
+
+
+// the output of each host is printed a line at a time behind its name
+static void
+exec_fleet(const char* hostname, int argc, char** argv)
+{
+  fleet_t* fleet = fleet_open(hostname);
+  char* command = exec_join(argc, argv);
+
+  fflush(stdout);
+
+  for (int i = 0; i < fleet->count; i++) {
+    fleet_host_t* host = &fleet->hosts[i];
+    if (argc == 2 && strcmp("cd", argv[0]) == 0) {
+      async_cd(host->conn, argv[1], fleet_done, host);
+    } else {
+      async_cli(host->conn, command, fleet_output, fleet_done, host);
+    }
+  }
+
+  int failed = fleet_run(fleet, command);
+  fleet_close(fleet);
+  free(command);
+
+  if (failed) {
+    fatalError("failed on %d host%s", failed, failed == 1 ? "" : "s");
+  }
+}
+
+
 void
 exec_main(int argc, char* argv[])
 {
   if (argc < 3) {
-    fatalError("incorrect number of arguments\nusage: %s hostname command to be executed", argv[0]);
+    fatalError("incorrect number of arguments\nusage: %s hostname|host,host...|@fleet command to be executed", argv[0]);
+  }
+
+  if (fleet_isFleet(argv[1])) {
+    exec_fleet(argv[1], argc-2, argv+2);
+    return;
   }
 
-  util_connect(argv[1]);
+  async_engine_t* engine = async_newEngine();
+  async_conn_t* conn = async_connect(engine, argv[1]);
 
-  for (int i = 0; i < argc-2; i++) {
-    argv[i] = argv[i+2];
+  argv += 2;
+  argc -= 2;
+
+  char* args[2];
+  exec_job_t job = {exec_join(argc, argv), 0};
+  int command = exec_parseNative(argc, argv, args);
+
+  if (command >= 0) {
+    async_fileOp(conn, command, args[0], args[1], exec_nativeDone, &job);
+    free(args[0]);
+    free(args[1]);
+  } else if (argc == 2 && strcmp("cd", argv[0]) == 0) {
+    async_cd(conn, argv[1], async_storeError, &job.error);
+  } else {
+    fflush(stdout);
+    async_cli(conn, job.command, exec_writeOutput, async_storeError, &job.error);
   }
 
-  argc-=2;
+  if (async_run(engine) != 0) {
+    fatalError("%s", conn_errorString(async_session(conn)));
+  }
 
-  uint32_t error = exec_cmd(argc, argv);
+  free(job.command);
+  async_freeEngine(engine);
 
-  if (error != 0) {
-    fatalError("%s", util_getErrorString(error));
+  if (job.error != 0) {
+    fatalError("%s", util_getErrorString(job.error));
   }
 }
@@ -1,4 +1,7 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "conn.h"
 
 int
 exec_cmd(int argc, char** argv);
@@ -6,6 +9,23 @@ exec_cmd(int argc, char** argv);
 char*
 exec_captureCmd(uint32_t* errorCode, int argc, char** argv);
 
+// Runs "command" on "conn", its output is handed to "output" as it arrives,
+// converted to UTF-8. Returns the remote status or the connection's error.
+uint32_t
+exec_connRun(squirt_conn_t* conn, const char* command, void (*output)(void* data, const char* utf8, size_t length), void* data);
+
+// The output and status of a command that has already been sent, for callers
+// that have other requests in flight
+uint32_t
+exec_connRecvOutput(squirt_conn_t* conn, void (*output)(void* data, const char* utf8, size_t length), void* data);
+
+// exec_connRun collecting the output, which the caller frees
+char*
+exec_connCapture(squirt_conn_t* conn, const char* command, uint32_t* errorCode);
+
+uint32_t
+exec_connCd(squirt_conn_t* conn, const char* dir);
+
 void
 exec_cleanup(void);
 
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "common.h"
+
+char*
+fileop_dosCommand(command_t command, const char* name, const char* dest)
+{
+  static const char* names[] = {
+    [SQUIRT_COMMAND_MAKEDIR] = "makedir",
+    [SQUIRT_COMMAND_DELETE] = "delete",
+    [SQUIRT_COMMAND_RENAME] = "rename",
+    [SQUIRT_COMMAND_COPY] = "copy",
+  };
+
+  char* dosCommand = malloc(strlen(name) + (dest ? strlen(dest) : 0) + 32);
+  if (!dosCommand) {
+    fatalError("malloc failed");
+  }
+
+  if (dest) {
+    sprintf(dosCommand, "%s \"%s\" to \"%s\"", names[command], name, dest);
+  } else {
+    sprintf(dosCommand, "%s \"%s\"", names[command], name);
+  }
+  return dosCommand;
+}
+
+
+static void
+fileop_discardOutput(void* data, const char* utf8, size_t length)
+{
+  (void)data, (void)utf8, (void)length;
+}
+
+
+int
+fileop_connSend(squirt_conn_t* conn, command_t command, const char* name, const char* dest)
+{
+  uint32_t reply, error;
+
+  conn_sendCommand(conn, command);
+  conn_sendString(conn, name, "name");
+
+  if (conn_recvU32(conn, &reply, "remote reply") != 0) {
+    return conn->error;
+  }
+
+  if (reply != SQUIRT_FILEOP_REPLY) {
+    // the server doesn't know the command and has already sent its status
+    char* dosCommand = fileop_dosCommand(command, name, dest);
+    error = exec_connRun(conn, dosCommand, fileop_discardOutput, 0);
+    free(dosCommand);
+    return error;
+  }
+
+  if (dest) {
+    conn_sendString(conn, dest, "destination");
+  }
+
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
+  }
+
+  return error;
+}
+
+
+static int
+fileop_send(command_t command, const char* name, const char* dest)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  int error = fileop_connSend(&conn, command, name, dest);
+
+  conn_detach(&conn);
+
+  return error;
+}
+
+
+int
+fileop_makeDir(const char* dir)
+{
+  return fileop_send(SQUIRT_COMMAND_MAKEDIR, dir, 0);
+}
+
+
+int
+fileop_delete(const char* filename)
+{
+  return fileop_send(SQUIRT_COMMAND_DELETE, filename, 0);
+}
+
+
+int
+fileop_rename(const char* from, const char* to)
+{
+  return fileop_send(SQUIRT_COMMAND_RENAME, from, to);
+}
+
+
+int
+fileop_copy(const char* from, const char* to)
+{
+  return fileop_send(SQUIRT_COMMAND_COPY, from, to);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "conn.h"
+#include "common.h"
+
+// native squirtd file operations, return 0 or the remote error code
+
+int
+fileop_makeDir(const char* dir);
+
+int
+fileop_delete(const char* filename);
+
+int
+fileop_rename(const char* from, const char* to);
+
+int
+fileop_copy(const char* from, const char* to);
+
+// "command" is one of the above, "dest" is 0 unless it is a rename or copy.
+// Servers without the native commands run the AmigaDOS one instead. Returns
+// the remote status or the connection's error.
+int
+fileop_connSend(squirt_conn_t* conn, command_t command, const char* name, const char* dest);
+
+// The AmigaDOS command line doing what "command" does, which the caller frees
+char*
+fileop_dosCommand(command_t command, const char* name, const char* dest);
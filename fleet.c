@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "main.h"
+#include "common.h"
+#include "fleet.h"
+
+#define FLEET_SEPARATORS " ,\t"
+
+
+int
+fleet_isFleet(const char* hostname)
+{
+  return hostname[0] == '@' || strchr(hostname, ',') != 0;
+}
+
+
+fleet_t*
+fleet_open(const char* hostname)
+{
+  const char* list = hostname;
+
+  if (hostname[0] == '@' && !(list = config_getFleet(hostname+1))) {
+    fatalError("unknown fleet %s", hostname);
+  }
+
+  // each host carries a line buffer, so only as many as are named are allocated
+  int count = 0;
+  const char* ptr = list + strspn(list, FLEET_SEPARATORS);
+  while (*ptr) {
+    count++;
+    ptr += strcspn(ptr, FLEET_SEPARATORS);
+    ptr += strspn(ptr, FLEET_SEPARATORS);
+  }
+
+  if (count == 0) {
+    fatalError("no hosts in %s", hostname);
+  }
+
+  fleet_t* fleet = calloc(1, sizeof(fleet_t));
+  if (!fleet || !(fleet->names = strdup(list)) || !(fleet->hosts = calloc(count, sizeof(fleet_host_t)))) {
+    fatalError("malloc failed");
+  }
+
+  for (char* name = strtok(fleet->names, FLEET_SEPARATORS); name; name = strtok(0, FLEET_SEPARATORS)) {
+    fleet->hosts[fleet->count++].hostname = name;
+    if ((int)strlen(name) > fleet->width) {
+      fleet->width = strlen(name);
+    }
+  }
+
+  fleet->engine = async_newEngine();
+  gettimeofday(&fleet->start, NULL);
+
+  for (int i = 0; i < fleet->count; i++) {
+    fleet_host_t* host = &fleet->hosts[i];
+    host->prefix = malloc(fleet->width + 4);
+    if (!host->prefix) {
+      fatalError("malloc failed");
+    }
+    sprintf(host->prefix, "%-*s | ", fleet->width, host->hostname);
+    host->conn = async_connect(fleet->engine, host->hostname);
+    host->end = fleet->start;
+  }
+
+  return fleet;
+}
+
+
+void
+fleet_close(fleet_t* fleet)
+{
+  async_freeEngine(fleet->engine);
+  for (int i = 0; i < fleet->count; i++) {
+    free(fleet->hosts[i].prefix);
+  }
+  free(fleet->hosts);
+  free(fleet->names);
+  free(fleet);
+}
+
+
+void
+fleet_done(async_conn_t* conn, uint32_t error, void* data)
+{
+  fleet_host_t* host = data;
+  (void)conn;
+
+  gettimeofday(&host->end, NULL);
+  if (error && !host->error) {
+    host->error = error;
+  }
+}
+
+
+static void
+fleet_printLine(fleet_host_t* host)
+{
+  printf("%s%.*s\n", host->prefix, (int)host->lineLength, host->line);
+  host->lineLength = 0;
+}
+
+
+void
+fleet_output(void* data, const char* utf8, size_t length)
+{
+  fleet_host_t* host = data;
+
+  for (size_t i = 0; i < length; i++) {
+    if (utf8[i] == '\n') {
+      fleet_printLine(host);
+    } else if (utf8[i] != '\r') {
+      if (host->lineLength == sizeof(host->line)) {
+	fleet_printLine(host);
+      }
+      host->line[host->lineLength++] = utf8[i];
+    }
+  }
+  fflush(stdout);
+}
+
+
+static double
+fleet_seconds(struct timeval* start, struct timeval* end)
+{
+  return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_usec - start->tv_usec)/1000000.0;
+}
+
+
+int
+fleet_run(fleet_t* fleet, const char* what)
+{
+  int failed = 0;
+  struct timeval end;
+
+  async_run(fleet->engine);
+  gettimeofday(&end, NULL);
+
+  for (int i = 0; i < fleet->count; i++) {
+    if (fleet->hosts[i].lineLength) {
+      fleet_printLine(&fleet->hosts[i]);
+    }
+  }
+
+  printf("\n%s on %d host%s:\n", what, fleet->count, fleet->count == 1 ? "" : "s");
+
+  for (int i = 0; i < fleet->count; i++) {
+    fleet_host_t* host = &fleet->hosts[i];
+    double seconds = fleet_seconds(&fleet->start, &host->end);
+
+    printf("  %-*s  %-6s %8.2fs", fleet->width, host->hostname, host->error ? "FAILED" : "ok", seconds);
+    if (host->error) {
+      squirt_conn_t* session = async_session(host->conn);
+      printf("  %s", session->error ? conn_errorString(session) : util_getErrorString(host->error));
+      failed++;
+    } else if (host->bytes && seconds > 0) {
+      printf("  %s bytes ", util_formatNumber((int)host->bytes));
+      util_printFormatSpeed((int32_t)host->bytes, seconds);
+    }
+    printf("\n");
+  }
+
+  printf("%d of %d ok in %0.02f seconds\n", fleet->count - failed, fleet->count, fleet_seconds(&fleet->start, &end));
+  fflush(stdout);
+
+  return failed;
+}
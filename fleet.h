@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "async.h"
+
+// Several Amigas driven at once, one session each. A fleet is named by a comma
+// separated list of hosts or by "@name" for a fleet from the config file.
+
+typedef struct {
+  const char* hostname;
+  char* prefix;           // the hostname padded to line up output
+  async_conn_t* conn;
+  uint32_t error;         // the first failure, the remote status or the connection's error
+  uint64_t bytes;         // transferred, for the summary
+  struct timeval end;     // when its last operation finished
+  char line[1024];        // output not yet printed as it doesn't end in a newline
+  size_t lineLength;
+} fleet_host_t;
+
+typedef struct {
+  async_engine_t* engine;
+  fleet_host_t* hosts;
+  int count;
+  int width;              // of the longest hostname, output is lined up behind it
+  char* names;
+  struct timeval start;
+} fleet_t;
+
+int
+fleet_isFleet(const char* hostname);
+
+// Starts connecting to every host of the fleet
+fleet_t*
+fleet_open(const char* hostname);
+
+void
+fleet_close(fleet_t* fleet);
+
+// An async_done_t for operations on a fleet host, "data" is the fleet_host_t
+void
+fleet_done(async_conn_t* conn, uint32_t error, void* data);
+
+// Command output of a fleet host, "data" is the fleet_host_t. Each line is
+// printed behind the hostname once it is complete.
+void
+fleet_output(void* data, const char* utf8, size_t length);
+
+// Runs everything queued on the fleet, then prints how each host did and how
+// long it took. "what" describes the work for the summary. Returns the
+// number of hosts that failed.
+int
+fleet_run(fleet_t* fleet, const char* what);
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "common.h"
+#include "crc32.h"
+
+#define HOSTCACHE_MAX_BYTES (256*1024*1024)
+#define HOSTCACHE_INDEX     "index"
+
+typedef struct hostcache_entry {
+  char* path;        // absolute remote path
+  char* localPath;
+  uint32_t size;
+  uint32_t prot;
+  dir_datestamp_t ds;
+  uint32_t crc;      // of the local copy when it last matched the remote file
+  time_t lastUsed;
+  struct hostcache_entry* next;
+} hostcache_entry_t;
+
+// cli local commands fetch and write back their files from several threads
+static pthread_mutex_t hostcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char* hostcache_root = 0;
+static hostcache_entry_t* hostcache_entries = 0;
+
+
+static void
+hostcache_freeEntry(hostcache_entry_t* entry)
+{
+  free(entry->path);
+  free(entry->localPath);
+  free(entry);
+}
+
+
+void
+hostcache_cleanup(void)
+{
+  while (hostcache_entries) {
+    hostcache_entry_t* next = hostcache_entries->next;
+    hostcache_freeEntry(hostcache_entries);
+    hostcache_entries = next;
+  }
+
+  if (hostcache_root) {
+    free(hostcache_root);
+    hostcache_root = 0;
+  }
+}
+
+
+static const char*
+hostcache_getIndexFile(void)
+{
+  static char buffer[PATH_MAX];
+  snprintf(buffer, sizeof(buffer), "%s%s", hostcache_root, HOSTCACHE_INDEX);
+  return buffer;
+}
+
+
+static hostcache_entry_t*
+hostcache_find(const char* path)
+{
+  for (hostcache_entry_t* entry = hostcache_entries; entry; entry = entry->next) {
+    // AmigaDOS paths are case insensitive
+    if (strcasecmp(entry->path, path) == 0) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+
+static hostcache_entry_t*
+hostcache_add(const char* path, const char* localPath)
+{
+  hostcache_entry_t* entry = calloc(1, sizeof(hostcache_entry_t));
+  if (!entry || !(entry->path = strdup(path)) || !(entry->localPath = strdup(localPath))) {
+    fatalError("malloc failed");
+  }
+  entry->next = hostcache_entries;
+  hostcache_entries = entry;
+  return entry;
+}
+
+
+static void
+hostcache_remove(hostcache_entry_t* entry)
+{
+  hostcache_entry_t** ptr = &hostcache_entries;
+  while (*ptr != entry) {
+    ptr = &(*ptr)->next;
+  }
+  *ptr = entry->next;
+  unlink(entry->localPath);
+  hostcache_freeEntry(entry);
+}
+
+
+void
+hostcache_init(const char* hostname)
+{
+  char buffer[PATH_MAX];
+  int length = snprintf(buffer, sizeof(buffer), "%s/.squirt_cache/", util_getHomeDir());
+  snprintf(buffer+length, sizeof(buffer)-length, "%s/", hostname);
+
+  // one directory per host, and the port separator isn't welcome in file names everywhere
+  for (char* ptr = buffer + length; *ptr; ptr++) {
+    if (*ptr == ':' || *ptr == '\\') {
+      *ptr = '_';
+    }
+  }
+#ifdef _WIN32
+  for (char* ptr = buffer; *ptr; ptr++) {
+    if (*ptr == '/') {
+      *ptr = '\\';
+    }
+  }
+#endif
+
+  hostcache_root = strdup(buffer);
+  if (!hostcache_root) {
+    fatalError("malloc failed");
+  }
+  util_mkpath(hostcache_root);
+
+  FILE* fp = fopen(hostcache_getIndexFile(), "r");
+  if (!fp) {
+    return;
+  }
+
+  // remote path, local path, size, prot, days, mins, ticks, crc, last used
+  char line[PATH_MAX*2+128];
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = 0;
+    char* path = strtok(line, "\t");
+    char* localPath = strtok(0, "\t");
+    char* fields = strtok(0, "");
+    hostcache_entry_t tmp;
+    long long lastUsed;
+    if (!path || !localPath || !fields ||
+	sscanf(fields, "%u %u %u %u %u %x %lld", &tmp.size, &tmp.prot, &tmp.ds.days, &tmp.ds.mins, &tmp.ds.ticks, &tmp.crc, &lastUsed) != 7) {
+      continue;
+    }
+    hostcache_entry_t* entry = hostcache_add(path, localPath);
+    entry->size = tmp.size;
+    entry->prot = tmp.prot;
+    entry->ds = tmp.ds;
+    entry->crc = tmp.crc;
+    entry->lastUsed = lastUsed;
+  }
+  fclose(fp);
+}
+
+
+static void
+hostcache_localPath(char* buffer, size_t size, const char* path)
+{
+  char* local = strdup(path);
+  if (!local) {
+    fatalError("malloc failed");
+  }
+
+  // Work:Proj/file lives in <root>files/Work/Proj/file
+  char* colon = strchr(local, ':');
+  if (colon) {
+    *colon = '/';
+  }
+#ifdef _WIN32
+  for (char* ptr = local; *ptr; ptr++) {
+    if (*ptr == '/') {
+      *ptr = '\\';
+    }
+  }
+  const char* separator = "\\";
+#else
+  const char* separator = "/";
+#endif
+
+  char* safeName = util_safeName(local);
+  if (!safeName) {
+    fatalError("malloc failed");
+  }
+  snprintf(buffer, size, "%sfiles%s%s", hostcache_root, separator, safeName);
+  free(safeName);
+  free(local);
+}
+
+
+// the local copy as it was last recorded, so it can be checked without holding the lock
+static int
+hostcache_snapshot(const char* path, char** localPath, uint32_t* crc, hostcache_entry_t* fields)
+{
+  pthread_mutex_lock(&hostcache_mutex);
+  hostcache_entry_t* cached = hostcache_find(path);
+  if (cached) {
+    *localPath = strdup(cached->localPath);
+    if (!*localPath) {
+      fatalError("malloc failed");
+    }
+    *crc = cached->crc;
+    if (fields) {
+      *fields = *cached;
+    }
+  }
+  pthread_mutex_unlock(&hostcache_mutex);
+  return cached != 0;
+}
+
+
+static int
+hostcache_localModified(const char* localPath, uint32_t crc)
+{
+  uint32_t localCrc;
+  return crc32_sum(localPath, &localCrc) != 0 || localCrc != crc;
+}
+
+
+static int
+hostcache_matches(hostcache_entry_t* cached, const char* localPath, dir_entry_t* entry)
+{
+  struct stat st;
+
+  return cached->size == entry->size && cached->prot == entry->prot &&
+    cached->ds.days == entry->ds.days && cached->ds.mins == entry->ds.mins && cached->ds.ticks == entry->ds.ticks &&
+    stat(localPath, &st) == 0 && st.st_size == (off_t)entry->size &&
+    !hostcache_localModified(localPath, cached->crc);
+}
+
+
+char*
+hostcache_fetch(squirt_conn_t* conn, const char* path, dir_entry_t* entry)
+{
+  char* localPath = 0;
+  uint32_t crc;
+  hostcache_entry_t fields;
+
+  if (!entry) {
+    hostcache_forget(path);
+    char missing[PATH_MAX];
+    hostcache_localPath(missing, sizeof(missing), path);
+    unlink(missing);
+    if (!(localPath = strdup(missing))) {
+      fatalError("malloc failed");
+    }
+    return localPath;
+  }
+
+  if (hostcache_snapshot(path, &localPath, &crc, &fields)) {
+    if (hostcache_matches(&fields, localPath, entry)) {
+      pthread_mutex_lock(&hostcache_mutex);
+      hostcache_entry_t* cached = hostcache_find(path);
+      if (cached) {
+	cached->lastUsed = time(0);
+      }
+      pthread_mutex_unlock(&hostcache_mutex);
+      return localPath;
+    }
+    free(localPath);
+  }
+
+  char buffer[PATH_MAX];
+  hostcache_localPath(buffer, sizeof(buffer), path);
+  pthread_mutex_lock(&hostcache_mutex);
+  hostcache_entry_t* cached = hostcache_find(path);
+  if (!cached) {
+    cached = hostcache_add(path, buffer);
+  }
+  localPath = strdup(cached->localPath);
+  pthread_mutex_unlock(&hostcache_mutex);
+  if (!localPath) {
+    fatalError("malloc failed");
+  }
+
+  util_mkpath(localPath);
+
+  uint32_t protection;
+  if (suck_connFile(conn, path, 0, 0, UTIL_DIR_CWD, localPath, &protection) < 0) {
+    hostcache_forget(path);
+    free(localPath);
+    return 0;
+  }
+
+  hostcache_update(path, entry);
+  return localPath;
+}
+
+
+int
+hostcache_isModified(const char* path)
+{
+  char* localPath;
+  uint32_t crc;
+  hostcache_entry_t fields;
+  struct stat st;
+
+  if (!hostcache_snapshot(path, &localPath, &crc, &fields)) {
+    return 1;
+  }
+
+  // a change of size needs no hashing, only a file of the same size is read
+  int modified = stat(localPath, &st) != 0 || st.st_size != (off_t)fields.size ||
+    hostcache_localModified(localPath, crc);
+  free(localPath);
+  return modified;
+}
+
+
+void
+hostcache_update(const char* path, dir_entry_t* entry)
+{
+  char* localPath;
+  uint32_t crc;
+
+  if (!hostcache_snapshot(path, &localPath, &crc, 0)) {
+    return;
+  }
+
+  int error = crc32_sum(localPath, &crc);
+  free(localPath);
+
+  pthread_mutex_lock(&hostcache_mutex);
+  hostcache_entry_t* cached = hostcache_find(path);
+  if (cached) {
+    if (error) {
+      hostcache_remove(cached);
+    } else {
+      cached->crc = crc;
+      cached->size = entry->size;
+      cached->prot = entry->prot;
+      cached->ds = entry->ds;
+      cached->lastUsed = time(0);
+    }
+  }
+  pthread_mutex_unlock(&hostcache_mutex);
+}
+
+
+void
+hostcache_forget(const char* path)
+{
+  pthread_mutex_lock(&hostcache_mutex);
+  hostcache_entry_t* cached = hostcache_find(path);
+  if (cached) {
+    hostcache_remove(cached);
+  }
+  pthread_mutex_unlock(&hostcache_mutex);
+}
+
+
+static int
+hostcache_compareLastUsed(const void* a, const void* b)
+{
+  time_t one = (*(hostcache_entry_t**)a)->lastUsed;
+  time_t two = (*(hostcache_entry_t**)b)->lastUsed;
+  return one < two ? -1 : one > two;
+}
+
+
+void
+hostcache_save(void)
+{
+  if (!hostcache_root) {
+    return;
+  }
+
+  pthread_mutex_lock(&hostcache_mutex);
+
+  int count = 0;
+  uint64_t bytes = 0;
+  for (hostcache_entry_t* entry = hostcache_entries; entry; entry = entry->next) {
+    count++;
+    bytes += entry->size;
+  }
+
+  if (bytes > HOSTCACHE_MAX_BYTES) {
+    hostcache_entry_t** sorted = malloc(count * sizeof(hostcache_entry_t*));
+    if (!sorted) {
+      fatalError("malloc failed");
+    }
+    int i = 0;
+    for (hostcache_entry_t* entry = hostcache_entries; entry; entry = entry->next) {
+      sorted[i++] = entry;
+    }
+    qsort(sorted, count, sizeof(hostcache_entry_t*), hostcache_compareLastUsed);
+    for (i = 0; i < count && bytes > HOSTCACHE_MAX_BYTES; i++) {
+      bytes -= sorted[i]->size;
+      hostcache_remove(sorted[i]);
+    }
+    free(sorted);
+  }
+
+  FILE* fp = fopen(hostcache_getIndexFile(), "w");
+  if (!fp) {
+    pthread_mutex_unlock(&hostcache_mutex);
+    return;
+  }
+
+  for (hostcache_entry_t* entry = hostcache_entries; entry; entry = entry->next) {
+    fprintf(fp, "%s\t%s\t%u %u %u %u %u %08x %lld\n", entry->path, entry->localPath, entry->size, entry->prot,
+	    entry->ds.days, entry->ds.mins, entry->ds.ticks, entry->crc, (long long)entry->lastUsed);
+  }
+  fclose(fp);
+  pthread_mutex_unlock(&hostcache_mutex);
+}
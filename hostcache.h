@@ -0,0 +1,35 @@
+#pragma once
+
+#include "dir.h"
+
+void
+hostcache_cleanup(void);
+
+// Loads the index of remote files cached for "hostname" by earlier sessions
+void
+hostcache_init(const char* hostname);
+
+// Local path of a copy of the remote file "path", which must be absolute, for
+// the caller to free. The cached copy is used if it still matches "entry" from
+// a fresh listing of its directory, otherwise the file is fetched again. If
+// "entry" is 0 the remote file doesn't exist, any copy is removed and the
+// (missing) local path is returned. Returns 0 if the fetch failed, leaving any
+// connection failure in "conn". Safe to call from several threads, each with
+// its own connection.
+char*
+hostcache_fetch(squirt_conn_t* conn, const char* path, dir_entry_t* entry);
+
+// 1 if the local copy was changed since it was fetched or written back
+int
+hostcache_isModified(const char* path);
+
+// Records the local copy as matching the remote file described by "entry"
+void
+hostcache_update(const char* path, dir_entry_t* entry);
+
+void
+hostcache_forget(const char* path);
+
+// Writes the index, removing the least recently used files over the limit
+void
+hostcache_save(void);
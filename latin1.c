@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "latin1.h"
+
+// runs of ASCII are checked and copied eight bytes at a time
+#define LATIN1_HIGH_BITS 0x8080808080808080ULL
+
+
+size_t
+latin1_toUtf8(char* out, const char* in, size_t length)
+{
+  size_t i = 0, j = 0;
+
+  while (i < length) {
+    if (length - i >= sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, in + i, sizeof(word));
+      if (!(word & LATIN1_HIGH_BITS)) {
+	memcpy(out + j, &word, sizeof(word));
+	i += sizeof(word);
+	j += sizeof(word);
+	continue;
+      }
+    }
+
+    uint8_t c = in[i++];
+    if (c < 0x80) {
+      out[j++] = c;
+    } else {
+      out[j++] = 0xC0 | (c >> 6);
+      out[j++] = 0x80 | (c & 0x3F);
+    }
+  }
+
+  out[j] = 0;
+  return j;
+}
+
+
+size_t
+latin1_fromUtf8(char* out, size_t* outLength, const char* in, size_t length)
+{
+  size_t i = 0, j = 0;
+
+  while (i < length) {
+    if (length - i >= sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, in + i, sizeof(word));
+      if (!(word & LATIN1_HIGH_BITS)) {
+	memcpy(out + j, &word, sizeof(word));
+	i += sizeof(word);
+	j += sizeof(word);
+	continue;
+      }
+    }
+
+    uint8_t c = in[i];
+    if (c < 0x80) {
+      out[j++] = c;
+      i++;
+    } else if ((c == 0xC2 || c == 0xC3) && i + 1 < length && ((uint8_t)in[i+1] & 0xC0) == 0x80) {
+      // U+0080 to U+00FF are the only two byte sequences Latin-1 has
+      out[j++] = ((c & 0x03) << 6) | ((uint8_t)in[i+1] & 0x3F);
+      i += 2;
+    } else {
+      break;
+    }
+  }
+
+  out[j] = 0;
+  *outLength = j;
+  return i;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+
+// Writes the UTF-8 form of "length" bytes of Latin-1 "in" to "out" and
+// terminates it. "out" needs room for 2*length+1 bytes, and may overlap "in"
+// as long as "in" starts at least "length" bytes into it. Returns the length
+// of the UTF-8.
+size_t
+latin1_toUtf8(char* out, const char* in, size_t length);
+
+// Writes the Latin-1 form of "length" bytes of UTF-8 "in" to "out" and
+// terminates it, "out" needs room for length+1 bytes. Stops at the first
+// character with no Latin-1 form, or one cut short at the end of "in" that a
+// stream can carry over to its next block. Returns the number of bytes of "in"
+// converted and sets "*outLength" to the length of the Latin-1.
+size_t
+latin1_fromUtf8(char* out, size_t* outLength, const char* in, size_t length);
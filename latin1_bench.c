@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iconv.h>
+
+#include "latin1.h"
+
+// Times the Latin-1/UTF-8 conversion on directory-entry sized names and on
+// long blocks of exec output, against the per-call iconv conversion it replaced
+
+#define BENCH_NAME_LENGTH  24
+#define BENCH_BLOCK_LENGTH (64*1024)
+#define BENCH_BYTES        (256*1024*1024)
+
+// the results are added up here so the conversions aren't optimised away
+static volatile size_t bench_sink;
+
+static double
+bench_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void
+bench_fill(char* buffer, int length, int accented)
+{
+  for (int i = 0; i < length; i++) {
+    buffer[i] = 'a' + i % 26;
+    if (accented && i % 8 == 7) {
+      buffer[i] = (char)0xE9; // e acute
+    }
+  }
+  buffer[length] = 0;
+}
+
+
+static size_t
+bench_iconv(const char* to, const char* from, char* out, const char* in, size_t length)
+{
+  iconv_t ic = iconv_open(to, from);
+  char* inptr = (char*)in;
+  char* outptr = out;
+  size_t outsize = length*2+1;
+  iconv(ic, &inptr, &length, &outptr, &outsize);
+  iconv_close(ic);
+  *outptr = 0;
+  return outptr - out;
+}
+
+
+static void
+bench_run(const char* label, int length, int accented)
+{
+  char* latin1 = malloc(length+1);
+  char* utf8 = malloc(length*2+1);
+  char* back = malloc(length*2+1);
+  if (!latin1 || !utf8 || !back) {
+    fprintf(stderr, "malloc failed\n");
+    exit(1);
+  }
+  bench_fill(latin1, length, accented);
+
+  long iterations = BENCH_BYTES / length;
+  size_t utf8Length = 0, backLength = 0;
+
+  double start = bench_now();
+  for (long i = 0; i < iterations; i++) {
+    utf8Length = latin1_toUtf8(utf8, latin1, length);
+    bench_sink += utf8Length;
+  }
+  double toUtf8 = bench_now() - start;
+
+  start = bench_now();
+  for (long i = 0; i < iterations; i++) {
+    latin1_fromUtf8(back, &backLength, utf8, utf8Length);
+    bench_sink += backLength;
+  }
+  double fromUtf8 = bench_now() - start;
+
+  if (backLength != (size_t)length || memcmp(back, latin1, length) != 0) {
+    fprintf(stderr, "%s: round trip mismatch\n", label);
+    exit(1);
+  }
+
+  // iconv is much slower, so a sixteenth of the work is enough to time it
+  long iconvIterations = iterations / 16;
+  start = bench_now();
+  for (long i = 0; i < iconvIterations; i++) {
+    bench_sink += bench_iconv("UTF-8", "ISO-8859-1", back, latin1, length);
+  }
+  double iconvToUtf8 = (bench_now() - start) * 16;
+
+  double megabytes = (double)iterations * length / (1024*1024);
+  printf("%-22s to utf-8 %8.1f MB/s  from utf-8 %8.1f MB/s  iconv per call %8.1f MB/s\n",
+	 label, megabytes / toUtf8, megabytes / fromUtf8, megabytes / iconvToUtf8);
+
+  free(latin1);
+  free(utf8);
+  free(back);
+}
+
+
+int
+main(void)
+{
+  bench_run("names, ascii", BENCH_NAME_LENGTH, 0);
+  bench_run("names, accented", BENCH_NAME_LENGTH, 1);
+  bench_run("blocks, ascii", BENCH_BLOCK_LENGTH, 0);
+  bench_run("blocks, accented", BENCH_BLOCK_LENGTH, 1);
+  return 0;
+}
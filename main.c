@@ -14,7 +14,7 @@
 
 const char* main_argv0;
 int main_screenWidth = 0;
-int main_socketFd = 0;
+_Thread_local int main_socketFd = 0;
 
 _Noreturn void
 main_cleanupAndExit(int errorCode)
@@ -24,6 +24,8 @@ main_cleanupAndExit(int errorCode)
     main_socketFd = 0;
   }
   backup_cleanup();
+  // the cached listings are in dir's list registry, free them first
+  dircache_cleanup();
   cli_cleanup();
   cwd_cleanup();
   exec_cleanup();
@@ -33,6 +35,10 @@ main_cleanupAndExit(int errorCode)
   squirt_cleanup();
   restore_cleanup();
   protect_cleanup();
+  verify_cleanup();
+  report_cleanup();
+  doslist_cleanup();
+  hostcache_cleanup();
   exit(errorCode);
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "util.h"
+#include "conn.h"
 #include "cli.h"
 #include "cwd.h"
 #include "exec.h"
@@ -12,6 +13,13 @@
 #include "squirt.h"
 #include "restore.h"
 #include "protect.h"
+#include "verify.h"
+#include "report.h"
+#include "fileop.h"
+#include "dircache.h"
+#include "doslist.h"
+#include "hostcache.h"
+#include "fleet.h"
 #include "config.h"
 
 #ifndef _WIN32
@@ -28,7 +36,8 @@
 
 extern const char* main_argv0;
 extern int main_screenWidth;
-extern int main_socketFd;
+// per thread so restore workers can each hold their own session
+extern _Thread_local int main_socketFd;
 
 _Noreturn void
 main_fatalError(const char *format, ...);
@@ -17,7 +17,7 @@ ifneq (,$(findstring MINGW64,$(UNAME_S)))
 PLATFORM=mingw64
 endif
 
-MINGW_LIBS=-lws2_32 -liconv -static
+MINGW_LIBS=-lws2_32 -liconv -lpthread -static
 
 ifeq ($(PLATFORM),osx)
 # OSX
@@ -34,7 +34,7 @@ MUSL_LIB_PATH=-L$(MINGW_GCC_PREFIX)/lib
 else ifeq ($(PLATFORM),raspberry_pi)
 # Raspberry Pi
 CC=gcc
-LIBS=
+LIBS=-lpthread
 else ifeq ($(PLATFORM),linux)
 # Linux
 ifeq ($(RELEASE),true)
@@ -42,7 +42,7 @@ else
 CC=gcc-10
 endif
 STATIC_ANALYZE=-fanalyzer -fsanitize=address -fsanitize=undefined
-LIBS=
+LIBS=-lpthread
 MINGW_GCC_PREFIX=/usr/x86_64-w64-mingw32
 MINGW_GCC=x86_64-w64-mingw32-gcc
 else ifeq ($(PLATFORM),mingw64)
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -9,6 +10,7 @@
 
 #include "main.h"
 #include "common.h"
+#include "latin1.h"
 
 void
 protect_cleanup(void)
@@ -17,43 +19,198 @@ protect_cleanup(void)
 }
 
 
-int
-protect_file(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp)
+static char*
+protect_putU32(char* ptr, uint32_t value)
+{
+  uint32_t networkValue = htonl(value);
+  memcpy(ptr, &networkValue, sizeof(networkValue));
+  return ptr + sizeof(networkValue);
+}
+
+
+static char*
+protect_putString(char* ptr, const char* str, size_t* length)
+{
+  latin1_fromUtf8(ptr + sizeof(uint32_t), length, str, strlen(str));
+  protect_putU32(ptr, *length);
+  return ptr + sizeof(uint32_t) + *length;
+}
+
+
+char*
+protect_encodeFileInfo(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, size_t* length, uint32_t* error)
 {
   dir_datestamp_t _dateStamp = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
   if (dateStamp == 0) {
     dateStamp = &_dateStamp;
   }
 
-  if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_SET_INFO) != 0) {
-    fatalError("failed to connect to squirtd server");
+  // the latin1 forms are never longer than the UTF-8
+  char* request = malloc(7*sizeof(uint32_t) + strlen(filename)+1 + (comment ? strlen(comment)+1 : 0));
+  if (!request) {
+    *error = ERROR_FATAL_ERROR;
+    return 0;
   }
 
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, filename) != 0) {
-    fatalError("send() name failed");
+  size_t stringLength;
+  char* ptr = protect_putU32(request, comment ? SQUIRT_COMMAND_SET_INFO_COMMENT : SQUIRT_COMMAND_SET_INFO);
+  ptr = protect_putString(ptr, filename, &stringLength);
+  ptr = protect_putU32(ptr, protection);
+  ptr = protect_putU32(ptr, dateStamp->days);
+  ptr = protect_putU32(ptr, dateStamp->mins);
+  ptr = protect_putU32(ptr, dateStamp->ticks);
+
+  if (comment) {
+    ptr = protect_putString(ptr, comment, &stringLength);
+    // the limit applies to the latin1 form that is sent
+    if (stringLength > SQUIRT_MAX_COMMENT_LENGTH) {
+      free(request);
+      *error = ERROR_SET_COMMENT_FAILED;
+      return 0;
+    }
   }
 
-  if (util_sendU32(main_socketFd, protection) != 0) {
-    fatalError("send() protection failed");
+  *length = ptr - request;
+  return request;
+}
+
+
+// SET_INFO_COMMENT is accepted with SQUIRT_FILEOP_REPLY once squirtd has the
+// name. The first one waits for that before sending the rest, later ones send
+// it all at once and read the reply with the status. An older squirtd gets a
+// SET_INFO and has the comment set with filenote.
+static int protect_commentSupport = 0;
+
+
+static void
+protect_discardOutput(void* data, const char* utf8, size_t length)
+{
+  (void)data, (void)utf8, (void)length;
+}
+
+
+static int
+protect_connSendFileNote(squirt_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment)
+{
+  size_t length;
+  uint32_t error;
+
+  char* request = protect_encodeFileInfo(filename, protection, dateStamp, 0, &length, &error);
+  char* command = malloc(strlen(filename) + strlen(comment)*2 + 16);
+  if (!request || !command) {
+    free(request);
+    free(command);
+    return conn_fail(conn, ERROR_FATAL_ERROR, "malloc failed");
   }
 
-  if (util_sendU32(main_socketFd, dateStamp->days) != 0) {
-    fatalError("send() datestamp failed");
+  conn_send(conn, request, length, "file info");
+  free(request);
+
+  // quotes and asterisks in the comment are escaped with an asterisk
+  char* ptr = command + sprintf(command, "filenote \"%s\" \"", filename);
+  for (const char* c = comment; *c; c++) {
+    if (*c == '"' || *c == '*') {
+      *ptr++ = '*';
+    }
+    *ptr++ = *c;
   }
+  strcpy(ptr, "\"");
+
+  conn_sendCommand(conn, SQUIRT_COMMAND_CLI);
+  conn_sendString(conn, command, "command");
+  free(command);
 
-  if (util_sendU32(main_socketFd, dateStamp->mins) != 0) {
-    fatalError("send() datestamp failed");
+  return conn->error;
+}
+
+
+int
+protect_connSendFileInfo(squirt_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, protect_reply_t* reply)
+{
+  size_t length;
+  uint32_t error, nameLength;
+
+  *reply = PROTECT_REPLY_STATUS;
+
+  // encoded even for a filenote, so a comment that's too long fails the same way
+  char* request = protect_encodeFileInfo(filename, protection, dateStamp, comment, &length, &error);
+  if (!request) {
+    return SQUIRT_ERROR_IS_FATAL(error) ? conn_fail(conn, error, "malloc failed") : error;
   }
 
-  if (util_sendU32(main_socketFd, dateStamp->ticks) != 0) {
-    fatalError("send() datestamp failed");
+  if (comment && protect_commentSupport < 0) {
+    free(request);
+    *reply = PROTECT_REPLY_FILENOTE;
+    return protect_connSendFileNote(conn, filename, protection, dateStamp, comment);
+  }
+
+  if (comment && protect_commentSupport == 0) {
+    memcpy(&nameLength, request + sizeof(uint32_t), sizeof(nameLength));
+    size_t headerLength = 2*sizeof(uint32_t) + ntohl(nameLength);
+
+    conn_send(conn, request, headerLength, "file info");
+    if (!conn_recvAccepted(conn, &protect_commentSupport)) {
+      free(request);
+      if (conn->error) {
+	return conn->error;
+      }
+      // that was the status of a squirtd without the command
+      *reply = PROTECT_REPLY_FILENOTE;
+      return protect_connSendFileNote(conn, filename, protection, dateStamp, comment);
+    }
+    conn_send(conn, request + headerLength, length - headerLength, "file info");
+  } else {
+    conn_send(conn, request, length, "file info");
+    if (comment) {
+      *reply = PROTECT_REPLY_ACCEPTED;
+    }
   }
+  free(request);
 
+  return conn->error;
+}
+
+
+int
+protect_connRecvFileInfoStatus(squirt_conn_t* conn, protect_reply_t reply)
+{
   uint32_t error;
 
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("protect: failed to read remote status");
+  if (reply == PROTECT_REPLY_ACCEPTED && !conn_recvAccepted(conn, &protect_commentSupport)) {
+    return conn->error;
+  }
+
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
+  }
+
+  if (reply == PROTECT_REPLY_FILENOTE) {
+    uint32_t noteError = exec_connRecvOutput(conn, protect_discardOutput, 0);
+    if (error == 0 && noteError != 0) {
+      error = conn->error ? conn->error : ERROR_SET_COMMENT_FAILED;
+    }
+  }
+
+  return error;
+}
+
+
+int
+protect_connFileWithComment(squirt_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment)
+{
+  protect_reply_t reply;
+  int error = protect_connSendFileInfo(conn, filename, protection, dateStamp, comment, &reply);
+  if (error == 0) {
+    error = protect_connRecvFileInfoStatus(conn, reply);
   }
+  return error;
+}
+
+
+static int
+protect_checkResult(squirt_conn_t* conn, const char* filename, int error)
+{
+  conn_detach(conn);
 
   if (error != 0) {
     fprintf(stderr, "\n**FAILED** to protect %s\n%s\n", filename, util_getErrorString(error));
@@ -61,3 +218,37 @@ protect_file(const char* filename, uint32_t protection, dir_datestamp_t* dateSta
 
   return error;
 }
+
+
+int
+protect_sendFileInfo(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, protect_reply_t* reply)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+  return protect_checkResult(&conn, filename, protect_connSendFileInfo(&conn, filename, protection, dateStamp, comment, reply));
+}
+
+
+int
+protect_recvFileInfoStatus(const char* filename, protect_reply_t reply)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+  return protect_checkResult(&conn, filename, protect_connRecvFileInfoStatus(&conn, reply));
+}
+
+
+int
+protect_fileWithComment(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+  return protect_checkResult(&conn, filename, protect_connFileWithComment(&conn, filename, protection, dateStamp, comment));
+}
+
+
+int
+protect_file(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp)
+{
+  return protect_fileWithComment(filename, protection, dateStamp, 0);
+}
@@ -1,9 +1,49 @@
 #pragma once
 #include <stdint.h>
 #include "dir.h"
+#include "conn.h"
 
 void
 protect_cleanup(void);
 
 int
 protect_file(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp);
+
+// comment may be 0 to leave the remote comment unchanged
+int
+protect_fileWithComment(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment);
+
+// What comes back for a request, set by the send and handed to the receive
+typedef enum {
+  PROTECT_REPLY_STATUS,   // just the status
+  PROTECT_REPLY_ACCEPTED, // SQUIRT_FILEOP_REPLY and then the status
+  PROTECT_REPLY_FILENOTE, // the SET_INFO status, then the output and status of filenote
+} protect_reply_t;
+
+// split halves of protect_fileWithComment so several requests can be in flight,
+// statuses must be read back in the order the requests were sent. Until the
+// server is known to have SET_INFO_COMMENT, a request with a comment waits for
+// its answer, so the first must not be sent while others are in flight.
+int
+protect_sendFileInfo(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, protect_reply_t* reply);
+
+int
+protect_recvFileInfoStatus(const char* filename, protect_reply_t reply);
+
+// The SET_INFO or SET_INFO_COMMENT request for "filename" as sent, for the
+// caller to free. Returns 0 with "error" set if it can't be, such as when the
+// comment is too long.
+char*
+protect_encodeFileInfo(const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, size_t* length, uint32_t* error);
+
+// The same on "conn", nothing is printed and errors are returned, the remote
+// status or the connection's error
+
+int
+protect_connFileWithComment(squirt_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment);
+
+int
+protect_connSendFileInfo(squirt_conn_t* conn, const char* filename, uint32_t protection, dir_datestamp_t* dateStamp, const char* comment, protect_reply_t* reply);
+
+int
+protect_connRecvFileInfoStatus(squirt_conn_t* conn, protect_reply_t reply);
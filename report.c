@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "report.h"
+
+#define REPORT_TOP_N       10
+#define REPORT_BUCKETS     18 // <1ms, <2ms, <4ms ... <65.5s, then everything slower
+#define REPORT_MAX_DEPTH   256
+
+typedef struct {
+  uint64_t count;
+  uint64_t usecs;
+  uint64_t buckets[REPORT_BUCKETS];
+} report_timing_t;
+
+typedef struct {
+  char* path;
+  uint64_t usecs;
+} report_slowest_t;
+
+static const char* report_phaseNames[REPORT_PHASE_COUNT] = {
+  "listing",
+  "transfer",
+  "hashing",
+  "metadata",
+  "round_trips",
+};
+
+static const char* report_filesNames[REPORT_FILES_COUNT] = {
+  "transferred",
+  "skipped",
+  "verified",
+  "retried",
+};
+
+// restore --jobs workers record their uploads from their own threads
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int report_on = 0;
+static char* report_filename = 0;
+static uint64_t report_wallStart;
+static report_timing_t report_phases[REPORT_PHASE_COUNT];
+static report_timing_t report_fileTimes;
+static uint64_t report_fileCounts[REPORT_FILES_COUNT];
+static uint64_t report_fileBytes[REPORT_FILES_COUNT];
+static report_slowest_t report_slowestFiles[REPORT_TOP_N];
+static report_slowest_t report_slowestDirs[REPORT_TOP_N];
+static uint64_t report_dirChildTime[REPORT_MAX_DEPTH];
+static int report_dirDepth = -1;
+static int report_dirOverflow = 0; // directories nested past REPORT_MAX_DEPTH
+
+
+static void
+report_freeSlowest(report_slowest_t* slowest)
+{
+  for (int i = 0; i < REPORT_TOP_N; i++) {
+    if (slowest[i].path) {
+      free(slowest[i].path);
+    }
+    slowest[i].path = 0;
+    slowest[i].usecs = 0;
+  }
+}
+
+
+void
+report_cleanup(void)
+{
+  report_on = 0;
+  report_dirDepth = -1;
+  report_dirOverflow = 0;
+
+  if (report_filename) {
+    free(report_filename);
+    report_filename = 0;
+  }
+
+  report_freeSlowest(report_slowestFiles);
+  report_freeSlowest(report_slowestDirs);
+}
+
+
+uint64_t
+report_start(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+
+void
+report_enable(const char* format)
+{
+  if (strncmp(format, "json", 4) != 0 || (format[4] != 0 && format[4] != ':')) {
+    fatalError("unsupported report format %s", format);
+  }
+
+  if (format[4] == ':') {
+    if (!format[5]) {
+      fatalError("missing report filename");
+    }
+    report_filename = strdup(format+5);
+    if (!report_filename) {
+      fatalError("malloc failed");
+    }
+  }
+
+  memset(report_phases, 0, sizeof(report_phases));
+  memset(&report_fileTimes, 0, sizeof(report_fileTimes));
+  memset(report_fileCounts, 0, sizeof(report_fileCounts));
+  memset(report_fileBytes, 0, sizeof(report_fileBytes));
+  report_wallStart = report_start();
+  report_on = 1;
+}
+
+
+int
+report_enabled(void)
+{
+  return report_on;
+}
+
+
+static void
+report_addTiming(report_timing_t* timing, uint64_t usecs)
+{
+  int bucket = 0;
+  uint64_t limit = 1000;
+  while (bucket < REPORT_BUCKETS-1 && usecs >= limit) {
+    bucket++;
+    limit <<= 1;
+  }
+
+  timing->count++;
+  timing->usecs += usecs;
+  timing->buckets[bucket]++;
+}
+
+
+static void
+report_addSlowest(report_slowest_t* slowest, const char* path, uint64_t usecs)
+{
+  if (usecs <= slowest[REPORT_TOP_N-1].usecs) {
+    return;
+  }
+
+  char* copy = strdup(path);
+  if (!copy) {
+    fatalError("malloc failed");
+  }
+
+  if (slowest[REPORT_TOP_N-1].path) {
+    free(slowest[REPORT_TOP_N-1].path);
+  }
+
+  int i = REPORT_TOP_N-1;
+  while (i > 0 && slowest[i-1].usecs < usecs) {
+    slowest[i] = slowest[i-1];
+    i--;
+  }
+  slowest[i].path = copy;
+  slowest[i].usecs = usecs;
+}
+
+
+void
+report_phase(report_phase_t phase, uint64_t start)
+{
+  if (report_on) {
+    uint64_t usecs = report_start() - start;
+    pthread_mutex_lock(&report_mutex);
+    report_addTiming(&report_phases[phase], usecs);
+    pthread_mutex_unlock(&report_mutex);
+  }
+}
+
+
+void
+report_files(report_files_t type, uint64_t bytes)
+{
+  pthread_mutex_lock(&report_mutex);
+  report_fileCounts[type]++;
+  report_fileBytes[type] += bytes;
+  pthread_mutex_unlock(&report_mutex);
+}
+
+
+void
+report_file(const char* path, uint64_t start)
+{
+  if (report_on) {
+    uint64_t usecs = report_start() - start;
+    pthread_mutex_lock(&report_mutex);
+    report_addTiming(&report_fileTimes, usecs);
+    report_addSlowest(report_slowestFiles, path, usecs);
+    pthread_mutex_unlock(&report_mutex);
+  }
+}
+
+
+uint64_t
+report_dirBegin(void)
+{
+  if (report_dirDepth < REPORT_MAX_DEPTH-1) {
+    report_dirChildTime[++report_dirDepth] = 0;
+  } else {
+    report_dirOverflow++;
+  }
+  return report_start();
+}
+
+
+void
+report_dirEnd(const char* path, uint64_t start)
+{
+  uint64_t usecs = report_start() - start;
+  uint64_t self = usecs;
+
+  if (report_dirOverflow) {
+    // too deep to track its children, so its own time includes theirs
+    if (--report_dirOverflow == 0) {
+      report_dirChildTime[report_dirDepth] += usecs;
+    }
+  } else {
+    self -= report_dirChildTime[report_dirDepth];
+    if (report_dirDepth > 0) {
+      report_dirChildTime[--report_dirDepth] += usecs;
+    } else {
+      report_dirDepth = -1;
+    }
+  }
+
+  if (report_on) {
+    report_addSlowest(report_slowestDirs, path, self);
+  }
+}
+
+
+static void
+report_writeString(FILE* fp, const char* str)
+{
+  fputc('"', fp);
+  for (const unsigned char* ptr = (const unsigned char*)str; *ptr; ptr++) {
+    if (*ptr == '"' || *ptr == '\\') {
+      fprintf(fp, "\\%c", *ptr);
+    } else if (*ptr < 0x20) {
+      fprintf(fp, "\\u%04x", *ptr);
+    } else {
+      fputc(*ptr, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+
+static void
+report_writeTiming(FILE* fp, const report_timing_t* timing)
+{
+  fprintf(fp, "{\"count\": %llu, \"seconds\": %.3f, \"histogram\": [",
+	  (unsigned long long)timing->count, (double)timing->usecs/1000000.0);
+  for (int i = 0; i < REPORT_BUCKETS; i++) {
+    fprintf(fp, "%s%llu", i ? ", " : "", (unsigned long long)timing->buckets[i]);
+  }
+  fprintf(fp, "]}");
+}
+
+
+static void
+report_writeSlowest(FILE* fp, const report_slowest_t* slowest)
+{
+  fprintf(fp, "[");
+  for (int i = 0; i < REPORT_TOP_N && slowest[i].path; i++) {
+    fprintf(fp, "%s\n    {\"path\": ", i ? "," : "");
+    report_writeString(fp, slowest[i].path);
+    fprintf(fp, ", \"seconds\": %.3f}", (double)slowest[i].usecs/1000000.0);
+  }
+  fprintf(fp, "%s]", slowest[0].path ? "\n  " : "");
+}
+
+
+void
+report_write(const char* command)
+{
+  if (!report_on) {
+    return;
+  }
+
+  FILE* fp = stdout;
+  if (report_filename) {
+    fp = fopen(report_filename, "w");
+    if (!fp) {
+      fatalError("unable to open report file %s", report_filename);
+    }
+  } else {
+    printf("\n");
+  }
+
+  fprintf(fp, "{\n  \"command\": ");
+  report_writeString(fp, command);
+  fprintf(fp, ",\n  \"wall_seconds\": %.3f,\n", (double)(report_start() - report_wallStart)/1000000.0);
+
+  fprintf(fp, "  \"files\": {");
+  for (int i = 0; i < REPORT_FILES_COUNT; i++) {
+    fprintf(fp, "%s\n    \"%s\": {\"count\": %llu, \"bytes\": %llu}", i ? "," : "", report_filesNames[i],
+	    (unsigned long long)report_fileCounts[i], (unsigned long long)report_fileBytes[i]);
+  }
+  fprintf(fp, "\n  },\n");
+
+  // bucket i counts samples under 2^i milliseconds, the last bucket is everything slower
+  fprintf(fp, "  \"histogram_bucket_ms\": [");
+  for (int i = 0; i < REPORT_BUCKETS-1; i++) {
+    fprintf(fp, "%s%d", i ? ", " : "", 1 << i);
+  }
+  fprintf(fp, ", null],\n");
+
+  fprintf(fp, "  \"phases\": {");
+  for (int i = 0; i < REPORT_PHASE_COUNT; i++) {
+    fprintf(fp, "%s\n    \"%s\": ", i ? "," : "", report_phaseNames[i]);
+    report_writeTiming(fp, &report_phases[i]);
+  }
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"file_wall_clock\": ");
+  report_writeTiming(fp, &report_fileTimes);
+
+  fprintf(fp, ",\n  \"slowest_files\": ");
+  report_writeSlowest(fp, report_slowestFiles);
+  fprintf(fp, ",\n  \"slowest_directories\": ");
+  report_writeSlowest(fp, report_slowestDirs);
+  fprintf(fp, "\n}\n");
+
+  if (fp != stdout) {
+    fclose(fp);
+  } else {
+    fflush(stdout);
+  }
+}
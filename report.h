@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+  REPORT_PHASE_LIST,
+  REPORT_PHASE_TRANSFER,
+  REPORT_PHASE_HASH,
+  REPORT_PHASE_METADATA,
+  REPORT_PHASE_ROUNDTRIP,
+  REPORT_PHASE_COUNT
+} report_phase_t;
+
+typedef enum {
+  REPORT_FILES_TRANSFERRED,
+  REPORT_FILES_SKIPPED,
+  REPORT_FILES_VERIFIED,
+  REPORT_FILES_RETRIED,
+  REPORT_FILES_COUNT
+} report_files_t;
+
+// format is the argument to --report=, "json" or "json:filename"
+void
+report_enable(const char* format);
+
+int
+report_enabled(void);
+
+// microsecond timestamp to pass back to report_phase/report_file/report_dirEnd
+uint64_t
+report_start(void);
+
+void
+report_phase(report_phase_t phase, uint64_t start);
+
+void
+report_files(report_files_t type, uint64_t bytes);
+
+void
+report_file(const char* path, uint64_t start);
+
+// directory times exclude the time spent in their subdirectories
+uint64_t
+report_dirBegin(void);
+
+void
+report_dirEnd(const char* path, uint64_t start);
+
+void
+report_write(const char* command);
+
+void
+report_cleanup(void);
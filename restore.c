@@ -10,33 +10,111 @@
 #include <limits.h>
 #include <getopt.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 
 #include "main.h"
 #include "common.h"
 #include "exall.h"
 
+#define RESTORE_MAX_JOBS    8
+#define RESTORE_INFO_WINDOW 32 // SET_INFO requests in flight before their statuses are read
+
 typedef enum {
-  UPDATE_NOUPDATE,
-  UPDATE_CREATE,
-  UPDATE_EXALL,
-} restore_update_t;
+  PLAN_UNCHANGED,
+  PLAN_MAKEDIR,
+  PLAN_CREATE,
+  PLAN_UPDATE,
+  PLAN_METADATA,
+  PLAN_DELETE,
+  PLAN_COUNT
+} restore_action_t;
 
-static char* restore_currentDir = 0;
+typedef enum {
+  ORDER_LARGEST,
+  ORDER_SMALLEST,
+  ORDER_TREE,
+} restore_order_t;
+
+typedef struct restore_item {
+  restore_action_t action;
+  int isDir;
+  int index;
+  char* localPath;
+  char* remotePath;
+  uint32_t size;
+  dir_entry_t* info;
+  struct restore_item* next;
+} restore_item_t;
+
+static const char* restore_actionNames[PLAN_COUNT] = {
+  "unchanged",
+  "makedir",
+  "create",
+  "update",
+  "metadata",
+  "delete",
+};
+
+static char restore_currentDir[PATH_MAX];
+static char restore_localDir[PATH_MAX];
+static int restore_dirFd = -1;
 static char* restore_dirBuffer = 0;
 static char* restore_skipFile = 0;
 static int restore_quiet = 0;
 static int restore_crcVerify = 0;
+static int restore_planOnly = 0;
+static restore_order_t restore_order = ORDER_LARGEST;
+static restore_item_t* restore_planHead = 0;
+static restore_item_t* restore_planTail = 0;
+static int restore_planCount[PLAN_COUNT];
+static uint64_t restore_planBytes[PLAN_COUNT];
+static int restore_jobCount = 1;
+static const char* restore_hostname = 0;
+static pthread_t restore_threads[RESTORE_MAX_JOBS];
+static squirt_conn_t* restore_sessions[RESTORE_MAX_JOBS];
+static int restore_threadCount = 0;
+static uint32_t restore_workerError = 0;
+static char restore_workerMessage[PATH_MAX+256];
+static pthread_mutex_t restore_mutex = PTHREAD_MUTEX_INITIALIZER;
+static restore_item_t** restore_uploads = 0;
+static int restore_uploadCount = 0;
+static int restore_uploadNext = 0;
+static int restore_uploadsDone = 0;
+static uint64_t restore_bytesDone = 0;
+static uint64_t restore_uploadStart = 0;
+static dir_manifest_t* restore_manifest = 0;
+static dir_manifest_t* restore_manifestTail = 0;
+static dir_manifest_t* restore_manifestNext = 0;
 
 static void
-restore_restoreDir(const char* remote);
+restore_planDir(const char* remote, int listRemote);
+static void
+restore_collectDir(const char* dir);
+
+
+// Lets the workers finish the files they have started, then closes their sessions
+static void
+restore_joinWorkers(void)
+{
+  for (int i = 0; i < restore_threadCount; i++) {
+    pthread_join(restore_threads[i], 0);
+    conn_close(restore_sessions[i]);
+    restore_sessions[i] = 0;
+  }
+  restore_threadCount = 0;
+}
+
 
 void
 restore_cleanup()
 {
-  if (restore_currentDir) {
-    free(restore_currentDir);
-    restore_currentDir = 0;
+  restore_currentDir[0] = 0;
+  restore_localDir[0] = 0;
+
+  if (restore_dirFd >= 0) {
+    util_dirClose(restore_dirFd);
+    restore_dirFd = -1;
   }
 
   if (restore_dirBuffer) {
@@ -49,156 +127,108 @@ restore_cleanup()
     restore_skipFile = 0;
   }
 
+  // the workers are stopped before what they use is freed
+  pthread_mutex_lock(&restore_mutex);
+  restore_uploadNext = restore_uploadCount;
+  pthread_mutex_unlock(&restore_mutex);
+  restore_joinWorkers();
+  restore_workerError = 0;
+
+  pthread_mutex_lock(&restore_mutex);
+  if (restore_uploads) {
+    free(restore_uploads);
+    restore_uploads = 0;
+  }
+  restore_uploadCount = restore_uploadNext = 0;
+  pthread_mutex_unlock(&restore_mutex);
+
+  while (restore_planHead) {
+    restore_item_t* save = restore_planHead;
+    restore_planHead = restore_planHead->next;
+    free(save->localPath);
+    free(save->remotePath);
+    if (save->info) {
+      dir_freeEntry(save->info);
+    }
+    free(save);
+  }
+  restore_planTail = 0;
+
+  if (restore_manifest) {
+    dir_freeManifest(restore_manifest);
+    restore_manifest = restore_manifestTail = restore_manifestNext = 0;
+  }
 }
 
 
-static char*
-restore_fullPath(const char* name)
+static const char*
+restore_fullPath(char* path, size_t size, const char* name)
 {
-  if (!restore_currentDir) {
-    return strdup(name);
-  }
+  int length;
 
-  char* path = malloc(strlen(restore_currentDir) + strlen(name) + 2);
-  if (!path) {
-    return NULL;
-  }
-  if (restore_currentDir[strlen(restore_currentDir)-1] != ':') {
-    sprintf(path, "%s/%s", restore_currentDir, name);
+  if (!restore_currentDir[0]) {
+    length = snprintf(path, size, "%s", name);
+  } else if (restore_currentDir[strlen(restore_currentDir)-1] != ':') {
+    length = snprintf(path, size, "%s/%s", restore_currentDir, name);
   } else {
-    sprintf(path, "%s%s", restore_currentDir, name);
+    length = snprintf(path, size, "%s%s", restore_currentDir, name);
+  }
+
+  if (length < 0 || (size_t)length >= size) {
+    fatalError("path too long %s", name);
   }
+
   return path;
 }
 
-// Like restore_fullPath but uses originalName (without squirt_ prefix if present on Windows)
-static char*
-restore_fullOriginalPath(const char* name)
+
+// local path relative to the directory the restore is executed from
+static const char*
+restore_localPath(char* path, size_t size, const char* name)
 {
-  if (!restore_currentDir) {
-#ifdef _WIN32
-    // Check if name has squirt_ prefix and remove it if present (Windows only)
-    if (strncmp(name, "squirt_", 7) == 0) {
-      return strdup(name + 7);
-    }
-#endif
-    return strdup(name);
-  }
+  int length;
 
-  // Check if name has squirt_ prefix (Windows only)
-  const char* originalName = name;
-#ifdef _WIN32
-  if (strncmp(name, "squirt_", 7) == 0) {
-    originalName = name + 7;
+  if (!restore_localDir[0]) {
+    length = snprintf(path, size, "%s", name);
+  } else {
+    length = snprintf(path, size, "%s/%s", restore_localDir, name);
   }
-#endif
 
-  char* path = malloc(strlen(restore_currentDir) + strlen(originalName) + 2);
-  if (!path) {
-    return NULL;
-  }
-  if (restore_currentDir[strlen(restore_currentDir)-1] != ':') {
-    sprintf(path, "%s/%s", restore_currentDir, originalName);
-  } else {
-    sprintf(path, "%s%s", restore_currentDir, originalName);
+  if (length < 0 || (size_t)length >= size) {
+    fatalError("path too long %s", name);
   }
+
   return path;
 }
 
 
-static char*
+static int
 restore_pushDir(const char* dir)
 {
-  if (restore_currentDir) {
-    char* newDir = restore_fullPath(dir);
-    if (restore_currentDir) {
-      free(restore_currentDir);
-    }
-    restore_currentDir = newDir;
-  } else {
-    restore_currentDir = malloc(strlen(dir)+1);
-    strcpy(restore_currentDir, dir);
-  }
-
-  if (util_cd(restore_currentDir) != 0) {
-    // Directory doesn't exist, try to create it
-    printf("Directory %s doesn't exist, creating it...\n", restore_currentDir);
-    
-    // Use CLI command to create the directory
-    char createDirCmd[PATH_MAX];
-    snprintf(createDirCmd, sizeof(createDirCmd), "makedir \"%s\"", restore_currentDir);
-    
-    if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_CLI) != 0) {
-      fatalError("failed to connect to squirtd server");
-    }
-    
-    if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, createDirCmd) != 0) {
-      fatalError("send() makedir command failed");
-    }
-    
-    // Read the command output using the same pattern as exec_cmd
-    uint8_t c;
-    char buffer[1024];
-    int bindex = 0;
-    int exitState = 0;
-    while (util_recv(main_socketFd, &c, 1, 0) == 1) {
-      if (c == 0) {
-        exitState++;
-        if (exitState == 4) {
-          break;
-        }
-      } else if (c == 0x9B) {
-        buffer[bindex] = 0;
-        // Optionally print output for debugging
-        // printf("%s", buffer);
-        bindex = 0;
-      } else {
-        buffer[bindex++] = c;
-        if (c == '\n' || bindex == sizeof(buffer)-1) {
-          buffer[bindex] = 0;
-          // Optionally print output for debugging
-          // printf("%s", buffer);
-          bindex = 0;
-        }
-      }
-    }
-    
-    uint32_t error;
-    if (util_recvU32(main_socketFd, &error) != 0) {
-      fatalError("makedir: failed to read remote status");
-    }
-    
-    if (error != 0) {
-      fatalError("failed to create directory %s (error: %d)", restore_currentDir, error);
-    }
-    
-    printf("Directory %s created successfully\n", restore_currentDir);
-    
-    // Now try to change to the directory again
-    if (util_cd(restore_currentDir) != 0) {
-      fatalError("unable to restore %s even after creating it", restore_currentDir);
-    }
-  }
+  char path[PATH_MAX];
+  strcpy(restore_currentDir, restore_fullPath(path, sizeof(path), dir));
 
   char* safe = util_safeName(dir);
   if (!safe) {
     fatalError("failed to create safe name");
   }
 
-  char* cwd = getcwd(0, 0);
+  strcpy(restore_localDir, restore_localPath(path, sizeof(path), safe));
 
-  if (chdir(safe) == -1) {
-    fatalError("unable to chdir to %s", safe);
+  int parentFd = restore_dirFd;
+  restore_dirFd = util_dirPush(parentFd, safe, 0);
+  if (restore_dirFd < 0) {
+    fatalError("unable to open %s", safe);
   }
 
   free(safe);
 
-  return cwd;
+  return parentFd;
 }
 
 
 static void
-restore_popDir(char* cwd)
+restore_popDir(int parentFd)
 {
   for (int i = strlen(restore_currentDir)-1; i >= 0; --i) {
     if (restore_currentDir[i] == '/' || (i > 0 && restore_currentDir[i-1] == ':')) {
@@ -207,78 +237,39 @@ restore_popDir(char* cwd)
     }
   }
 
-  if (chdir(cwd)) {
-    fatalError("failed to cd to %s", cwd);
+  char* slash = strrchr(restore_localDir, '/');
+  if (slash) {
+    *slash = 0;
+  } else {
+    restore_localDir[0] = 0;
+  }
+
+  if (util_dirPop(restore_dirFd, parentFd) != 0) {
+    fatalError("failed to return to parent of %s", restore_currentDir);
   }
-  free((void*)cwd);
+  restore_dirFd = parentFd;
 }
 
 
-static int
-restore_updateExAll(const char* filename, const char* path)
+static dir_entry_t*
+restore_readExAll(const char* filename)
 {
   dir_entry_t *temp = dir_newDirEntry();
-  if (!exall_readExAllData(temp, filename)) {
+  if (!exall_readExAllData(restore_dirFd, temp, filename)) {
     fatalError("unabled to read exall data for %s\n", filename);
   }
-
-  int error =  protect_file(path, temp->prot, &temp->ds);
-
-  if (temp->comment && strlen(temp->comment) > 0) {
-    char buffer[PATH_MAX];
-    snprintf(buffer, sizeof(buffer), "filenote \"%s\" \"%s\"", path, temp->comment);
-    if (util_exec(buffer) != 0) {
-      fprintf(stderr, "failed to set comment %s\n", filename);
-    }
-  }
-
-    dir_freeEntry(temp);
-
-
-  return error;
+  return temp;
 }
 
 
-static restore_update_t
-restore_remoteFileNeedsUpdating(const char* filename, int isDir, dir_entry_t* list)
+static int
+restore_sendInfo(const char* path, dir_entry_t* info, protect_reply_t* reply)
 {
-  restore_update_t update = UPDATE_NOUPDATE;
-  int found = 0;
-  dir_entry_t* entry = list;
-
-  while (entry) {
-    if (strcmp(entry->name, filename) == 0) {
-      found = 1;
-      break;
-    }
-    entry = entry->next;
-  }
-
-  if (found) {
-    dir_entry_t *temp = dir_newDirEntry();
-    struct stat st;
-    if (stat(filename, &st) == 0) {
-      if (isDir || st.st_size == (off_t)entry->size) {
-	if (!exall_readExAllData(temp, filename)) {
-	  fatalError("unable to read exall data for %s\n", filename);
-	}
-	if (!exall_identicalExAllData(temp, entry)) {
-	  update = UPDATE_EXALL;
-	}
-      } else if (st.st_size != (off_t)entry->size) {
-	update = UPDATE_CREATE;
-      }
-    } else {
-      fatalError("unable to read %s\n", filename);
-    }
-    dir_freeEntry(temp);
-  } else {
-    update = UPDATE_CREATE;
-  }
-
-  return update;
+  // an empty comment clears any stale comment left on the amiga
+  return protect_sendFileInfo(path, info->prot, &info->ds, info->comment ? info->comment : "", reply);
 }
 
+
 void
 restore_printProgress(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength)
 {
@@ -296,7 +287,6 @@ restore_printProgress(const char* filename, struct timeval* start, uint32_t tota
 #else
   printf("\r");
 #endif
-  fflush(stdout);
   if (percentage >= 100) {
     printf("\xE2\x9C\x85 "); // utf-8 tick
   } else {
@@ -310,8 +300,52 @@ restore_printProgress(const char* filename, struct timeval* start, uint32_t tota
 #endif
 }
 
+
+static int
+restore_skip(const char* filename)
+{
+  int skipFile = 0;
+  if (restore_skipFile) {
+    char pathBuffer[PATH_MAX];
+    const char* path = restore_fullPath(pathBuffer, sizeof(pathBuffer), filename);
+    char* found = strstr(restore_skipFile, path);
+    if (found) {
+      found += strlen(path);
+      skipFile = *found == 0 || *found == '\n' || *found == '\r';
+    }
+  }
+  return skipFile;
+}
+
+
 static void
-restore_operation(const char* filename, void* data)
+restore_addItem(restore_action_t action, int isDir, const char* localPath, const char* remotePath, uint32_t size, dir_entry_t* info)
+{
+  restore_item_t* item = calloc(1, sizeof(restore_item_t));
+  if (!item || !(item->localPath = strdup(localPath)) || !(item->remotePath = strdup(remotePath))) {
+    fatalError("malloc failed");
+  }
+
+  item->action = action;
+  item->isDir = isDir;
+  item->size = size;
+  item->info = info;
+
+  if (restore_planTail) {
+    item->index = restore_planTail->index + 1;
+    restore_planTail->next = item;
+  } else {
+    restore_planHead = item;
+  }
+  restore_planTail = item;
+
+  restore_planCount[action]++;
+  restore_planBytes[action] += size;
+}
+
+
+static void
+restore_collectEntry(const char* filename, void* data)
 {
   if (strcmp(filename, ".") == 0 ||
       strcmp(filename, "..") == 0 ||
@@ -319,17 +353,71 @@ restore_operation(const char* filename, void* data)
     return;
   }
 
-  dir_entry_t* entry = data;
-  char* path = restore_fullPath(filename);
+  dir_entry_list_t* known = data;
 
-  // On restore, filename is already the safe filename (with prefix)
-  // We need to use it as source for reading, but send the original name to Amiga
-  char* safeFilename = strdup(filename);
-  if (!safeFilename) {
-    free(path);
-    fatalError("failed to duplicate filename %s", filename);
+  const char* originalFilename = filename;
+#ifdef _WIN32
+  if (strncmp(filename, "squirt_", 7) == 0) {
+    originalFilename = filename + 7;
+  }
+#endif
+
+  struct stat st;
+  if (util_dirStat(restore_dirFd, filename, &st) != 0) {
+    fatalError("unable to read %s\n", filename);
+  }
+
+  dir_entry_t* entry = restore_readExAll(originalFilename);
+  if (!S_ISDIR(st.st_mode)) {
+    // a file edited since the backup must not match the amiga's copy
+    entry->size = st.st_size;
+  }
+
+  if (known->tail == 0) {
+    known->head = known->tail = entry;
+  } else {
+    known->tail->next = entry;
+    known->tail = entry;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    restore_collectDir(filename);
+  }
+}
+
+
+// what the amiga should look like, so squirtd can send back only the differences
+static void
+restore_collectDir(const char* dir)
+{
+  int parentFd = restore_pushDir(dir);
+
+  dir_entry_list_t* known = calloc(1, sizeof(dir_entry_list_t));
+  if (!known) {
+    fatalError("malloc failed");
   }
-  
+  dir_addManifest(&restore_manifestTail, restore_currentDir, known);
+  if (!restore_manifest) {
+    restore_manifest = restore_manifestTail;
+  }
+
+  util_dirOperationAt(restore_dirFd, ".", restore_collectEntry, known);
+
+  restore_popDir(parentFd);
+}
+
+
+static void
+restore_planEntry(const char* filename, void* data)
+{
+  if (strcmp(filename, ".") == 0 ||
+      strcmp(filename, "..") == 0 ||
+      strcmp(filename, SQUIRT_EXALL_INFO_DIR) == 0) {
+    return;
+  }
+
+  dir_entry_list_t* list = data;
+
   // Get original filename by removing "squirt_" prefix if present (Windows only)
   const char* originalFilename = filename;
 #ifdef _WIN32
@@ -338,282 +426,444 @@ restore_operation(const char* filename, void* data)
   }
 #endif
 
-  // Create path with original filename for Amiga operations
-  char* originalPath = restore_fullOriginalPath(filename);
+  char remotePath[PATH_MAX], localPath[PATH_MAX];
+  restore_fullPath(remotePath, sizeof(remotePath), originalFilename);
+  restore_localPath(localPath, sizeof(localPath), filename);
+
+  struct stat st;
+  if (util_dirStat(restore_dirFd, filename, &st) != 0) {
+    fatalError("unable to read %s\n", filename);
+  }
+  int isDir = S_ISDIR(st.st_mode);
+  uint32_t size = isDir ? 0 : st.st_size;
+
+  dir_entry_t* remote = list ? list->head : 0;
+  while (remote && strcmp(remote->name, originalFilename) != 0) {
+    remote = remote->next;
+  }
+
+  dir_entry_t* info = restore_readExAll(originalFilename);
+  if (!isDir) {
+    // the size saved by the backup is stale once the file has been edited
+    info->size = size;
+  }
+  restore_action_t action = PLAN_UNCHANGED;
+
+  if (!remote) {
+    action = isDir ? PLAN_MAKEDIR : PLAN_CREATE;
+  } else if (!isDir && (st.st_size != (off_t)remote->size ||
+			info->ds.days != remote->ds.days || info->ds.mins != remote->ds.mins || info->ds.ticks != remote->ds.ticks)) {
+    // content edited to the same length only shows in the datestamp, so
+    // that alone is never trusted to a SET_INFO
+    action = PLAN_UPDATE;
+  } else if (!exall_identicalExAllData(info, remote)) {
+    action = PLAN_METADATA;
+  }
 
-  int isDir = util_isDirectory(filename);
-  restore_update_t update = restore_remoteFileNeedsUpdating(filename, isDir, entry);
+  restore_addItem(action, isDir, localPath, remotePath, size, info);
 
   if (isDir) {
-    if (update == UPDATE_CREATE) {
-      char buffer[PATH_MAX];
-      snprintf(buffer, sizeof(buffer), "makedir \"%s\"", path);
-      if (util_exec(buffer) != 0) {
-	fatalError("failed to create %s", filename);
-      }
+    // the children of a directory that is yet to be created can't be listed
+    restore_planDir(filename, remote != 0);
+  }
+}
+
+
+static void
+restore_planDir(const char* dir, int listRemote)
+{
+  uint64_t dirStart = report_dirBegin();
+  int parentFd = restore_pushDir(dir);
+
+  dir_entry_list_t* list = 0;
+  if (listRemote) {
+    dir_manifest_t* manifest = dir_findManifest(restore_manifest, restore_manifestNext, restore_currentDir);
+    if (manifest) {
+      list = manifest->remote;
+      manifest->remote = 0;
+      restore_manifestNext = manifest->next;
     }
-    restore_restoreDir(filename);
-    switch (update) {
-    case UPDATE_CREATE:
-    case UPDATE_EXALL:
-      printf("\xE2\x8C\x9B %s restoring...", path); // utf-8 hourglass
-      fflush(stdout);
-
-      if (restore_updateExAll(originalFilename, originalPath) != 0) {
-	fatalError("failed to update ExAll for %s", originalFilename);
-      }
 
-#ifndef _WIN32
-	printf("\r%c[K", 27);
-#else
-	printf("\r");
-#endif
-	printf("\xE2\x9C\x85 %s restoring...done\n", path); // utf-8 tick
-      break;
-    case UPDATE_NOUPDATE:
+    if (!list) {
+      // only the directory being restored gets here, its parent wasn't listed
+      restore_addItem(PLAN_MAKEDIR, 1, restore_localDir, restore_currentDir, 0, 0);
+    }
+  }
 
-      if (!restore_quiet) {
-	printf("\xE2\x9C\x85 %s\n", path); // utf-8 tick
+  util_dirOperationAt(restore_dirFd, ".", restore_planEntry, list);
+
+  if (list) {
+    char remotePath[PATH_MAX], localPath[PATH_MAX];
+    struct stat st;
+    for (dir_entry_t* entry = list->head; entry; entry = entry->next) {
+      if (!restore_skip(entry->name) && util_dirStat(restore_dirFd, entry->name, &st) != 0) {
+	restore_addItem(PLAN_DELETE, entry->type > 0,
+			restore_localPath(localPath, sizeof(localPath), entry->name),
+			restore_fullPath(remotePath, sizeof(remotePath), entry->name),
+			entry->type > 0 ? 0 : entry->size, 0);
       }
-      break;
     }
-  } else {
-    switch (update) {
-    case UPDATE_CREATE:
-    case UPDATE_EXALL:
-      printf("\xE2\x8C\x9B %s restoring...", path); // utf-8 hourglass
-      fflush(stdout);
-      char updateMessage[PATH_MAX];
-      sprintf(updateMessage, "\xE2\x9C\x85 %s updating...", path);
-      
-      // When restoring to Amiga, use the original filename as destination
-      // but read from local safe filename
-      int uploadAttempts = 0;
-      int maxAttempts = restore_crcVerify ? 3 : 1; // Allow retries only with CRC32 verification
-      
-      while (uploadAttempts < maxAttempts) {
-        uploadAttempts++;
-        
-        if (squirt_file(safeFilename, updateMessage, originalFilename, 1, restore_printProgress) != 0) {
-          fatalError("failed to restore %s\n", path);
-        }
-        
-        if (restore_crcVerify) {
-          int crcResult = backup_doCrcVerify(path);
-          if (crcResult == 1) {
-            // CRC mismatch
-            if (uploadAttempts < maxAttempts) {
-              printf("\n\xE2\x9D\x8C CRC32 mismatch for %s - retrying upload (attempt %d/%d)\n", path, uploadAttempts + 1, maxAttempts);
-              continue; // Retry upload
-            } else {
-              fatalError("CRC32 verification failed for %s after %d attempts", path, maxAttempts);
-            }
-          } else if (crcResult == 2) {
-            fatalError("CRC32 verification failed - remote file not found: %s", path);
-          }
-          // CRC verification passed (crcResult == 0)
-        }
-        
-        break; // Upload successful, exit retry loop
-      }
-      
-      if (restore_updateExAll(originalFilename, originalPath) != 0) {
-	fatalError("failed to update ExAll for %s", originalFilename);
+    dir_freeEntryList(list);
+  }
+
+  report_dirEnd(restore_currentDir, dirStart);
+  restore_popDir(parentFd);
+}
+
+
+static void
+restore_printPlan(void)
+{
+  for (restore_item_t* item = restore_planHead; item; item = item->next) {
+    if (item->action != PLAN_UNCHANGED || !restore_quiet) {
+      if (item->isDir) {
+	printf("%-9s %12s  %s/\n", restore_actionNames[item->action], "", item->remotePath);
+      } else {
+	printf("%-9s %12u  %s\n", restore_actionNames[item->action], item->size, item->remotePath);
       }
+    }
+  }
+
+  printf("\nplan:");
+  for (int i = 0; i < PLAN_COUNT; i++) {
+    printf("%s %d %s", i ? "," : "", restore_planCount[i], restore_actionNames[i]);
+  }
+  printf("\n%llu bytes to upload, %llu bytes unchanged\n",
+	 (unsigned long long)(restore_planBytes[PLAN_CREATE] + restore_planBytes[PLAN_UPDATE]),
+	 (unsigned long long)(restore_planBytes[PLAN_UNCHANGED] + restore_planBytes[PLAN_METADATA]));
+}
+
+
+static void
+restore_printDone(restore_item_t* item)
+{
+  uint64_t totalBytes = restore_planBytes[PLAN_CREATE] + restore_planBytes[PLAN_UPDATE];
+
+  pthread_mutex_lock(&restore_mutex);
+  restore_uploadsDone++;
+  restore_bytesDone += item->size;
+
+  // the eta assumes the remaining bytes go at the average rate so far
+  uint64_t elapsed = report_start() - restore_uploadStart;
+  uint32_t eta = 0;
+  if (restore_bytesDone) {
+    eta = (uint32_t)(((double)elapsed * (double)(totalBytes - restore_bytesDone) / (double)restore_bytesDone) / 1000000.0);
+  }
+
 #ifndef _WIN32
-	printf("\r%c[K", 27);
-#else
-	printf("\r");
-#endif
-	if (restore_crcVerify) {
-	  printf("\xE2\x9C\x85 %s restoring...done (CRC OK)\n", path); // utf-8 tick with CRC verification
-	} else {
-	  printf("\xE2\x9C\x85 %s restoring...done\n", path); // utf-8 tick
-	}
-      break;
-    case UPDATE_NOUPDATE:
-
-      if (restore_crcVerify) {
-	int crcResult = backup_doCrcVerify(path);
-	if (crcResult == 1) {
-	  // CRC mismatch - file needs to be re-uploaded
-	  printf("\xE2\x9D\x8C CRC32 mismatch detected for %s - file will be re-uploaded\n", path);
-	  
-	  // Change update status to force re-upload
-	  printf("\xE2\x8C\x9B %s restoring...", path); // utf-8 hourglass
-	  fflush(stdout);
-	  
-	  // Perform upload with retry logic
-	  int retryAttempts = 0;
-	  int maxRetryAttempts = 3;
-	  
-	  while (retryAttempts < maxRetryAttempts) {
-	    retryAttempts++;
-	    
-	    if (squirt_file(safeFilename, path, originalFilename, 1, restore_printProgress) != 0) {
-	      fatalError("failed to restore %s\n", path);
-	    }
-	    
-	    int retryCrcResult = backup_doCrcVerify(path);
-	    if (retryCrcResult == 1) {
-	      // Still mismatch
-	      if (retryAttempts < maxRetryAttempts) {
-	        printf("\n\xE2\x9D\x8C CRC32 mismatch for %s - retrying upload (attempt %d/%d)\n", path, retryAttempts + 1, maxRetryAttempts);
-	        continue;
-	      } else {
-	        fatalError("CRC32 verification failed for %s after %d attempts", path, maxRetryAttempts);
-	      }
-	    } else if (retryCrcResult == 2) {
-	      fatalError("CRC32 verification failed - remote file not found: %s", path);
-	    }
-	    // CRC verification passed
-	    break;
-	  }
-	  
-	  if (restore_updateExAll(originalFilename, originalPath) != 0) {
-	    fatalError("failed to update ExAll for %s", originalFilename);
-	  }
-	  
-#ifndef _WIN32
-	  printf("\r%c[K", 27);
+  printf("\r%c[K", 27);
 #else
-	  printf("\r");
+  printf("\r");
 #endif
-	  printf("\xE2\x9C\x85 %s restoring...done (CRC OK)\n", path); // utf-8 tick with CRC verification
-	} else if (crcResult == 2) {
-	  fatalError("CRC32 verification failed - remote file not found: %s", path);
-	} else {
-	  // CRC verification passed - file is identical
-	  if (!restore_quiet) {
-	    printf("\xE2\x9C\x85 %s (CRC verified - no change)\n", path); // utf-8 tick with CRC verification message
-	  }
-	}
-      } else {
-	if (!restore_quiet) {
-	  printf("\xE2\x9C\x85 %s\n", path); // utf-8 tick
-	}
+  printf("\xE2\x9C\x85 %s restoring...done [%d/%d %d%% ETA %u:%02u]\n", item->remotePath, // utf-8 tick
+	 restore_uploadsDone, restore_uploadCount,
+	 totalBytes ? (int)((restore_bytesDone*100)/totalBytes) : 100, eta/60, eta%60);
+  fflush(stdout);
+  pthread_mutex_unlock(&restore_mutex);
+}
+
+
+// Returns 0, or the error with what failed described in "message"
+static int
+restore_connUploadFile(squirt_conn_t* conn, restore_item_t* item, int showProgress, char* message, size_t messageSize)
+{
+  char updateMessage[PATH_MAX];
+  snprintf(updateMessage, sizeof(updateMessage), "\xE2\x9C\x85 %s updating...", item->remotePath);
+
+  uint64_t fileStart = report_start();
+  int error = squirt_connFile(conn, restore_dirFd, item->localPath, updateMessage, item->remotePath, 1, showProgress ? restore_printProgress : 0);
+  if (error != 0) {
+    snprintf(message, messageSize, "failed to restore %s: %s", item->remotePath,
+	     error < 0 ? strerror(errno) : conn->error ? conn_errorString(conn) : util_getErrorString(error));
+    return error;
+  }
+  report_phase(REPORT_PHASE_TRANSFER, fileStart);
+
+  uint64_t start = report_start();
+  dir_entry_t* info = item->info;
+  error = protect_connFileWithComment(conn, item->remotePath, info->prot, &info->ds, info->comment ? info->comment : "");
+  if (error != 0) {
+    snprintf(message, messageSize, "failed to update ExAll for %s: %s", item->remotePath,
+	     conn->error ? conn_errorString(conn) : util_getErrorString(error));
+    return error;
+  }
+  report_phase(REPORT_PHASE_METADATA, start);
+  report_file(item->remotePath, fileStart);
+
+  return 0;
+}
+
+
+static void
+restore_uploadFile(restore_item_t* item, int showProgress)
+{
+  char message[PATH_MAX+256];
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  if (restore_connUploadFile(&conn, item, showProgress, message, sizeof(message)) != 0) {
+    fatalError("%s", message);
+  }
+
+  conn_detach(&conn);
+}
+
+
+// Uploads over a session of its own. Only the main thread may exit, so the
+// first error stops every worker and is reported once they have all finished
+static void*
+restore_worker(void* arg)
+{
+  squirt_conn_t* conn = arg;
+  char message[PATH_MAX+256];
+
+  pthread_mutex_lock(&restore_mutex);
+  while (!restore_workerError && restore_uploadNext < restore_uploadCount) {
+    restore_item_t* item = restore_uploads[restore_uploadNext++];
+    pthread_mutex_unlock(&restore_mutex);
+
+    int error = restore_connUploadFile(conn, item, 0, message, sizeof(message));
+    if (error == 0) {
+      restore_printDone(item);
+    }
+
+    pthread_mutex_lock(&restore_mutex);
+    if (error != 0) {
+      if (!restore_workerError) {
+	restore_workerError = error < 0 ? ERROR_FILE_READ_FAILED : error;
+	strcpy(restore_workerMessage, message);
       }
       break;
     }
   }
+  pthread_mutex_unlock(&restore_mutex);
 
-  free(originalPath);
-  free(path);
+  return 0;
 }
 
 
 static int
-restore_skip(const char* filename)
+restore_compareUploads(const void* a, const void* b)
 {
-  int skipFile = 0;
-  if (restore_skipFile) {
-    const char* path = restore_fullPath(filename);
-    char* found = strstr(restore_skipFile, path);
-    if (found) {
-      found += strlen(path);
-      skipFile = *found == 0 || *found == '\n' || *found == '\r';
-    }
-    free((void*)path);
+  const restore_item_t* one = *(restore_item_t* const*)a;
+  const restore_item_t* two = *(restore_item_t* const*)b;
+
+  if (restore_order != ORDER_TREE && one->size != two->size) {
+    int smallerFirst = one->size < two->size ? -1 : 1;
+    return restore_order == ORDER_SMALLEST ? smallerFirst : -smallerFirst;
   }
-  return skipFile;
+
+  return one->index - two->index;
 }
 
+
 static void
-restore_list(dir_entry_list_t* list)
+restore_startUploads(void)
 {
-  util_dirOperation(".", restore_operation, list->head);
+  int count = restore_planCount[PLAN_CREATE] + restore_planCount[PLAN_UPDATE];
+  if (!count) {
+    return;
+  }
 
-  dir_entry_t* entry = list->head;
-  while (entry) {
-    struct stat st;
-    if (!restore_skip(entry->name)) {
-      if (stat(entry->name, &st) != 0) {
-	char* path = restore_fullPath(entry->name);
-	char* cwd = getcwd(0, 0);
-	if (!cwd) {
-	  perror("cwd failed");
-	}
-	printf("PROB NEEDS DELETING %s (%s) (%s)\n", path, entry->name, cwd);
-	free(path);
+  restore_uploads = malloc(sizeof(restore_item_t*) * count);
+  if (!restore_uploads) {
+    fatalError("malloc failed");
+  }
+
+  restore_uploadCount = 0;
+  for (restore_item_t* item = restore_planHead; item; item = item->next) {
+    if (item->action == PLAN_CREATE || item->action == PLAN_UPDATE) {
+      restore_uploads[restore_uploadCount++] = item;
+    }
+  }
+  qsort(restore_uploads, count, sizeof(restore_item_t*), restore_compareUploads);
+
+  restore_uploadStart = report_start();
+
+  if (restore_jobCount > 1) {
+    // the workers drain the sorted array while this thread sends the
+    // metadata-only updates. A standalone squirtd has no session to spare,
+    // then everything is uploaded here as it would be without --jobs.
+    for (int i = 0; i < restore_jobCount && i < count; i++) {
+      squirt_conn_t* conn = conn_openSession(restore_hostname);
+      if (!conn) {
+	break;
+      }
+      if (pthread_create(&restore_threads[i], 0, restore_worker, conn) != 0) {
+	conn_close(conn);
+	break;
       }
+      restore_sessions[i] = conn;
+      restore_threadCount++;
+    }
+    if (restore_threadCount) {
+      return;
     }
-    entry = entry->next;
+  }
+
+  for (; restore_uploadNext < count; restore_uploadNext++) {
+    restore_item_t* item = restore_uploads[restore_uploadNext];
+    printf("\xE2\x8C\x9B %s restoring...", item->remotePath); // utf-8 hourglass
+    fflush(stdout);
+    restore_uploadFile(item, 1);
+    restore_printDone(item);
   }
 }
 
+
 static void
-restore_restoreDir(const char* remote)
+restore_waitUploads(void)
 {
-  char* local = restore_pushDir(remote);
-
-  if (dir_process(restore_currentDir, restore_list) != 0) {
-    // Directory doesn't exist, try to create it
-    printf("Directory %s doesn't exist, creating it...\n", remote);
-    
-    // Use CLI command to create the directory
-    char createDirCmd[PATH_MAX];
-    snprintf(createDirCmd, sizeof(createDirCmd), "makedir \"%s\"", remote);
-    
-    if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_CLI) != 0) {
-      fatalError("failed to connect to squirtd server");
+  restore_joinWorkers();
+
+  if (restore_workerError) {
+    fatalError("%s", restore_workerMessage);
+  }
+}
+
+
+static void
+restore_updateInfo(int dirs)
+{
+  int count = 0;
+  restore_item_t** items = malloc(sizeof(restore_item_t*) * (restore_planTail ? restore_planTail->index+1 : 1));
+  if (!items) {
+    fatalError("malloc failed");
+  }
+
+  for (restore_item_t* item = restore_planHead; item; item = item->next) {
+    if (item->isDir == dirs && item->info &&
+	(item->action == PLAN_METADATA || (dirs && item->action == PLAN_MAKEDIR))) {
+      items[count++] = item;
     }
-    
-    if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, createDirCmd) != 0) {
-      fatalError("send() makedir command failed");
+  }
+
+  if (dirs) {
+    // children before their parents
+    for (int i = 0; i < count/2; i++) {
+      restore_item_t* save = items[i];
+      items[i] = items[count-1-i];
+      items[count-1-i] = save;
     }
-    
-    // Read the command output using the same pattern as exec_cmd
-    uint8_t c;
-    char buffer[1024];
-    int bindex = 0;
-    int exitState = 0;
-    while (util_recv(main_socketFd, &c, 1, 0) == 1) {
-      if (c == 0) {
-        exitState++;
-        if (exitState == 4) {
-          break;
-        }
-      } else if (c == 0x9B) {
-        buffer[bindex] = 0;
-        // Optionally print output for debugging
-        // printf("%s", buffer);
-        bindex = 0;
-      } else {
-        buffer[bindex++] = c;
-        if (c == '\n' || bindex == sizeof(buffer)-1) {
-          buffer[bindex] = 0;
-          // Optionally print output for debugging
-          // printf("%s", buffer);
-          bindex = 0;
-        }
+  }
+
+  uint64_t start = report_start();
+  protect_reply_t replies[RESTORE_INFO_WINDOW];
+  int sent = 0, received = 0;
+  while (received < count) {
+    if (sent < count && sent - received < RESTORE_INFO_WINDOW) {
+      if (restore_sendInfo(items[sent]->remotePath, items[sent]->info, &replies[sent % RESTORE_INFO_WINDOW]) != 0) {
+	fatalError("failed to update ExAll for %s", items[sent]->remotePath);
       }
+      sent++;
+    } else {
+      if (protect_recvFileInfoStatus(items[received]->remotePath, replies[received % RESTORE_INFO_WINDOW]) != 0) {
+	fatalError("failed to update ExAll for %s", items[received]->remotePath);
+      }
+      printf("\xE2\x9C\x85 %s%s restoring...done\n", items[received]->remotePath, dirs ? "/" : ""); // utf-8 tick
+      received++;
     }
-    
-    uint32_t error;
-    if (util_recvU32(main_socketFd, &error) != 0) {
-      fatalError("makedir: failed to read remote status");
-    }
-    
-    if (error != 0) {
-      fatalError("failed to create directory %s (error: %d)", remote, error);
+  }
+  if (count) {
+    report_phase(REPORT_PHASE_METADATA, start);
+  }
+
+  free(items);
+}
+
+
+static void
+restore_makeDir(restore_item_t* item)
+{
+  uint64_t start = report_start();
+
+  if (!item->info) {
+    // the directory being restored, its parents may be missing too
+    char path[PATH_MAX];
+    strcpy(path, item->remotePath);
+    char* ptr = strchr(path, ':');
+    while (ptr && (ptr = strchr(ptr+1, '/'))) {
+      *ptr = 0;
+      fileop_makeDir(path);
+      *ptr = '/';
     }
-    
-    printf("Directory %s created successfully\n", remote);
-    
-    // Now try to read the directory again
-    if (dir_process(restore_currentDir, restore_list) != 0) {
-      fatalError("unable to read %s even after creating it", remote);
+  }
+
+  uint32_t error = fileop_makeDir(item->remotePath);
+  if (error != 0) {
+    fatalError("failed to create directory %s (%s)", item->remotePath, util_getErrorString(error));
+  }
+  report_phase(REPORT_PHASE_ROUNDTRIP, start);
+
+  printf("\xE2\x9C\x85 %s/ created\n", item->remotePath); // utf-8 tick
+}
+
+
+static void
+restore_redoFile(const char* localName, const char* remotePath, void* data)
+{
+  restore_item_t* item = data;
+  (void)localName;
+  restore_uploadFile(item, 1);
+
+#ifndef _WIN32
+  printf("\r%c[K", 27);
+#else
+  printf("\r");
+#endif
+  printf("\xE2\x9C\x85 %s restoring...done\n", remotePath); // utf-8 tick
+}
+
+
+static void
+restore_execute(void)
+{
+  verify_batch_t* batch = restore_crcVerify ? verify_newBatch() : 0;
+
+  // the plan is in tree order so parents are created before their children
+  for (restore_item_t* item = restore_planHead; item; item = item->next) {
+    if (item->action == PLAN_MAKEDIR) {
+      restore_makeDir(item);
+    } else if (!item->isDir && item->action != PLAN_DELETE) {
+      if (item->action == PLAN_UNCHANGED) {
+	if (!restore_quiet) {
+	  printf("\xE2\x9C\x85 %s\n", item->remotePath); // utf-8 tick
+	}
+	report_files(REPORT_FILES_SKIPPED, item->size);
+      } else if (item->action != PLAN_METADATA) {
+	report_files(REPORT_FILES_TRANSFERRED, item->size);
+      }
+
+      if (batch) {
+	// hashed in the background, a mismatch is uploaded again in verify_reconcile
+	verify_queue(batch, restore_dirFd, item->localPath, item->remotePath, item);
+      }
     }
   }
 
-  restore_popDir(local);
+  restore_startUploads();
+  restore_updateInfo(0);
+  restore_waitUploads();
+
+  if (batch) {
+    verify_reconcile(batch, restore_redoFile);
+  }
+
+  // uploads change the datestamps of the directories they land in
+  restore_updateInfo(1);
+
+  for (restore_item_t* item = restore_planHead; item; item = item->next) {
+    if (item->action == PLAN_DELETE) {
+      printf("PROB NEEDS DELETING %s\n", item->remotePath);
+    }
+  }
 }
 
 
 _Noreturn static void
 restore_usage(void)
 {
-  fatalError("invalid arguments\nusage: %s hostname dir_name", main_argv0);
+  fatalError("invalid arguments\nusage: %s [--quiet] [--crc32] [--plan] [--order=largest|smallest|tree] [--jobs=N] [--skipfile=skipfile] [--report=json[:filename]] hostname dir_name\n--crc32 waits for each directory's remote ssum before the next directory", main_argv0);
 }
 
 void
@@ -629,7 +879,11 @@ restore_main(int argc, char* argv[])
       {
        {"quiet",    no_argument, &restore_quiet, 'q'},
        {"crc32",    no_argument, &restore_crcVerify, 'c'},
+       {"plan",     no_argument, &restore_planOnly, 'p'},
        {"skipfile", required_argument, 0, 's'},
+       {"report",   required_argument, 0, 'j'},
+       {"jobs",     required_argument, 0, 'n'},
+       {"order",    required_argument, 0, 'o'},
        {0, 0, 0, 0}
       };
     int option_index = 0;
@@ -646,6 +900,29 @@ restore_main(int argc, char* argv[])
 	}
 	skipFile = optarg;
 	break;
+      case 'j':
+	if (optarg == 0 || strlen(optarg) == 0) {
+	  restore_usage();
+	}
+	report_enable(optarg);
+	break;
+      case 'n':
+	restore_jobCount = optarg ? atoi(optarg) : 0;
+	if (restore_jobCount < 1 || restore_jobCount > RESTORE_MAX_JOBS) {
+	  restore_usage();
+	}
+	break;
+      case 'o':
+	if (optarg && strcmp(optarg, "largest") == 0) {
+	  restore_order = ORDER_LARGEST;
+	} else if (optarg && strcmp(optarg, "smallest") == 0) {
+	  restore_order = ORDER_SMALLEST;
+	} else if (optarg && strcmp(optarg, "tree") == 0) {
+	  restore_order = ORDER_TREE;
+	} else {
+	  restore_usage();
+	}
+	break;
       case '?':
       default:
 	restore_usage();
@@ -673,6 +950,12 @@ restore_main(int argc, char* argv[])
   }
 
   util_connect(hostname);
+  restore_hostname = hostname;
+
+  restore_dirFd = util_dirOpenCwd();
+  if (restore_dirFd < 0) {
+    fatalError("unable to open current directory");
+  }
 
   char* token = strtok(path, ":");
   char* dir = 0;
@@ -685,12 +968,12 @@ restore_main(int argc, char* argv[])
 	fatalError("malloc failed");
       }
       sprintf(restore_dirBuffer, "%s:", dir);
-      free(restore_pushDir(restore_dirBuffer));
+      util_dirClose(restore_pushDir(restore_dirBuffer));
       do {
 	dir = token;
 	token = strtok(0, "/");
 	if (token) {
-	  free(restore_pushDir(dir));
+	  util_dirClose(restore_pushDir(dir));
 	}
       } while (token);
     } else {
@@ -704,27 +987,25 @@ restore_main(int argc, char* argv[])
   }
 
   if (dir) {
-    restore_restoreDir(dir);
-    
-    // Change back to parent directory to release lock on created directory
-    // This prevents "object in use" errors when trying to delete the directory
-    char* parentDir = strdup(restore_dirBuffer ? restore_dirBuffer : "work:");
-    if (parentDir) {
-      // Remove the subdirectory part to get parent
-      char* lastColon = strrchr(parentDir, ':');
-      if (lastColon && *(lastColon + 1) != '\0') {
-        // If there's content after the colon, it's a subdirectory
-        *(lastColon + 1) = '\0'; // Keep just "work:"
-      }
-      
-      printf("Releasing directory lock by changing to %s\n", parentDir);
-      if (util_cd(parentDir) != 0) {
-        // If we can't change to parent, try changing to root of the device
-        printf("Warning: Could not change to parent directory\n");
-      }
-      free(parentDir);
+    // the plan's local paths are relative to the directory holding the one being restored
+    restore_localDir[0] = 0;
+    restore_collectDir(dir);
+
+    uint64_t start = report_start();
+    dir_readManifest(restore_manifest);
+    report_phase(REPORT_PHASE_LIST, start);
+
+    restore_planDir(dir, 1);
+
+    if (restore_planOnly) {
+      restore_printPlan();
+      report_write("restore");
+      return;
     }
+
+    restore_execute();
   }
 
   printf("\nrestore complete!\n");
+  report_write("restore");
 }
@@ -8,51 +8,36 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 
 #include "main.h"
 #include "common.h"
-
-static int squirt_fileFd = 0;
-static char* squirt_readBuffer = 0;
-
+#include "async.h"
 
 void
 squirt_cleanup(void)
 {
-  if (squirt_readBuffer) {
-    free(squirt_readBuffer);
-    squirt_readBuffer = 0;
-  }
 
-  if (squirt_fileFd) {
-    close(squirt_fileFd);
-    squirt_fileFd = 0;
-  }
 }
 
 
 int
-squirt_file(const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength))
+squirt_connFile(squirt_conn_t* conn, int dirFd, const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength))
 {
   int total = 0;
   int32_t fileLength;
   struct stat st;
 
-  struct timeval start, end;
+  struct timeval end, lastProgress = {0, 0};
 
-  if (stat(filename, &st) == -1) {
-    fprintf(stderr, "Error: Cannot access file '%s' - %s\n", filename, strerror(errno));
-    return -1; // Return error code instead of terminating
+  if (util_dirStat(dirFd, filename, &st) == -1) {
+    return -1;
   }
 
   fileLength = st.st_size;
 
-  if (util_sendCommand(main_socketFd, writeToCurrentDir ? SQUIRT_COMMAND_SQUIRT_TO_CWD : SQUIRT_COMMAND_SQUIRT) != 0) {
-    fatalError("failed to connect to squirtd server");
-  }
-
   const char* amigaFilename;
 
   if (destFilename) {
@@ -61,95 +46,769 @@ squirt_file(const char* filename, const char* progressHeader, const char* destFi
     amigaFilename = basename((char*)filename);
   }
 
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, amigaFilename) != 0) {
-    fatalError("send() name failed");
-  }
-
-  if (util_sendU32(main_socketFd, fileLength) != 0) {
-    fatalError("send() fileLength failed");
+  conn_sendCommand(conn, writeToCurrentDir ? SQUIRT_COMMAND_SQUIRT_TO_CWD : SQUIRT_COMMAND_SQUIRT);
+  conn_sendString(conn, amigaFilename, "name");
+  if (conn_sendU32(conn, fileLength, "file length") != 0) {
+    return conn->error;
   }
 
-  squirt_fileFd = util_open(filename, O_RDONLY|_O_BINARY);
+  // the server is already waiting for the data, so from here on any local
+  // failure leaves the connection unusable
+  char* buffer = conn_buffer(conn);
+  int fileFd = buffer ? util_dirOpenFile(dirFd, filename, O_RDONLY|_O_BINARY) : -1;
 
-  if (!squirt_fileFd) {
-    fatalError("failed to open %s", filename);
+  if (fileFd < 0) {
+    return conn_fail(conn, ERROR_FILE_READ_FAILED, "failed to open %s", filename);
   }
 
-  squirt_readBuffer = malloc(BLOCK_SIZE);
-
   if (progress == util_printProgress) {
     printf("squirting %s (%s bytes)\n", filename, util_formatNumber(fileLength));
-    gettimeofday(&start, NULL);
   }
+  gettimeofday(&conn->start, NULL);
 
-  do {
+  while (!conn->error && total < fileLength) {
     int len;
-    if ((len = read(squirt_fileFd, squirt_readBuffer, BLOCK_SIZE) ) < 0) {
-      fatalError("failed to read %s", filename);
-    } else {
-      if ((send(main_socketFd, squirt_readBuffer, len, 0)) != len) {
-	fatalError("send() failed");
-      }
-      //      int old = total;
+    if ((len = read(fileFd, buffer, BLOCK_SIZE)) <= 0) {
+      conn_fail(conn, ERROR_FILE_READ_FAILED, "failed to read %s", filename);
+    } else if (conn_send(conn, buffer, len, "file data") == 0) {
       total += len;
-      //      if (((((old*100)/fileLength))/100) - (((total*100)/fileLength)/100) > 2) {
-      if (progress) {
-	progress(progressHeader ? progressHeader : filename, &start, total, fileLength);
+      // drawing every block slows fast links down, the final state is drawn below
+      if (progress && total < fileLength && util_progressDue(&lastProgress)) {
+	progress(progressHeader ? progressHeader : filename, &conn->start, total, fileLength);
       }
-	//      }
     }
+  }
 
-  } while (total < fileLength);
+  close(fileFd);
 
-  if (progress == util_printProgress) {
-    util_printProgress(progressHeader ? progressHeader :filename, &start, total, fileLength);
+  if (progress) {
+    progress(progressHeader ? progressHeader : filename, &conn->start, total, fileLength);
+    fflush(stdout);
+  }
+
+  uint32_t error;
+
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return conn->error;
+  }
+
+  if (error == 0 && progress == util_printProgress) {
+    gettimeofday(&end, NULL);
+    long seconds = end.tv_sec - conn->start.tv_sec;
+    long micros = ((seconds * 1000000) + end.tv_usec) - conn->start.tv_usec;
+    printf("\nsquirted %s (%s bytes) in %0.02f seconds ", filename, util_formatNumber(fileLength), ((double)micros)/1000000.0f);
+    util_printFormatSpeed(fileLength, ((double)micros)/1000000.0f);
+    printf("\n");
+  }
+
+  return error;
+}
+
+
+int
+squirt_file(int dirFd, const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength))
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  int error = squirt_connFile(&conn, dirFd, filename, progressHeader, destFilename, writeToCurrentDir, progress);
+
+  if (error == -1) {
+    fprintf(stderr, "Error: Cannot access file '%s' - %s\n", filename, strerror(errno));
+  }
+
+  conn_detach(&conn);
+
+  if (error > 0) {
+    fprintf(stderr, "\n**FAILED** to squirt %s\n%s\n", filename, util_getErrorString(error));
   }
 
+  return error;
+}
+
+
+#define SQUIRT_PROTECT_WRITE_DELETE 0x5 // the w and d bits, which deny writing and deleting when set
+#define SQUIRT_PROTECT_RWED         0xF // only these follow the local file, the others are the Amiga's own
+#define SQUIRT_PROTECT_ARCHIVE      0x10
+
+typedef struct {
+  char* localPath;
+  char* remotePath;       // 0 to send it to squirtd's upload folder under its own name
+  const char* name;       // the last part of remotePath, looked for in its drawer's listing
+  int drawer;             // the drawer it goes in, -1 if it isn't checked
+  int child;              // the drawer it is, for drawers
+  uint32_t size;
+  uint32_t prot;
+  dir_datestamp_t ds;
+} squirt_item_t;
+
+typedef struct {
+  const char* path;
+  int first;              // its subtree is items first to end-1
+  int end;
+} squirt_drawer_t;
+
+typedef struct {
+  squirt_item_t* items;
+  int count;
+  int size;
+  squirt_drawer_t* drawers;
+  int drawerCount;
+  int drawerSize;
+  int files;
+  uint64_t bytes;
+  int force;
+} squirt_plan_t;
+
+typedef struct squirt_session squirt_session_t;
+
+typedef struct {
+  squirt_session_t* session;
+  int index;
   uint32_t error;
+} squirt_task_t;
+
+// What sending the plan to one host has done so far
+struct squirt_session {
+  squirt_plan_t* plan;
+  async_conn_t* conn;
+  fleet_host_t* host;     // 0 unless squirting to a fleet
+  dir_entry_list_t** listings;
+  int listed;
+  squirt_task_t* tasks;
+  squirt_task_t* drawerTasks;
+  int sent;
+  int skipped;
+  int created;
+  int failed;
+  uint64_t bytes;
+};
+
+static int squirt_progressDrawn = 0;
+
+
+static void
+squirt_printProgress(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength)
+{
+  if (total == 0) {
+    printf("squirting %s (%s bytes)\n", filename, util_formatNumber(fileLength));
+  }
+  util_printProgress(filename, start, total, fileLength);
+  squirt_progressDrawn = 1;
+}
+
+
+static int
+squirt_leapYears(int year)
+{
+  year--;
+  return year/4 - year/100 + year/400;
+}
+
+
+// the amiga keeps local time as days, minutes and ticks since 1978
+static void
+squirt_dateStamp(time_t time, dir_datestamp_t* ds)
+{
+  struct tm* tm = localtime(&time);
+  ds->days = ds->mins = ds->ticks = 0;
+
+  if (tm && tm->tm_year + 1900 >= 1978) {
+    int year = tm->tm_year + 1900;
+    ds->days = (year-1978)*365 + squirt_leapYears(year) - squirt_leapYears(1978) + tm->tm_yday;
+    ds->mins = tm->tm_hour*60 + tm->tm_min;
+    ds->ticks = tm->tm_sec*50;
+  }
+}
+
+
+static char*
+squirt_joinPath(const char* dir, const char* name, int amiga)
+{
+  size_t length = strlen(dir);
+  char* path = malloc(length + strlen(name) + 2);
+  if (!path) {
+    fatalError("malloc failed");
+  }
+
+  // "" is the remote current directory
+  if (amiga && (length == 0 || dir[length-1] == ':' || dir[length-1] == '/')) {
+    sprintf(path, "%s%s", dir, name);
+  } else {
+    sprintf(path, "%s/%s", dir, name);
+  }
+  return path;
+}
+
+
+static int
+squirt_addDrawer(squirt_plan_t* plan, const char* path)
+{
+  if (plan->drawerCount == plan->drawerSize) {
+    plan->drawerSize = plan->drawerSize ? plan->drawerSize * 2 : 8;
+    plan->drawers = realloc(plan->drawers, sizeof(squirt_drawer_t) * plan->drawerSize);
+    if (!plan->drawers) {
+      fatalError("malloc failed");
+    }
+  }
+
+  squirt_drawer_t* drawer = &plan->drawers[plan->drawerCount];
+  drawer->path = path;
+  drawer->first = drawer->end = plan->count;
+  return plan->drawerCount++;
+}
+
+
+static int
+squirt_addItem(squirt_plan_t* plan, const char* localPath, const char* remoteDir, const char* name, int drawer, struct stat* st)
+{
+  if (plan->count == plan->size) {
+    plan->size = plan->size ? plan->size * 2 : 64;
+    plan->items = realloc(plan->items, sizeof(squirt_item_t) * plan->size);
+    if (!plan->items) {
+      fatalError("malloc failed");
+    }
+  }
+
+  squirt_item_t* item = &plan->items[plan->count];
+  memset(item, 0, sizeof(*item));
+  item->localPath = strdup(localPath);
+  if (!item->localPath) {
+    fatalError("malloc failed");
+  }
+  if (remoteDir) {
+    item->remotePath = squirt_joinPath(remoteDir, name, 1);
+    item->name = item->remotePath + strlen(item->remotePath) - strlen(name);
+  }
+  item->drawer = drawer;
+  item->child = -1;
+  item->prot = (st->st_mode & S_IWUSR) ? 0 : SQUIRT_PROTECT_WRITE_DELETE;
+  squirt_dateStamp(st->st_mtime, &item->ds);
+
+  if (!S_ISDIR(st->st_mode)) {
+    item->size = st->st_size;
+    plan->files++;
+    plan->bytes += st->st_size;
+  }
+
+  return plan->count++;
+}
+
+
+static void
+squirt_addPath(squirt_plan_t* plan, const char* localPath, const char* name, const char* remoteDir, int drawer);
+
+typedef struct {
+  squirt_plan_t* plan;
+  const char* localDir;
+  const char* remoteDir;
+  int drawer;
+} squirt_walk_t;
+
+
+static void
+squirt_walkEntry(const char* filename, void* data)
+{
+  squirt_walk_t* walk = data;
+
+  if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+    return;
+  }
+
+  char* localPath = squirt_joinPath(walk->localDir, filename, 0);
+  squirt_addPath(walk->plan, localPath, filename, walk->remoteDir, walk->drawer);
+  free(localPath);
+}
+
+
+static void
+squirt_walkDir(squirt_plan_t* plan, const char* localDir, const char* remoteDir, int drawer)
+{
+  squirt_walk_t walk = {plan, localDir, remoteDir, drawer};
+
+  if (util_dirOperation(localDir, squirt_walkEntry, &walk) < 0) {
+    fatalError("failed to read directory %s", localDir);
+  }
+  plan->drawers[drawer].end = plan->count;
+}
+
+
+static void
+squirt_addPath(squirt_plan_t* plan, const char* localPath, const char* name, const char* remoteDir, int drawer)
+{
+  struct stat st;
+
+  if (stat(localPath, &st) == -1) {
+    fatalError("failed to access %s: %s", localPath, strerror(errno));
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    int index = squirt_addItem(plan, localPath, remoteDir, name, drawer, &st);
+    // the path belongs to the item, the items array may move but the string doesn't
+    const char* remotePath = plan->items[index].remotePath;
+    int child = squirt_addDrawer(plan, remotePath);
+    plan->items[index].child = child;
+    squirt_walkDir(plan, localPath, remotePath, child);
+  } else if (S_ISREG(st.st_mode)) {
+    squirt_addItem(plan, localPath, remoteDir, name, drawer, &st);
+  }
+}
+
 
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    fatalError("squirt: failed to read remote status");
+// Files without a destination go to squirtd's upload folder as they always
+// have, everything else is checked against the listing of its drawer
+static int
+squirt_addArgument(squirt_plan_t* plan, const char* filename, const char* base, int recursive)
+{
+  struct stat st;
+
+  if (stat(filename, &st) == -1) {
+    fprintf(stderr, "Error: Cannot access file '%s' - %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  if (S_ISDIR(st.st_mode) && !recursive) {
+    fprintf(stderr, "Error: '%s' is a directory, use -r to squirt it\n", filename);
+    return -1;
+  }
+
+  char* copy = strdup(filename);
+  if (!copy) {
+    fatalError("malloc failed");
+  }
+  const char* name = basename(copy);
+
+  if (S_ISDIR(st.st_mode) && (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, "/") == 0)) {
+    // there's no name to give it, so its contents go straight into the destination
+    squirt_walkDir(plan, filename, base, 0);
+  } else {
+    squirt_addPath(plan, filename, name, base, base ? 0 : -1);
+  }
+
+  free(copy);
+  return 0;
+}
+
+
+static void
+squirt_freePlan(squirt_plan_t* plan)
+{
+  for (int i = 0; i < plan->count; i++) {
+    free(plan->items[i].localPath);
+    free(plan->items[i].remotePath);
   }
+  free(plan->items);
+  free(plan->drawers);
+}
+
+
+static squirt_session_t*
+squirt_newSession(squirt_plan_t* plan, async_conn_t* conn, fleet_host_t* host)
+{
+  squirt_session_t* session = calloc(1, sizeof(squirt_session_t));
+  if (!session ||
+      !(session->listings = calloc(plan->drawerCount+1, sizeof(dir_entry_list_t*))) ||
+      !(session->tasks = calloc(plan->count+1, sizeof(squirt_task_t))) ||
+      !(session->drawerTasks = calloc(plan->drawerCount+1, sizeof(squirt_task_t)))) {
+    fatalError("malloc failed");
+  }
+
+  session->plan = plan;
+  session->conn = conn;
+  session->host = host;
+
+  for (int i = 0; i < plan->count; i++) {
+    session->tasks[i].session = session;
+    session->tasks[i].index = i;
+  }
+  for (int i = 0; i < plan->drawerCount; i++) {
+    session->drawerTasks[i].session = session;
+    session->drawerTasks[i].index = i;
+  }
+
+  return session;
+}
+
+
+static void
+squirt_freeSession(squirt_session_t* session)
+{
+  for (int i = 0; i < session->plan->drawerCount; i++) {
+    if (session->listings[i]) {
+      dir_freeEntryList(session->listings[i]);
+    }
+  }
+  free(session->listings);
+  free(session->tasks);
+  free(session->drawerTasks);
+  free(session);
+}
 
-  if (error == 0) {
-    if (progress == util_printProgress) {
-      gettimeofday(&end, NULL);
-      long seconds = end.tv_sec - start.tv_sec;
-      long micros = ((seconds * 1000000) + end.tv_usec) - start.tv_usec;
-      printf("\nsquirted %s (%s bytes) in %0.02f seconds ", filename, util_formatNumber(fileLength), ((double)micros)/1000000.0f);
-      util_printFormatSpeed(fileLength, ((double)micros)/1000000.0f);
+
+static void
+squirt_endProgress(void)
+{
+  if (squirt_progressDrawn) {
+    printf("\n");
+    squirt_progressDrawn = 0;
+  }
+}
+
+
+// Returns 1 if there was an error to report. When the connection itself has
+// failed every remaining operation ends with its error, which is reported once
+// the session is over.
+static int
+squirt_failed(squirt_session_t* session, uint32_t error, const char* what, const char* name)
+{
+  if (session->host) {
+    fleet_done(session->conn, error, session->host);
+  }
+
+  if (!error || async_session(session->conn)->error) {
+    return error != 0;
+  }
+
+  session->failed++;
+  if (session->host) {
+    printf("%s**FAILED** to %s %s: %s\n", session->host->prefix, what, name, util_getErrorString(error));
+  } else {
+    squirt_endProgress();
+    fprintf(stderr, "**FAILED** to %s %s\n%s\n", what, name, util_getErrorString(error));
+  }
+  return 1;
+}
+
+
+// nothing can be sent into a drawer that couldn't be created
+static void
+squirt_failDrawer(squirt_session_t* session, int drawer)
+{
+  squirt_drawer_t* d = &session->plan->drawers[drawer];
+
+  for (int i = d->first; i < d->end; i++) {
+    session->failed += session->plan->items[i].child < 0;
+  }
+}
+
+
+static void
+squirt_sent(async_conn_t* conn, uint32_t error, void* data)
+{
+  squirt_task_t* task = data;
+  squirt_session_t* session = task->session;
+  squirt_item_t* item = &session->plan->items[task->index];
+  (void)conn;
+
+  squirt_endProgress();
+  if (squirt_failed(session, error, "squirt", item->localPath)) {
+    task->error = error;
+    return;
+  }
+
+  session->sent++;
+  session->bytes += item->size;
+  if (session->host) {
+    session->host->bytes += item->size;
+  }
+}
+
+
+static void
+squirt_infoSet(async_conn_t* conn, uint32_t error, void* data)
+{
+  squirt_task_t* task = data;
+  squirt_item_t* item = &task->session->plan->items[task->index];
+  (void)conn;
+
+  // a file that wasn't sent has already been reported
+  squirt_failed(task->session, task->error ? 0 : error, "set the protection and date of", item->remotePath);
+}
+
+
+static void
+squirt_queueDrawer(squirt_session_t* session, int drawer);
+
+
+static void
+squirt_openDrawer(squirt_session_t* session, int drawer);
+
+
+static dir_entry_t*
+squirt_findEntry(dir_entry_list_t* list, const char* name)
+{
+  for (dir_entry_t* entry = list ? list->head : 0; entry; entry = entry->next) {
+    if (strcasecmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+
+static void
+squirt_queueItem(squirt_session_t* session, int index)
+{
+  squirt_plan_t* plan = session->plan;
+  squirt_item_t* item = &plan->items[index];
+  squirt_task_t* task = &session->tasks[index];
+
+  if (item->drawer < 0) {
+    async_squirt(session->conn, item->localPath, 0, 0, squirt_sent, task);
+    return;
+  }
+
+  dir_entry_t* entry = squirt_findEntry(session->listings[item->drawer], item->name);
+
+  if (item->child >= 0) {
+    if (entry && entry->type < 0) {
+      // squirtd would fail on every file sent into it
+      squirt_failed(session, ERROR_CREATE_DIR_FAILED, "create drawer", item->remotePath);
+      squirt_failDrawer(session, item->child);
+    } else {
+      squirt_openDrawer(session, item->child);
+    }
+    return;
+  }
+
+  if (entry && entry->type >= 0) {
+    entry = 0;
+  }
+
+  // the hold, script and pure bits of a file being replaced are kept, its
+  // archive bit is cleared as it has been written to
+  uint32_t other = entry ? entry->prot & ~SQUIRT_PROTECT_RWED : 0;
+  int same = entry && entry->size == item->size &&
+    entry->ds.days == item->ds.days && entry->ds.mins == item->ds.mins && entry->ds.ticks == item->ds.ticks;
+
+  if (!same || plan->force) {
+    async_squirt(session->conn, item->localPath, item->remotePath, 1, squirt_sent, task);
+    async_setInfo(session->conn, item->remotePath, (other & ~SQUIRT_PROTECT_ARCHIVE) | item->prot, &item->ds, squirt_infoSet, task);
+  } else if ((entry->prot & SQUIRT_PROTECT_RWED) != item->prot) {
+    async_setInfo(session->conn, item->remotePath, other | item->prot, &item->ds, squirt_infoSet, task);
+    session->skipped++;
+  } else {
+    session->skipped++;
+  }
+}
+
+
+static void
+squirt_queueDrawer(squirt_session_t* session, int drawer)
+{
+  squirt_drawer_t* d = &session->plan->drawers[drawer];
+
+  for (int i = d->first; i < d->end; i++) {
+    if (session->plan->items[i].drawer == drawer) {
+      squirt_queueItem(session, i);
+    }
+  }
+}
+
+
+static void
+squirt_drawerMade(async_conn_t* conn, uint32_t error, void* data)
+{
+  squirt_task_t* task = data;
+  squirt_session_t* session = task->session;
+  squirt_drawer_t* drawer = &session->plan->drawers[task->index];
+  (void)conn;
+
+  if (squirt_failed(session, error, "create drawer", drawer->path)) {
+    squirt_failDrawer(session, task->index);
+    return;
+  }
+
+  session->created++;
+  squirt_queueDrawer(session, task->index);
+}
+
+
+// Drawers that couldn't be listed are created before anything is sent into
+// them, as squirtd drops the connection when it can't create a file
+static void
+squirt_openDrawer(squirt_session_t* session, int drawer)
+{
+  if (session->listings[drawer]) {
+    squirt_queueDrawer(session, drawer);
+  } else {
+    async_fileOp(session->conn, SQUIRT_COMMAND_MAKEDIR, session->plan->drawers[drawer].path, 0, squirt_drawerMade, &session->drawerTasks[drawer]);
+  }
+}
+
+
+static void
+squirt_listed(async_conn_t* conn, uint32_t error, void* data)
+{
+  squirt_session_t* session = data;
+  (void)error; // a drawer that can't be listed doesn't exist yet
+
+  if (session->host) {
+    fleet_done(conn, async_session(conn)->error, session->host);
+  }
+
+  if (++session->listed == session->plan->drawerCount && !async_session(conn)->error) {
+    squirt_openDrawer(session, 0);
+  }
+}
+
+
+// Every drawer's listing is queued up front, then each is filled in once it
+// is known to exist. The connection still answers them one after another.
+static void
+squirt_start(squirt_session_t* session)
+{
+  squirt_plan_t* plan = session->plan;
+
+  if (plan->drawerCount == 0) {
+    for (int i = 0; i < plan->count; i++) {
+      squirt_queueItem(session, i);
+    }
+    return;
+  }
+
+  for (int i = 0; i < plan->drawerCount; i++) {
+    async_dir(session->conn, plan->drawers[i].path, &session->listings[i], squirt_listed, session);
+  }
+}
+
+
+static double
+squirt_secondsSince(struct timeval* start)
+{
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  long seconds = end.tv_sec - start->tv_sec;
+  long micros = ((seconds * 1000000) + end.tv_usec) - start->tv_usec;
+  return ((double)micros)/1000000.0f;
+}
+
+
+static const char*
+squirt_describePlan(squirt_plan_t* plan, const char* filename)
+{
+  static char description[PATH_MAX+64];
+
+  if (plan->count == 1 && plan->items[0].child < 0) {
+    snprintf(description, sizeof(description), "%s", filename);
+  } else {
+    snprintf(description, sizeof(description), "%d file%s", plan->files, plan->files == 1 ? "" : "s");
+  }
+  return description;
+}
+
+
+// every host gets the files at once, so the whole fleet takes as long as its slowest host
+static void
+squirt_fleet(const char* hostname, squirt_plan_t* plan, const char* filename)
+{
+  fleet_t* fleet = fleet_open(hostname);
+  squirt_session_t** sessions = calloc(fleet->count, sizeof(squirt_session_t*));
+  if (!sessions) {
+    fatalError("malloc failed");
+  }
+
+  printf("squirting %s (%s bytes) to %d hosts\n", squirt_describePlan(plan, filename), util_formatNumber((int)plan->bytes), fleet->count);
+  fflush(stdout);
+
+  for (int i = 0; i < fleet->count; i++) {
+    sessions[i] = squirt_newSession(plan, fleet->hosts[i].conn, &fleet->hosts[i]);
+    squirt_start(sessions[i]);
+  }
+
+  char what[PATH_MAX+64];
+  snprintf(what, sizeof(what), "squirted %s", squirt_describePlan(plan, filename));
+  int failed = fleet_run(fleet, what);
+
+  for (int i = 0; i < fleet->count; i++) {
+    squirt_freeSession(sessions[i]);
+  }
+  free(sessions);
+  fleet_close(fleet);
+
+  if (failed) {
+    fatalError("failed to squirt %s to %d host%s", squirt_describePlan(plan, filename), failed, failed == 1 ? "" : "s");
+  }
+}
+
+
+static void
+squirt_host(const char* hostname, squirt_plan_t* plan, const char* filename)
+{
+  async_engine_t* engine = async_newEngine();
+  async_conn_t* conn = async_connect(engine, hostname);
+  squirt_session_t* session = squirt_newSession(plan, conn, 0);
+  struct timeval start;
+
+  gettimeofday(&start, NULL);
+  async_setProgress(conn, squirt_printProgress);
+  squirt_start(session);
+
+  if (async_run(engine) != 0) {
+    squirt_endProgress();
+    fflush(stdout);
+    fatalError("%s", conn_errorString(async_session(conn)));
+  }
+
+  if (plan->count == 1 && plan->items[0].child < 0) {
+    if (session->sent) {
+      double seconds = squirt_secondsSince(&async_session(conn)->start);
+      printf("squirted %s (%s bytes) in %0.02f seconds ", filename, util_formatNumber((int)plan->bytes), seconds);
+      util_printFormatSpeed((int32_t)plan->bytes, seconds);
       printf("\n");
+    } else if (session->skipped) {
+      printf("%s is up to date\n", filename);
     }
   } else {
-    fprintf(stderr, "\n**FAILED** to squirt %s\n%s\n", filename, util_getErrorString(error));
+    double seconds = squirt_secondsSince(&start);
+    printf("\nsquirted %d of %d file%s (%s bytes) in %0.02f seconds", session->sent, plan->files, plan->files == 1 ? "" : "s", util_formatNumber((int)session->bytes), seconds);
+    if (session->bytes) {
+      printf(" ");
+      util_printFormatSpeed((int32_t)session->bytes, seconds);
+    }
+    printf(", %d up to date, %d drawer%s created\n", session->skipped, session->created, session->created == 1 ? "" : "s");
   }
 
-  squirt_cleanup();
+  int failed = session->failed;
+  squirt_freeSession(session);
+  async_freeEngine(engine);
 
-  return error;
+  // a single file fails the way it always has
+  if (failed && (plan->count > 1 || plan->items[0].child >= 0)) {
+    fflush(stdout);
+    fatalError("failed to squirt %d item%s", failed, failed == 1 ? "" : "s");
+  }
 }
 
 
 _Noreturn static void
 squirt_usage(void)
 {
-  fatalError("invalid arguments\nusage: %s [--dest=destination folder] hostname filename", main_argv0);
+  fatalError("invalid arguments\nusage: %s [--dest=destination folder] [-r|--recursive] [-f|--force] hostname|host,host...|@fleet file|dir...", main_argv0);
 }
 
 void
 squirt_main(int argc, char* argv[])
 {
-  int argvIndex = 1;
-  char *dest = 0, *hostname = 0, * filename = 0;
+  int argvIndex = 1, recursive = 0, fileCount = 0;
+  char *dest = 0, *hostname = 0;
+  squirt_plan_t plan = {0};
+  char** filenames = calloc(argc, sizeof(char*));
+
+  if (!filenames) {
+    fatalError("malloc failed");
+  }
 
   while (argvIndex < argc) {
     static struct option long_options[] =
       {
        {"dest", required_argument, 0, 'd'},
+       {"recursive", no_argument, 0, 'r'},
+       {"force", no_argument, 0, 'f'},
        {0, 0, 0, 0}
       };
     int option_index = 0;
-    int c = getopt_long (argc, argv, "", long_options, &option_index);
+    int c = getopt_long (argc, argv, "rf", long_options, &option_index);
     if (c != -1) {
       argvIndex = optind;
       switch (c) {
@@ -158,6 +817,12 @@ squirt_main(int argc, char* argv[])
       case 'd':
 	dest = optarg;
 	break;
+      case 'r':
+	recursive = 1;
+	break;
+      case 'f':
+	plan.force = 1;
+	break;
       case '?':
       default:
 	squirt_usage();
@@ -167,24 +832,44 @@ squirt_main(int argc, char* argv[])
       if (hostname == 0) {
 	hostname = argv[argvIndex];
       } else {
-	filename = argv[argvIndex];
+	filenames[fileCount++] = argv[argvIndex];
       }
       optind++;
       argvIndex++;
     }
   }
 
-  if (hostname == 0 || filename == 0) {
+  if (hostname == 0 || fileCount == 0) {
     squirt_usage();
   }
 
-  util_connect(hostname);
-  char buffer[PATH_MAX];
-  if (dest) {
-    sprintf(buffer, "cd %s", dest);
-    util_exec(buffer);
-    squirt_file(filename, 0, 0, 1, util_printProgress);
+  // full paths go straight to the destination, so there's no need to cd
+  // first, and a tree without one is mirrored into the remote current directory
+  const char* base = dest ? dest : recursive ? "" : 0;
+  if (base) {
+    squirt_addDrawer(&plan, base);
+  }
+
+  for (int i = 0; i < fileCount; i++) {
+    if (squirt_addArgument(&plan, filenames[i], base, recursive) != 0) {
+      squirt_freePlan(&plan);
+      free(filenames);
+      return;
+    }
+  }
+
+  if (base) {
+    plan.drawers[0].end = plan.count;
+  }
+
+  if (plan.count == 0) {
+    printf("nothing to squirt\n");
+  } else if (fleet_isFleet(hostname)) {
+    squirt_fleet(hostname, &plan, filenames[0]);
   } else {
-    squirt_file(filename, 0, 0, 0, util_printProgress);
+    squirt_host(hostname, &plan, filenames[0]);
   }
+
+  squirt_freePlan(&plan);
+  free(filenames);
 }
@@ -1,11 +1,20 @@
 #pragma once
 #include <stdint.h>
+#include "conn.h"
 
 void
 squirt_cleanup(void);
 
+// Sends the local file "filename" in the directory "dirFd" (UTIL_DIR_CWD for
+// the current directory) to squirtd as "destFilename", or under its own name
+// if that is 0. Returns -1 (with errno set) if the file can't be read,
+// otherwise the remote status, or the connection's error if it failed.
 int
-squirt_file(const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength));
+squirt_connFile(squirt_conn_t* conn, int dirFd, const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength));
+
+// squirt_connFile on the thread's connection, exits if the connection fails
+int
+squirt_file(int dirFd, const char* filename, const char* progressHeader, const char* destFilename, int writeToCurrentDir, void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength));
 
 void
 squirt_main(int argc, char* argv[]);
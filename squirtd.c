@@ -33,6 +33,7 @@ static uint32_t squirtd_execError = 0;
 static int squirtd_listenFd = 0;
 static int squirtd_connectionFd = 0;
 static char* squirtd_filename = 0;
+static char* squirtd_destname = 0;
 static char* squirtd_rxBuffer = 0;
 static BPTR  squirtd_outputFd = 0;
 static BPTR squirtd_inputFd = 0;
@@ -67,6 +68,11 @@ cleanupForNextRun(void)
     free(squirtd_filename);
     squirtd_filename = 0;
   }
+
+  if (squirtd_destname) {
+    free(squirtd_destname);
+    squirtd_destname = 0;
+  }
 }
 
 
@@ -124,6 +130,23 @@ sendU32(int fd, uint32_t status)
 }
 
 
+static uint32_t
+recvAll(int fd, void* buffer, uint32_t length)
+{
+  uint8_t* ptr = buffer;
+  while (length) {
+    int len = recv(fd, (void*)ptr, length, 0);
+    if (len <= 0) {
+      return ERROR_FATAL_RECV_FAILED;
+    }
+    ptr += len;
+    length -= len;
+  }
+
+  return 0;
+}
+
+
 static void
 exec_runner(void)
 {
@@ -197,24 +220,72 @@ exec_run(int fd, const char* command)
 
 
 static uint32_t
-exec_dir(int fd, const char* dir)
+exec_sendDirEntry(int fd, struct ExAllData* ead, uint32_t nameLength, uint32_t commentLength)
 {
-  struct ExAllControl*  eac = 0;
-  void* data = 0;
-  uint32_t error = 0;
+  if (send(fd, (void*)&nameLength, sizeof(nameLength), 0) != sizeof(nameLength) ||
+      send(fd, ead->ed_Name, nameLength, 0) != (int)nameLength ||
+      send(fd, (void*)&ead->ed_Type, sizeof(ead->ed_Type), 0) != sizeof(ead->ed_Type) ||
+      send(fd, (void*)&ead->ed_Size, sizeof(ead->ed_Size), 0) != sizeof(ead->ed_Size) ||
+      send(fd, (void*)&ead->ed_Prot, sizeof(ead->ed_Prot), 0) != sizeof(ead->ed_Prot) ||
+      send(fd, (void*)&ead->ed_Days, sizeof(ead->ed_Days), 0) != sizeof(ead->ed_Days) ||
+      send(fd, (void*)&ead->ed_Mins, sizeof(ead->ed_Mins), 0) != sizeof(ead->ed_Mins) ||
+      send(fd, (void*)&ead->ed_Ticks, sizeof(ead->ed_Ticks), 0) != sizeof(ead->ed_Ticks) ||
+      send(fd, (void*)&commentLength, sizeof(commentLength), 0) != sizeof(commentLength) ||
+      send(fd, ead->ed_Comment, commentLength, 0) != (int)commentLength) {
+    return ERROR_FATAL_SEND_FAILED;
+  }
 
-  BPTR lock = Lock((APTR)dir, ACCESS_READ);
+  return 0;
+}
 
-  if (!lock) {
-    error = ERROR_FILE_READ_FAILED;
-    goto cleanup;
+
+static int
+exec_isNewer(struct ExAllData* ead, struct DateStamp* since)
+{
+  if (ead->ed_Days != (ULONG)since->ds_Days) {
+    return ead->ed_Days > (ULONG)since->ds_Days;
+  }
+  if (ead->ed_Mins != (ULONG)since->ds_Minute) {
+    return ead->ed_Mins > (ULONG)since->ds_Minute;
+  }
+  return ead->ed_Ticks > (ULONG)since->ds_Tick;
+}
+
+
+static int
+exec_findDigest(uint32_t* digests, uint32_t count, uint32_t digest)
+{
+  int low = 0, high = (int)count - 1;
+
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (digests[mid] == digest) {
+      return mid;
+    } else if (digests[mid] < digest) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
   }
 
+  return -1;
+}
+
+
+static uint32_t
+exec_listDir(int fd, BPTR lock, struct DateStamp* since, uint32_t* digests, uint32_t count, uint8_t* matched)
+{
+  struct ExAllControl*  eac = 0;
+  void* data = 0;
+  uint32_t error = 0;
+  int filtered = since || matched;
+  int hasThreshold = since && (since->ds_Days || since->ds_Minute || since->ds_Tick);
+
   data = malloc(BLOCK_SIZE);
 
   eac = AllocDosObject(DOS_EXALLCONTROL, NULL);
 
-  if (!eac) {
+  if (!eac || !data) {
     error = ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE;
     goto cleanup;
   }
@@ -235,23 +306,104 @@ exec_dir(int fd, const char* dir)
     do {
       uint32_t nameLength = strlen((char*)ead->ed_Name);
       uint32_t commentLength = strlen((char*)ead->ed_Comment);
-      if (send(fd, (void*)&nameLength, sizeof(nameLength), 0) != sizeof(nameLength) ||
-	  send(fd, ead->ed_Name, nameLength, 0) != (int)nameLength ||
-	  send(fd, (void*)&ead->ed_Type, sizeof(ead->ed_Type), 0) != sizeof(ead->ed_Type) ||
-	  send(fd, (void*)&ead->ed_Size, sizeof(ead->ed_Size), 0) != sizeof(ead->ed_Size) ||
-	  send(fd, (void*)&ead->ed_Prot, sizeof(ead->ed_Prot), 0) != sizeof(ead->ed_Prot) ||
-	  send(fd, (void*)&ead->ed_Days, sizeof(ead->ed_Days), 0) != sizeof(ead->ed_Days) ||
-	  send(fd, (void*)&ead->ed_Mins, sizeof(ead->ed_Mins), 0) != sizeof(ead->ed_Mins) ||
-	  send(fd, (void*)&ead->ed_Ticks, sizeof(ead->ed_Ticks), 0) != sizeof(ead->ed_Ticks) ||
-	  send(fd, (void*)&commentLength, sizeof(commentLength), 0) != sizeof(commentLength) ||
-	  send(fd, ead->ed_Comment, commentLength, 0) != (int)commentLength) {
-	error = ERROR_FATAL_SEND_FAILED;
+      int unchanged = 0, index = -1;
+
+      if (filtered) {
+	int newer = hasThreshold && exec_isNewer(ead, since);
+	if (count) {
+	  uint32_t digest = squirt_digestEntry((char*)ead->ed_Name, nameLength, ead->ed_Type, ead->ed_Size, ead->ed_Prot, ead->ed_Days, ead->ed_Mins, ead->ed_Ticks, (char*)ead->ed_Comment, commentLength);
+	  index = exec_findDigest(digests, count, digest);
+	  unchanged = index >= 0 && !newer;
+	} else {
+	  unchanged = hasThreshold && !newer;
+	}
+      }
+
+      if (!unchanged) {
+	error = exec_sendDirEntry(fd, ead, nameLength, commentLength);
+      } else if (index >= 0) {
+	matched[index/8] |= 1 << (index%8);
+      } else {
+	uint32_t compactLength = nameLength | SQUIRT_DIR_COMPACT_ENTRY;
+	if (send(fd, (void*)&compactLength, sizeof(compactLength), 0) != sizeof(compactLength) ||
+	    send(fd, ead->ed_Name, nameLength, 0) != (int)nameLength) {
+	  error = ERROR_FATAL_SEND_FAILED;
+	}
+      }
+
+      if (error) {
 	goto cleanup;
       }
       ead = ead->ed_Next;
     } while (ead);
   } while (more);
 
+ cleanup:
+
+  if (eac) {
+    FreeDosObject(DOS_EXALLCONTROL,eac);
+  }
+
+  if (data) {
+    free(data);
+  }
+
+  return error;
+}
+
+
+static uint32_t
+exec_dir(int fd, const char* dir, int changedSince)
+{
+  uint32_t error = 0;
+  uint32_t* digests = 0;
+  uint8_t* matched = 0;
+  uint32_t matchedLength = 0;
+  BPTR lock = 0;
+
+  struct {
+    struct DateStamp since;
+    uint32_t count;
+  } filter = {{0, 0, 0}, 0};
+
+  if (changedSince) {
+    // the client only sends the filter to a server that has said it will read it
+    if (sendU32(fd, SQUIRT_FILEOP_REPLY) != 0) {
+      return ERROR_FATAL_SEND_FAILED;
+    }
+
+    if (recvAll(fd, &filter, sizeof(filter)) != 0) {
+      return ERROR_FATAL_RECV_FAILED;
+    }
+
+    if (filter.count > SQUIRT_DIR_MAX_DIGESTS) {
+      return ERROR_FATAL_RECV_FAILED;
+    }
+
+    if (filter.count) {
+      matchedLength = (filter.count + 7) / 8;
+      digests = malloc(filter.count * sizeof(uint32_t));
+      matched = malloc(matchedLength);
+      if (!digests || !matched) {
+	error = ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE;
+	goto cleanup;
+      }
+      memset(matched, 0, matchedLength);
+      if (recvAll(fd, digests, filter.count * sizeof(uint32_t)) != 0) {
+	error = ERROR_FATAL_RECV_FAILED;
+	goto cleanup;
+      }
+    }
+  }
+
+  lock = Lock((APTR)dir, ACCESS_READ);
+
+  if (!lock) {
+    error = ERROR_FILE_READ_FAILED;
+    goto cleanup;
+  }
+
+  error = exec_listDir(fd, lock, changedSince ? &filter.since : 0, digests, filter.count, matched);
 
  cleanup:
 
@@ -259,12 +411,16 @@ exec_dir(int fd, const char* dir)
     error = ERROR_FATAL_SEND_FAILED;
   }
 
-  if (eac) {
-    FreeDosObject(DOS_EXALLCONTROL,eac);
+  if (matched && send(fd, (void*)matched, matchedLength, 0) != (int)matchedLength) {
+    error = ERROR_FATAL_SEND_FAILED;
   }
 
-  if (data) {
-    free(data);
+  if (matched) {
+    free(matched);
+  }
+
+  if (digests) {
+    free(digests);
   }
 
   if (lock) {
@@ -276,13 +432,98 @@ exec_dir(int fd, const char* dir)
 
 
 static uint32_t
-exec_cwd(int fd)
+exec_manifest(int fd)
+{
+  uint32_t length, error = 0;
+
+  if (sendU32(fd, SQUIRT_FILEOP_REPLY) != 0) {
+    return ERROR_FATAL_SEND_FAILED;
+  }
+
+  if (recvAll(fd, &length, sizeof(length)) != 0 ||
+      length > SQUIRT_MANIFEST_MAX_LENGTH || (length & 3)) {
+    return ERROR_FATAL_RECV_FAILED;
+  }
+
+  // the whole manifest is read before replying, so neither end blocks on a full socket
+  uint8_t* manifest = malloc(length ? length : 4);
+  if (!manifest) {
+    return ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE;
+  }
+
+  if (recvAll(fd, manifest, length) != 0) {
+    free(manifest);
+    return ERROR_FATAL_RECV_FAILED;
+  }
+
+  uint32_t offset = 0;
+  while (!error && offset < length) {
+    uint32_t pathLength = *(uint32_t*)(manifest+offset);
+    uint32_t pathSize = (pathLength + 4) & ~3;
+    if (pathLength > length || offset + 8 + pathSize > length) {
+      error = ERROR_FATAL_RECV_FAILED;
+      break;
+    }
+
+    char* path = (char*)manifest + offset + 4;
+    uint32_t count = *(uint32_t*)(manifest + offset + 4 + pathSize);
+    uint32_t* digests = (uint32_t*)(manifest + offset + 8 + pathSize);
+    offset += 8 + pathSize;
+    if (path[pathLength] != 0 || count > SQUIRT_DIR_MAX_DIGESTS || count * sizeof(uint32_t) > length - offset) {
+      error = ERROR_FATAL_RECV_FAILED;
+      break;
+    }
+    offset += count * sizeof(uint32_t);
+
+    uint32_t matchedLength = (count + 7) / 8;
+    uint8_t* matched = count ? malloc(matchedLength) : 0;
+    if (count && !matched) {
+      error = ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE;
+      break;
+    }
+    if (matched) {
+      memset(matched, 0, matchedLength);
+    }
+
+    // every directory is answered, so only a fatal error ends the manifest
+    uint32_t dirError = ERROR_FILE_READ_FAILED;
+    BPTR lock = Lock((APTR)path, ACCESS_READ);
+    if (lock) {
+      struct DateStamp since = {0, 0, 0};
+      dirError = exec_listDir(fd, lock, &since, digests, count, matched);
+      UnLock(lock);
+    }
+
+    if (sendU32(fd, 0xFFFFFFFF) != 0 ||
+	(matched && send(fd, (void*)matched, matchedLength, 0) != (int)matchedLength) ||
+	sendU32(fd, dirError) != 0) {
+      dirError = ERROR_FATAL_SEND_FAILED;
+    }
+
+    if (matched) {
+      free(matched);
+    }
+
+    if (SQUIRT_ERROR_IS_FATAL(dirError)) {
+      error = dirError;
+    }
+  }
+
+  free(manifest);
+
+  return error;
+}
+
+
+static uint32_t
+exec_sendCwd(int fd, uint32_t flag)
 {
   char name[108];
   NameFromLock(squirtd_proc->pr_CurrentDir, (STRPTR)name, sizeof(name)-1);
   int32_t len = strlen(name);
+  uint32_t word = len | flag;
 
-  if (send(fd, (void*)&len, sizeof(len), 0) != sizeof(len) ||
+  if (send(fd, (void*)&word, sizeof(word), 0) != sizeof(word) ||
       (send(fd, name, len, 0) != len)) {
     return ERROR_FATAL_SEND_FAILED;
   }
@@ -291,6 +532,66 @@ exec_cwd(int fd)
 }
 
 
+static uint32_t
+exec_cwd(int fd)
+{
+  return exec_sendCwd(fd, 0);
+}
+
+
+static uint32_t
+exec_dosList(int fd)
+{
+  const ULONG flags = LDF_DEVICES|LDF_ASSIGNS|LDF_VOLUMES;
+  uint32_t length = 0;
+  struct DosList* dl;
+
+  // nothing may wait on the network while the dos list is locked, so the
+  // reply is built first, sized by a pass over the list under the same lock
+  struct DosList* head = LockDosList(flags|LDF_READ);
+  for (dl = head; (dl = NextDosEntry(dl, flags));) {
+    // devices without a handler task (CON:, SER: ...) aren't filesystems
+    if (dl->dol_Type != DLT_DEVICE || dl->dol_Task) {
+      length += 8 + ((uint8_t*)BADDR(dl->dol_Name))[0];
+    }
+  }
+
+  uint8_t* buffer = malloc(length + 4);
+  if (!buffer) {
+    UnLockDosList(flags|LDF_READ);
+    return ERROR_FATAL_FAILED_TO_CREATE_OS_RESOURCE;
+  }
+
+  uint32_t offset = 0;
+  for (dl = head; (dl = NextDosEntry(dl, flags));) {
+    if (dl->dol_Type == DLT_DEVICE && !dl->dol_Task) {
+      continue;
+    }
+    uint8_t* name = BADDR(dl->dol_Name);
+    uint32_t type = dl->dol_Type == DLT_DEVICE ? SQUIRT_DOSLIST_DEVICE :
+      dl->dol_Type == DLT_VOLUME ? SQUIRT_DOSLIST_VOLUME : SQUIRT_DOSLIST_ASSIGN;
+    uint32_t nameLength = name[0];
+    memcpy(buffer+offset, &type, 4);
+    memcpy(buffer+offset+4, &nameLength, 4);
+    memcpy(buffer+offset+8, name+1, nameLength);
+    offset += 8 + nameLength;
+  }
+  UnLockDosList(flags|LDF_READ);
+
+  uint32_t end = 0xFFFFFFFF; // not status, terminating word
+  memcpy(buffer+offset, &end, 4);
+
+  uint32_t error = 0;
+  if (send(fd, (void*)buffer, offset + 4, 0) != (int)(offset + 4)) {
+    error = ERROR_FATAL_SEND_FAILED;
+  }
+
+  free(buffer);
+
+  return error;
+}
+
+
 static uint32_t
 exec_cd(const char* dir)
 {
@@ -318,23 +619,177 @@ exec_cd(const char* dir)
 
 
 static uint32_t
-file_setInfo(int fd, const char* filename)
+exec_cdCwd(int fd, const char* dir)
+{
+  uint32_t error = exec_cd(dir);
+
+  if (error) {
+    return sendU32(fd, SQUIRT_CD_CWD_REPLY) != 0 ? ERROR_FATAL_SEND_FAILED : error;
+  }
+
+  return exec_sendCwd(fd, SQUIRT_CD_CWD_REPLY);
+}
+
+
+static uint32_t
+file_setInfo(int fd, const char* filename, int withComment)
 {
   squirtd_file_info_t info;
-  int len;
-  if ((len = recv(fd, &info, sizeof(info), 0)) == sizeof(info)) {
-    if (!SetProtection((STRPTR)filename, info.protection)) {
-      return ERROR_SET_PROTECTION_FAILED;
+  char comment[SQUIRT_MAX_COMMENT_LENGTH+1];
+  uint32_t commentLength;
+
+  if (withComment && sendU32(fd, SQUIRT_FILEOP_REPLY) != 0) {
+    return ERROR_FATAL_SEND_FAILED;
+  }
+
+  if (recvAll(fd, &info, sizeof(info)) != 0) {
+    return ERROR_FATAL_RECV_FAILED;
+  }
+
+  // read the whole request before acting on it so a failure leaves the stream in sync
+  if (withComment) {
+    if (recvAll(fd, &commentLength, sizeof(commentLength)) != 0 ||
+	commentLength > SQUIRT_MAX_COMMENT_LENGTH ||
+	recvAll(fd, comment, commentLength) != 0) {
+      return ERROR_FATAL_RECV_FAILED;
+    }
+    comment[commentLength] = 0;
+  }
+
+  if (!SetProtection((STRPTR)filename, info.protection)) {
+    return ERROR_SET_PROTECTION_FAILED;
+  }
+  if ((uint32_t)info.dateStamp.ds_Days != 0xFFFFFFFF) {
+    if (!SetFileDate((STRPTR)filename, &info.dateStamp)) {
+      return ERROR_SET_DATESTAMP_FAILED;
+    }
+  }
+  if (withComment) {
+    if (!SetComment((STRPTR)filename, (STRPTR)comment)) {
+      return ERROR_SET_COMMENT_FAILED;
+    }
+  }
+  return 0;
+}
+
+
+static uint32_t
+file_makeDir(const char* dir)
+{
+  BPTR lock = CreateDir((STRPTR)dir);
+  if (!lock) {
+    return ERROR_CREATE_DIR_FAILED;
+  }
+  UnLock(lock);
+  return 0;
+}
+
+
+static uint32_t
+file_delete(const char* filename)
+{
+  return DeleteFile((STRPTR)filename) ? 0 : ERROR_DELETE_FAILED;
+}
+
+
+static uint32_t
+file_recvDestName(int fd, const char* filename)
+{
+  uint32_t length;
+  if (recvAll(fd, &length, sizeof(length)) != 0 || length > 1024) {
+    return ERROR_FATAL_RECV_FAILED;
+  }
+
+  // room to append the source name when the destination is a directory
+  uint32_t size = length+1+108;
+  if (!(squirtd_destname = malloc(size)) || recvAll(fd, squirtd_destname, length) != 0) {
+    return ERROR_FATAL_RECV_FAILED;
+  }
+  squirtd_destname[length] = 0;
+
+  BPTR lock = Lock((APTR)squirtd_destname, ACCESS_READ);
+  if (lock) {
+    // a destination that can't be examined is taken as a file
+    struct FileInfoBlock fileInfo;
+    int isDirectory = Examine(lock, &fileInfo) && fileInfo.fib_DirEntryType > 0;
+    UnLock(lock);
+    if (isDirectory) {
+      AddPart((STRPTR)squirtd_destname, FilePart((STRPTR)filename), size);
     }
-    if ((uint32_t)info.dateStamp.ds_Days != 0xFFFFFFFF) {
-      if (!SetFileDate((STRPTR)filename, &info.dateStamp)) {
-	return ERROR_SET_DATESTAMP_FAILED;
+  }
+
+  return 0;
+}
+
+
+static uint32_t
+file_rename(int fd, const char* filename)
+{
+  uint32_t error = file_recvDestName(fd, filename);
+  if (error) {
+    return error;
+  }
+
+  return Rename((STRPTR)filename, (STRPTR)squirtd_destname) ? 0 : ERROR_RENAME_FAILED;
+}
+
+
+static uint32_t
+file_copy(int fd, const char* filename)
+{
+  uint32_t error = file_recvDestName(fd, filename);
+  if (error) {
+    return error;
+  }
+
+  if (!(squirtd_inputFd = Open((APTR)filename, MODE_OLDFILE))) {
+    return ERROR_COPY_FAILED;
+  }
+
+  if (!(squirtd_outputFd = Open((APTR)squirtd_destname, MODE_NEWFILE))) {
+    return ERROR_COPY_FAILED;
+  }
+
+  int len = -1;
+  if ((squirtd_rxBuffer = malloc(BLOCK_SIZE))) {
+    while ((len = Read(squirtd_inputFd, squirtd_rxBuffer, BLOCK_SIZE)) > 0) {
+      if (Write(squirtd_outputFd, squirtd_rxBuffer, len) != len) {
+	len = -1;
+	break;
       }
     }
-    return 0;
   }
 
-  return ERROR_FATAL_RECV_FAILED;
+  if (len < 0) {
+    // a truncated copy isn't left behind to be mistaken for the file
+    Close(squirtd_outputFd);
+    squirtd_outputFd = 0;
+    DeleteFile((STRPTR)squirtd_destname);
+    return ERROR_COPY_FAILED;
+  }
+
+  return 0;
+}
+
+
+// the reply tells the client these are understood before it sends a destination
+static uint32_t
+file_operation(int fd, uint32_t command, const char* filename)
+{
+  if (sendU32(fd, SQUIRT_FILEOP_REPLY) != 0) {
+    return ERROR_FATAL_SEND_FAILED;
+  }
+
+  switch (command) {
+  case SQUIRT_COMMAND_MAKEDIR:
+    return file_makeDir(filename);
+  case SQUIRT_COMMAND_DELETE:
+    return file_delete(filename);
+  case SQUIRT_COMMAND_RENAME:
+    return file_rename(fd, filename);
+  default:
+    return file_copy(fd, filename);
+  }
 }
 
 
@@ -572,14 +1027,26 @@ main(int argc, char **argv)
     error = exec_run(squirtd_connectionFd, squirtd_filename);
   } else if (command.command == SQUIRT_COMMAND_CD) {
     error = exec_cd(squirtd_filename);
+  } else if (command.command == SQUIRT_COMMAND_CD_CWD) {
+    error = exec_cdCwd(squirtd_connectionFd, squirtd_filename);
   } else if (command.command == SQUIRT_COMMAND_SUCK) {
     error = file_send(squirtd_connectionFd, squirtd_filename);
   } else if (command.command == SQUIRT_COMMAND_DIR) {
-    error = exec_dir(squirtd_connectionFd, squirtd_filename);
+    error = exec_dir(squirtd_connectionFd, squirtd_filename, 0);
+  } else if (command.command == SQUIRT_COMMAND_DIR_SINCE) {
+    error = exec_dir(squirtd_connectionFd, squirtd_filename, 1);
   } else if (command.command == SQUIRT_COMMAND_CWD) {
     error = exec_cwd(squirtd_connectionFd);
   } else if (command.command == SQUIRT_COMMAND_SET_INFO) {
-    error = file_setInfo(squirtd_connectionFd, squirtd_filename);
+    error = file_setInfo(squirtd_connectionFd, squirtd_filename, 0);
+  } else if (command.command == SQUIRT_COMMAND_SET_INFO_COMMENT) {
+    error = file_setInfo(squirtd_connectionFd, squirtd_filename, 1);
+  } else if (command.command >= SQUIRT_COMMAND_MAKEDIR && command.command <= SQUIRT_COMMAND_COPY) {
+    error = file_operation(squirtd_connectionFd, command.command, squirtd_filename);
+  } else if (command.command == SQUIRT_COMMAND_MANIFEST) {
+    error = exec_manifest(squirtd_connectionFd);
+  } else if (command.command == SQUIRT_COMMAND_DOSLIST) {
+    error = exec_dosList(squirtd_connectionFd);
   } else if (command.command == SQUIRT_COMMAND_SQUIRT ||
 	     command.command == SQUIRT_COMMAND_SQUIRT_TO_CWD) {
     error = file_get(squirtd_connectionFd);
@@ -591,7 +1058,7 @@ main(int argc, char **argv)
 
   cleanupForNextRun();
 
-  if (error < ERROR_FATAL_ERROR) {
+  if (!SQUIRT_ERROR_IS_FATAL(error)) {
     goto again;
   }
 
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "main.h"
 
 #ifdef _WIN32
@@ -60,11 +61,22 @@ static char srl_killBuffer[MAX_INPUT_LENGTH] = {0};
 static char srl_searchBuffer[MAX_INPUT_LENGTH] = {0};
 static char srl_searchPrompt[MAX_INPUT_LENGTH] = {0};
 
-// History management
-#define MAX_HISTORY_ENTRIES 100
+// History management, a ring of the most recent entries. Lines are appended
+// to the history file as they are entered, so sessions share it, and the file
+// is only rewritten once it has grown well past what is kept.
+#define MAX_HISTORY_ENTRIES 20000
+#define MAX_HISTORY_FILE_LINES (MAX_HISTORY_ENTRIES*2)
 static char* srl_history[MAX_HISTORY_ENTRIES];
+static int srl_historyStart = 0;
 static int srl_historyCount = 0;
 static int srl_historyIndex = -1;
+static int srl_historyFileLines = 0;
+
+// Reverse search narrows the matches for the last search text when more is
+// typed, rather than searching the whole history again
+static int srl_searchMatches[MAX_HISTORY_ENTRIES];
+static int srl_searchMatchCount = -1;
+static char srl_searchMatched[MAX_INPUT_LENGTH];
 
 // Reset tab completion tracking
 static void
@@ -295,6 +307,14 @@ srl_refreshLine(void)
 }
 
 // History functions
+
+// entry "i" counting from the oldest
+static const char*
+srl_historyAt(int i)
+{
+  return srl_history[(srl_historyStart + i) % MAX_HISTORY_ENTRIES];
+}
+
 static void
 srl_historySelectNext(void)
 {
@@ -307,7 +327,7 @@ srl_historySelectNext(void)
       srl_bufferLength = 0;
       srl_cursorPos = 0;
     } else {
-      strcpy(srl_inputBuffer, srl_history[srl_historyIndex]);
+      strcpy(srl_inputBuffer, srl_historyAt(srl_historyIndex));
       srl_bufferLength = strlen(srl_inputBuffer);
       srl_cursorPos = srl_bufferLength;
     }
@@ -324,7 +344,7 @@ srl_historySelectPrev(void)
     else if (srl_historyIndex > 0) srl_historyIndex--;
     
     if (srl_historyIndex >= 0) {
-      strcpy(srl_inputBuffer, srl_history[srl_historyIndex]);
+      strcpy(srl_inputBuffer, srl_historyAt(srl_historyIndex));
       srl_bufferLength = strlen(srl_inputBuffer);
       srl_cursorPos = srl_bufferLength;
       srl_refreshLine();
@@ -337,23 +357,55 @@ srl_findHistoryMatch(const char* candidate, int n)
 {
   if (!candidate || n < 0) return NULL;
 
-  int match_index = 0;
-  const char* last_content = NULL;
-
-  for (int i = MAX_HISTORY_ENTRIES - 1; i >= 0; i--) {
-    const char* entry = srl_history[i];
-    if (entry && strstr(entry, candidate)) {
-      if (!last_content || strcmp(entry, last_content) != 0) {
-        if (match_index == n) {
-          return entry;
-        }
-        last_content = entry;
-        match_index++;
+  // anything containing the longer text contains the text already matched
+  int length = strlen(srl_searchMatched);
+  if (srl_searchMatchCount >= 0 && strncmp(candidate, srl_searchMatched, length) == 0) {
+    if (candidate[length]) {
+      int count = 0;
+      const char* last_content = NULL;
+      for (int i = 0; i < srl_searchMatchCount; i++) {
+	const char* entry = srl_historyAt(srl_searchMatches[i]);
+	if (strstr(entry, candidate) && (!last_content || strcmp(entry, last_content) != 0)) {
+	  srl_searchMatches[count++] = srl_searchMatches[i];
+	  last_content = entry;
+	}
       }
+      srl_searchMatchCount = count;
     }
+  } else {
+    // newest first, skipping repeats of the previous match
+    const char* last_content = NULL;
+    srl_searchMatchCount = 0;
+    for (int i = srl_historyCount - 1; i >= 0; i--) {
+      const char* entry = srl_historyAt(i);
+      if (strstr(entry, candidate) && (!last_content || strcmp(entry, last_content) != 0)) {
+	srl_searchMatches[srl_searchMatchCount++] = i;
+	last_content = entry;
+      }
+    }
+  }
+  strlcpy(srl_searchMatched, candidate, sizeof(srl_searchMatched));
+
+  return n < srl_searchMatchCount ? srl_historyAt(srl_searchMatches[n]) : NULL;
+}
+
+// Keeps "line" as the newest entry, dropping the oldest once the ring is full
+static void
+srl_pushHistory(const char* line)
+{
+  char* entry = strdup(line);
+  if (!entry) {
+    return;
   }
 
-  return NULL;
+  if (srl_historyCount == MAX_HISTORY_ENTRIES) {
+    free(srl_history[srl_historyStart]);
+    srl_history[srl_historyStart] = entry;
+    srl_historyStart = (srl_historyStart + 1) % MAX_HISTORY_ENTRIES;
+  } else {
+    srl_history[(srl_historyStart + srl_historyCount++) % MAX_HISTORY_ENTRIES] = entry;
+  }
+  srl_searchMatchCount = -1;
 }
 
 static void
@@ -362,19 +414,18 @@ srl_addToHistory(const char* line)
   if (!line || !*line) return;
   
   // Check if same as last entry
-  if (srl_historyCount > 0 && strcmp(srl_history[srl_historyCount-1], line) == 0) {
+  if (srl_historyCount > 0 && strcmp(srl_historyAt(srl_historyCount-1), line) == 0) {
     return;
   }
   
-  if (srl_historyCount >= MAX_HISTORY_ENTRIES) {
-    free(srl_history[0]);
-    for (int i = 0; i < MAX_HISTORY_ENTRIES-1; i++) {
-      srl_history[i] = srl_history[i+1];
-    }
-    srl_historyCount = MAX_HISTORY_ENTRIES - 1;
+  srl_pushHistory(line);
+
+  FILE* file = fopen(util_getHistoryFile(), "a");
+  if (file) {
+    fprintf(file, "%s\n", line);
+    fclose(file);
+    srl_historyFileLines++;
   }
-  
-  srl_history[srl_historyCount++] = strdup(line);
 }
 
 // Tab completion handling
@@ -1003,13 +1054,35 @@ srl_escapeSpaces(const char* str)
 void
 srl_writeHistory(void)
 {
-  // Custom history writing - save our internal history to file
-  FILE* file = fopen(util_getHistoryFile(), "w");
+  // entries are appended as they are entered, so the file only needs
+  // compacting once it has grown, and then keeps the newest entries from
+  // every session rather than just this one's
+  if (srl_historyFileLines <= MAX_HISTORY_FILE_LINES) {
+    return;
+  }
+
+  srl_historyStart = srl_historyCount = 0;
+  for (int i = 0; i < MAX_HISTORY_ENTRIES; i++) {
+    if (srl_history[i]) {
+      free(srl_history[i]);
+      srl_history[i] = 0;
+    }
+  }
+  srl_loadHistory();
+
+  char tempFile[PATH_MAX];
+  snprintf(tempFile, sizeof(tempFile), "%s.tmp", util_getHistoryFile());
+  FILE* file = fopen(tempFile, "w");
   if (file) {
     for (int i = 0; i < srl_historyCount; i++) {
-      fprintf(file, "%s\n", srl_history[i]);
+      fprintf(file, "%s\n", srl_historyAt(i));
     }
     fclose(file);
+#ifdef _WIN32
+    unlink(util_getHistoryFile());
+#endif
+    rename(tempFile, util_getHistoryFile());
+    srl_historyFileLines = srl_historyCount;
   }
 }
 
@@ -1027,9 +1100,11 @@ srl_cleanup(void)
   
   // Free history
   for (int i = 0; i < srl_historyCount; i++) {
-    free(srl_history[i]);
+    free(srl_history[(srl_historyStart + i) % MAX_HISTORY_ENTRIES]);
+    srl_history[(srl_historyStart + i) % MAX_HISTORY_ENTRIES] = 0;
   }
-  srl_historyCount = 0;
+  srl_historyStart = srl_historyCount = 0;
+  srl_searchMatchCount = -1;
 }
 
 
@@ -1039,8 +1114,10 @@ static void srl_loadHistory(void)
   FILE* file = fopen(util_getHistoryFile(), "r");
   if (!file) return;
   
+  // the ring keeps the newest entries of a longer file
   char line[MAX_INPUT_LENGTH];
-  while (fgets(line, sizeof(line), file) && srl_historyCount < MAX_HISTORY_ENTRIES) {
+  srl_historyFileLines = 0;
+  while (fgets(line, sizeof(line), file)) {
     // Remove trailing newline
     size_t len = strlen(line);
     if (len > 0 && line[len-1] == '\n') {
@@ -1048,7 +1125,8 @@ static void srl_loadHistory(void)
     }
     
     if (strlen(line) > 0) {
-      srl_history[srl_historyCount++] = strdup(line);
+      srl_pushHistory(line);
+      srl_historyFileLines++;
     }
   }
   
@@ -1066,7 +1144,7 @@ srl_init(const char*(*prompt)(void),void (*complete_hook)(const char* text, cons
   
   // Initialize state
   srl_terminalSetup = 0;
-  srl_historyCount = 0;
+  srl_historyStart = srl_historyCount = 0;
   srl_historyIndex = -1;
   srl_cursorPos = 0;
   srl_bufferLength = 0;
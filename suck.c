@@ -7,59 +7,39 @@
 
 #include "main.h"
 #include "common.h"
-
-static int suck_fileFd = 0;
-static char* suck_readBuffer = 0;
-static struct timeval suck_start;
-
+#include "async.h"
 
 void
 suck_cleanup(void)
 {
-  if (suck_readBuffer) {
-    free(suck_readBuffer);
-    suck_readBuffer = 0;
-  }
 
-  if (suck_fileFd) {
-    close(suck_fileFd);
-    suck_fileFd = 0;
-  }
 }
 
 
 int32_t
-squirt_suckFile(const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), const char* destFilename, uint32_t* protection)
+suck_connFile(squirt_conn_t* conn, const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), int dirFd, const char* destFilename, uint32_t* protection)
 {
   int32_t total = 0;
+  struct timeval lastProgress = {0, 0};
 
   fflush(stdout);
 
-  if (util_sendCommand(main_socketFd, SQUIRT_COMMAND_SUCK) !=  0) {
-    fatalError("failed to connect to squirtd server");
-  }
-
-  if (util_sendLengthAndUtf8StringAsLatin1(main_socketFd, filename) != 0) {
-    fatalError("send() filename failed");
-  }
-
+  conn_sendCommand(conn, SQUIRT_COMMAND_SUCK);
+  conn_sendString(conn, filename, "filename");
 
   int32_t fileLength;
-  if (util_recv32(main_socketFd, &fileLength) != 0) {
-    fatalError("util_recv() Filelength failed");
+  if (conn_recvU32(conn, (uint32_t*)&fileLength, "file length") != 0) {
+    return -(int32_t)conn->error;
   }
 
-
   if (fileLength == -1) {
     uint32_t status;
-    util_recvU32(main_socketFd, &status);
-    printf("Error: Remote file '%s' not found\n", filename);
-    suck_cleanup();
-    return -1;
+    conn_recvU32(conn, &status, "remote status");
+    return conn->error ? -(int32_t)conn->error : -1;
   }
 
-  if (util_recvU32(main_socketFd, protection) != 0) {
-    fatalError("util_recv() protection failed");
+  if (conn_recvU32(conn, protection, "protection") != 0) {
+    return -(int32_t)conn->error;
   }
 
   const char* baseName;
@@ -70,21 +50,23 @@ squirt_suckFile(const char* filename, const char* progressHeader,  void (*progre
     baseName = destFilename;
   }
 
+  // the server sends the data regardless, so from here on any local failure
+  // leaves the connection unusable
+  char* buffer = conn_buffer(conn);
   // Use util_safeName to handle Windows reserved filenames
   char* safeBaseName = util_safeName(baseName);
-  if (!safeBaseName) {
-    fatalError("memory allocation failed for safe filename");
+  if (!buffer || !safeBaseName) {
+    free(safeBaseName);
+    return -(int32_t)conn_fail(conn, ERROR_FATAL_ERROR, "memory allocation failed for safe filename");
   }
-  
-  suck_fileFd = open(safeBaseName, O_WRONLY|O_CREAT|O_TRUNC|_O_BINARY, 0777);
+
+  int fileFd = util_dirOpenFile(dirFd, safeBaseName, O_WRONLY|O_CREAT|O_TRUNC|_O_BINARY);
   free(safeBaseName); // Free the allocated safe name
 
-  if (suck_fileFd == -1) {
-    fatalError("failed to open %s", baseName);
+  if (fileFd == -1) {
+    return -(int32_t)conn_fail(conn, ERROR_FATAL_CREATE_FILE_FAILED, "failed to open %s", baseName);
   }
 
-  suck_readBuffer = malloc(BLOCK_SIZE);
-
   if (fileLength > 0) {
     if (progress == util_printProgress) {
       printf("sucking %s (%s bytes)\n", filename, util_formatNumber(fileLength));
@@ -92,7 +74,7 @@ squirt_suckFile(const char* filename, const char* progressHeader,  void (*progre
 
     fflush(stdout);
 
-    gettimeofday(&suck_start, NULL);
+    gettimeofday(&conn->start, NULL);
 
     do {
       int len, requestLength;
@@ -101,46 +83,73 @@ squirt_suckFile(const char* filename, const char* progressHeader,  void (*progre
       } else {
 	requestLength = fileLength - total;
       }
-      if ((len = util_recv(main_socketFd, suck_readBuffer, requestLength, 0)) < 0) {
-	fflush(stdout);
-	fatalError("\nfailed to read");
-      } else {
-	if (progress) {
-	  progress(progressHeader ? progressHeader : filename, &suck_start, total, fileLength);
+      if (conn_recv(conn, buffer, requestLength, "file data") == 0) {
+	len = requestLength;
+	// drawing every block slows fast links down, the final state is drawn below
+	if (progress && util_progressDue(&lastProgress)) {
+	  progress(progressHeader ? progressHeader : filename, &conn->start, total, fileLength);
 	}
-	int readLen;
-	if ((readLen = write(suck_fileFd, suck_readBuffer, len)) != len) {
-	  fflush(stdout);
-	  fatalError("\nfailed to write to %s %d",  baseName, readLen);
+	int writeLen;
+	if ((writeLen = write(fileFd, buffer, len)) != len) {
+	  conn_fail(conn, ERROR_FATAL_FILE_WRITE_FAILED, "failed to write to %s %d", baseName, writeLen);
 	}
 	total += len;
       }
-    } while (total < fileLength);
+    } while (!conn->error && total < fileLength);
 
     if (progress) {
-      progress(progressHeader ? progressHeader : filename, &suck_start, total, fileLength);
+      progress(progressHeader ? progressHeader : filename, &conn->start, total, fileLength);
       fflush(stdout);
     }
-  } else {
-    total = fileLength;
   }
 
+  close(fileFd);
 
   uint32_t error;
-  if (util_recvU32(main_socketFd, &error) != 0) {
-    return -1;
+  if (conn_recvU32(conn, &error, "remote status") != 0) {
+    return -(int32_t)conn->error;
   }
 
-  if (error) {
-    total = -error;
-    if (progress == util_printProgress) {
-      fatalError("failed to suck file %s", filename);
-    }
+  return error ? -(int32_t)error : fileLength;
+}
+
+
+static int32_t
+suck_checkResult(squirt_conn_t* conn, const char* filename, int32_t result, void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength))
+{
+  if (result == -1 && !conn->error) {
+    printf("Error: Remote file '%s' not found\n", filename);
   }
 
-  suck_cleanup();
+  conn_detach(conn);
+
+  if (result < -1 && progress == util_printProgress) {
+    fatalError("failed to suck file %s", filename);
+  }
 
-  return total;
+  return result;
+}
+
+
+int32_t
+squirt_suckFile(const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), int dirFd, const char* destFilename, uint32_t* protection)
+{
+  squirt_conn_t conn;
+  conn_attach(&conn, main_socketFd);
+
+  int32_t result = suck_connFile(&conn, filename, progressHeader, progress, dirFd, destFilename, protection);
+
+  return suck_checkResult(&conn, filename, result, progress);
+}
+
+
+static void
+suck_printProgress(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength)
+{
+  if (total == 0) {
+    printf("sucking %s (%s bytes)\n", filename, util_formatNumber(fileLength));
+  }
+  util_printProgress(filename, start, total, fileLength);
 }
 
 
@@ -151,18 +160,35 @@ suck_main(int argc, char* argv[])
     fatalError("incorrect number of arguments\nusage: %s hostname filename", main_argv0);
   }
 
-  util_connect(argv[1]);
+  async_engine_t* engine = async_newEngine();
+  async_conn_t* conn = async_connect(engine, argv[1]);
+  uint32_t error = 0, protection;
+  int32_t length = 0;
+
+  async_setProgress(conn, suck_printProgress);
+  async_suck(conn, argv[2], 0, &length, &protection, async_storeError, &error);
+
+  if (async_run(engine) != 0) {
+    fflush(stdout);
+    fatalError("%s", conn_errorString(async_session(conn)));
+  }
 
-  uint32_t protection;
-  int32_t length = squirt_suckFile(argv[2], 0, util_printProgress, 0, &protection);
+  const char* baseName = util_amigaBaseName(argv[2]);
 
+  if (length == -1) {
+    printf("Error: Remote file '%s' not found\n", argv[2]);
+  } else if (error == ERROR_FATAL_CREATE_FILE_FAILED || error == ERROR_FATAL_FILE_WRITE_FAILED) {
+    fatalError("failed to write to %s", baseName);
+  } else if (error) {
+    fatalError("failed to suck file %s", argv[2]);
+  }
+
+  struct timeval start = async_session(conn)->start;
   struct timeval end;
 
   gettimeofday(&end, NULL);
-  long seconds = end.tv_sec - suck_start.tv_sec;
-  long micros = ((seconds * 1000000) + end.tv_usec) - suck_start.tv_usec;
-
-  const char* baseName = util_amigaBaseName(argv[2]);
+  long seconds = end.tv_sec - start.tv_sec;
+  long micros = ((seconds * 1000000) + end.tv_usec) - start.tv_usec;
 
   fflush(stdout);
 
@@ -173,4 +199,6 @@ suck_main(int argc, char* argv[])
   } else {
     fprintf(stderr, "%s: failed to suck %s\n", main_argv0, argv[2]);
   }
+
+  async_freeEngine(engine);
 }
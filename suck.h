@@ -1,8 +1,18 @@
 #pragma once
 #include <stdint.h>
+#include "conn.h"
 
+// Fetches the remote file "filename" into the directory "dirFd" (UTIL_DIR_CWD
+// for the current directory) as "destFilename", or under its own name if that
+// is 0. Returns the length, -1 if
+// the file doesn't exist, otherwise minus the remote status or the connection's
+// error if it failed.
 int32_t
-squirt_suckFile(const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), const char* destFilename, uint32_t* protection);
+suck_connFile(squirt_conn_t* conn, const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), int dirFd, const char* destFilename, uint32_t* protection);
+
+// suck_connFile on the thread's connection, exits if the connection fails
+int32_t
+squirt_suckFile(const char* filename, const char* progressHeader,  void (*progress)(const char* progressHeader, struct timeval* start, uint32_t total, uint32_t fileLength), int dirFd, const char* destFilename, uint32_t* protection);
 
 void
 suck_cleanup(void);
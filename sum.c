@@ -8,29 +8,33 @@
 int
 main(int argc, char** argv)
 {
-  if (argc != 2) {
+  if (argc < 2) {
 #ifdef AMIGA
-    Printf((APTR)"usage: %s file\n", (int)argv[0]);
+    Printf((APTR)"usage: %s file [file...]\n", (int)argv[0]);
 #else
-    printf("usage: %s file\n", argv[0]);
+    printf("usage: %s file [file...]\n", argv[0]);
 #endif
     return 1;
   }
 
-  uint32_t crc;
-  if (crc32_sum(argv[1], &crc) == 0) {
+  // one line per file, in order, so the host can verify a whole directory at once
+  int error = 0;
+  for (int i = 1; i < argc; i++) {
+    uint32_t crc;
+    if (crc32_sum(argv[i], &crc) == 0) {
 #ifdef AMIGA
-    Printf((APTR)"%lx\n", crc);
+      Printf((APTR)"%lx\n", crc);
 #else
-    printf("%x\n", crc);
+      printf("%x\n", crc);
 #endif
-  } else {
+    } else {
 #ifdef AMIGA
-    Printf((APTR)"error\n", 0);
+      Printf((APTR)"error\n", 0);
 #else
-    puts("error\n");
+      puts("error");
 #endif
-    return 1;
+      error = 1;
+    }
   }
-  return 0;
+  return error;
 }
@@ -8,11 +8,11 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/time.h>
-#include <iconv.h>
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <utime.h>
 #include <ctype.h>
 #include <errno.h>
 
@@ -29,6 +29,9 @@ typedef int socklen_t;
 #include "main.h"
 #include "common.h"
 #include "argv.h"
+#include "latin1.h"
+
+#define UTIL_PROGRESS_INTERVAL 100000 // usecs between progress redraws
 
 static const char* errors[] = {
   [_ERROR_SUCCESS] = "Unknown error",
@@ -41,6 +44,11 @@ static const char* errors[] = {
   [ERROR_FILE_READ_FAILED] = "file read failed",
   [ERROR_SET_DATESTAMP_FAILED] = "set datestamp failed",
   [ERROR_SET_PROTECTION_FAILED] = "set protection failed",
+  [ERROR_SET_COMMENT_FAILED] = "set comment failed",
+  [ERROR_CREATE_DIR_FAILED] = "create dir failed",
+  [ERROR_DELETE_FAILED] = "delete failed",
+  [ERROR_RENAME_FAILED] = "rename failed",
+  [ERROR_COPY_FAILED] = "copy failed",
   [ERROR_CD_FAILED] = "cd failed",
   [ERROR_EXEC_FAILED] = "exec failed",
   [ERROR_SUCK_ON_DIR] = "suck on dir",
@@ -105,20 +113,30 @@ util_isHostname(const char *__hostname)
 }
 #endif
 
-void
-util_connect(const char* __hostname)
+int
+util_setBlocking(int socketFd, int blocking)
+{
+#ifdef _WIN32
+  u_long mode = !blocking;
+  return ioctlsocket(socketFd, FIONBIO, &mode) != 0 ? -1 : 0;
+#else
+  int flags = fcntl(socketFd, F_GETFL, 0);
+  if (flags < 0) {
+    return -1;
+  }
+  flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+  return fcntl(socketFd, F_SETFL, flags) < 0 ? -1 : 0;
+#endif
+}
+
+
+int
+util_startConnect(const char* __hostname)
 {
   struct sockaddr_in sockAddr;
+  int socketFd = -1;
   int result;
-  fd_set writefds;
-  struct timeval timeout;
-  socklen_t len;
-  int error;
-#ifndef _WIN32
-  int flags;
-#endif
 
-  
   int port=NETWORK_PORT;
   char* _hostname = strdup(__hostname);
   char *colon = strstr(_hostname,":");
@@ -133,29 +151,18 @@ util_connect(const char* __hostname)
     goto error;
   }
 
-  if ((main_socketFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+  if ((socketFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     goto error;
   }
 
   // Set socket to non-blocking mode
-#ifdef _WIN32
-  u_long mode = 1;
-  if (ioctlsocket(main_socketFd, FIONBIO, &mode) != 0) {
-    goto error;
-  }
-#else
-  flags = fcntl(main_socketFd, F_GETFL, 0);
-  if (flags < 0) {
+  if (util_setBlocking(socketFd, 0) != 0) {
     goto error;
   }
-  if (fcntl(main_socketFd, F_SETFL, flags | O_NONBLOCK) < 0) {
-    goto error;
-  }
-#endif
 
   // Attempt to connect
-  result = connect(main_socketFd, (struct sockaddr *)&sockAddr, sizeof(struct sockaddr_in));
-  
+  result = connect(socketFd, (struct sockaddr *)&sockAddr, sizeof(struct sockaddr_in));
+
   if (result < 0) {
 #ifdef _WIN32
     int wsaError = WSAGetLastError();
@@ -167,67 +174,89 @@ util_connect(const char* __hostname)
       goto error;
     }
 #endif
-    
-    // Connection is in progress, wait for it to complete with timeout
-    FD_ZERO(&writefds);
-    FD_SET(main_socketFd, &writefds);
-    
-    timeout.tv_sec = 5;  // 5 second timeout
-    timeout.tv_usec = 0;
-    
-    result = select(main_socketFd + 1, NULL, &writefds, NULL, &timeout);
-    
-    if (result <= 0) {
-      // Timeout or error
-      goto error;
-    }
-    
-    // Check if connection was successful
-    len = sizeof(error);
+  }
+
+  free(_hostname);
+  return socketFd;
+ error:
+  if (socketFd >= 0) {
+    close(socketFd);
+  }
+  free(_hostname);
+  return -1;
+}
+
+
+int
+util_connectResult(int socketFd)
+{
+  int error;
+  socklen_t len = sizeof(error);
+
 #ifdef _WIN32
-    if (getsockopt(main_socketFd, SOL_SOCKET, SO_ERROR, (char*)&error, &len) < 0) {
+  if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, (char*)&error, &len) < 0) {
 #else
-    if (getsockopt(main_socketFd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+  if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
 #endif
-      goto error;
-    }
-    
-    if (error != 0) {
+    return -1;
+  }
+
+  if (error != 0) {
 #ifdef _WIN32
-      WSASetLastError(error);
+    WSASetLastError(error);
 #else
-      errno = error;
+    errno = error;
 #endif
-      goto error;
-    }
+    return -1;
   }
 
-  // Restore socket to blocking mode
-#ifdef _WIN32
-  mode = 0;
-  if (ioctlsocket(main_socketFd, FIONBIO, &mode) != 0) {
-    goto error;
+  return 0;
+}
+
+
+int
+util_connectSocket(const char* hostname)
+{
+  fd_set writefds;
+  struct timeval timeout;
+
+  int socketFd = util_startConnect(hostname);
+  if (socketFd < 0) {
+    return -1;
   }
-#else
-  // Clear the O_NONBLOCK flag to ensure blocking mode
-  if (fcntl(main_socketFd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
-    goto error;
+
+  // Connection may be in progress, wait for it to complete with timeout
+  FD_ZERO(&writefds);
+  FD_SET(socketFd, &writefds);
+
+  timeout.tv_sec = 5;  // 5 second timeout
+  timeout.tv_usec = 0;
+
+  // Timeout or error, otherwise check if connection was successful
+  if (select(socketFd + 1, NULL, &writefds, NULL, &timeout) <= 0 ||
+      util_connectResult(socketFd) != 0 ||
+      util_setBlocking(socketFd, 1) != 0) {
+    close(socketFd);
+    return -1;
   }
-#endif
 
   // Note: Socket-level timeouts (SO_RCVTIMEO/SO_SNDTIMEO) can cause issues
   // Connection timeout is already handled above with select() during connect
 
+  return socketFd;
+}
+
+
+void
+util_connect(const char* hostname)
+{
+  if ((main_socketFd = util_connectSocket(hostname)) < 0) {
+    main_socketFd = 0;
+    fatalError("failed to connect to server %s", hostname);
+  }
+
   // Reset connection error flag for new connection
   util_resetConnectionErrorFlag();
-  free(_hostname);
-  return;
- error:
-  if (main_socketFd >= 0) {
-    close(main_socketFd);
-    main_socketFd = -1;
-  }
-  fatalError("failed to connect to server %s:%d", hostname, port);
 }
 
 
@@ -391,17 +420,15 @@ util_open(const char* filename, uint32_t mode)
 }
 
 
-static char*
+char*
 util_utf8ToLatin1(const char* buffer)
 {
-  iconv_t ic = iconv_open("ISO-8859-1", "UTF-8");
-  size_t insize = strlen(buffer);
-  char* inptr = (char*)buffer;
-  size_t outsize = (insize)+1;
-  char* out = calloc(1, outsize);
-  char* outptr = out;
-  iconv(ic, &inptr, &insize, &outptr, &outsize);
-  iconv_close(ic);
+  size_t length = strlen(buffer);
+  char* out = malloc(length+1);
+  if (out) {
+    size_t outLength;
+    latin1_fromUtf8(out, &outLength, buffer, length);
+  }
   return out;
 }
 
@@ -410,20 +437,11 @@ char*
 util_latin1ToUtf8(const char* _buffer)
 {
   if (_buffer) {
-    iconv_t ic = iconv_open("UTF-8", "ISO-8859-1");
-    char* buffer = malloc(strlen(_buffer)+1);
-    if (!buffer) {
-      return NULL;
+    size_t length = strlen(_buffer);
+    char* out = malloc(length*2+1);
+    if (out) {
+      latin1_toUtf8(out, _buffer, length);
     }
-    strcpy(buffer, _buffer);
-    size_t insize = strlen(buffer);
-    char* inptr = (char*)buffer;
-    size_t outsize = (insize*4)+1;
-    char* out = calloc(1, outsize);
-    char* outptr = out;
-    iconv(ic, &inptr, &insize, &outptr, &outsize);
-    iconv_close(ic);
-    free(buffer);
     return out;
   }
 
@@ -445,6 +463,20 @@ util_printFormatSpeed(int32_t size, double elapsed)
 }
 
 
+int
+util_progressDue(struct timeval* last)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  long micros = (now.tv_sec - last->tv_sec) * 1000000 + (now.tv_usec - last->tv_usec);
+  if ((last->tv_sec || last->tv_usec) && micros >= 0 && micros < UTIL_PROGRESS_INTERVAL) {
+    return 0;
+  }
+  *last = now;
+  return 1;
+}
+
+
 void
 util_printProgress(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength)
 {
@@ -466,7 +498,6 @@ util_printProgress(const char* filename, struct timeval* start, uint32_t total,
 #else
   printf("\r");
 #endif
-  fflush(stdout);
   if (percentage >= 100) {
     printf("\xE2\x9C\x85 "); // utf-8 tick
   } else {
@@ -590,42 +621,26 @@ util_recv32(int socketFd, int32_t *data)
 int
 util_sendLengthAndUtf8StringAsLatin1(int socketFd, const char* str)
 {
-  int error = 0;
-  char* latin1 = util_utf8ToLatin1(str);
-  uint32_t length = strlen(latin1);
-  uint32_t networkLength = htonl(length);
-
-  if (send(socketFd, (const void*)&networkLength, sizeof(networkLength), 0) == sizeof(networkLength)) {
-    error = send(socketFd, latin1, length, 0) != (int)length;
-  }
-
-  free(latin1);
-  return error;
+  squirt_conn_t conn;
+  conn_attach(&conn, socketFd);
+  return conn_sendString(&conn, str, "string") != 0 ? -1 : 0;
 }
 
 
 char*
 util_recvLatin1AsUtf8(int socketFd, uint32_t length)
 {
-  char* buffer = malloc(length+1);
-
-  if (util_recv(socketFd, buffer, length, 0) != length) {
-    free(buffer);
-    return 0;
-  }
-
-  buffer[length] = 0;
-
-  char* utf8 = util_latin1ToUtf8(buffer);
-  free(buffer);
-  return utf8;
+  squirt_conn_t conn;
+  conn_attach(&conn, socketFd);
+  return conn_recvString(&conn, length, "string");
 }
 
 
 const char*
 util_getErrorString(uint32_t error)
 {
-  if (error >= sizeof(errors)) {
+  // a newer squirtd may send codes this client doesn't know
+  if (error >= countof(errors) || !errors[error]) {
     error = 0;
   }
 
@@ -719,6 +734,243 @@ util_isDirectory(const char *path)
 }
 
 
+#ifdef _WIN32
+#define UTIL_MAX_DIR_HANDLES 256
+
+// there is no openat, so a handle is the directory's path and names are
+// joined onto it
+static char* util_dirHandles[UTIL_MAX_DIR_HANDLES];
+
+static int
+_util_dirHandle(char* path)
+{
+  if (!path) {
+    return -1;
+  }
+
+  for (int i = 0; i < UTIL_MAX_DIR_HANDLES; i++) {
+    if (!util_dirHandles[i]) {
+      util_dirHandles[i] = path;
+      return i;
+    }
+  }
+
+  free(path);
+  return -1;
+}
+
+
+static const char*
+_util_dirPath(char* path, size_t size, int dirFd, const char* name)
+{
+  if (dirFd == UTIL_DIR_CWD) {
+    return name;
+  }
+
+  snprintf(path, size, "%s\\%s", util_dirHandles[dirFd], name);
+  return path;
+}
+#endif
+
+
+int
+util_dirOpenCwd(void)
+{
+#ifndef _WIN32
+  return open(".", O_RDONLY|O_DIRECTORY);
+#else
+  return _util_dirHandle(getcwd(0, 0));
+#endif
+}
+
+
+void
+util_dirClose(int dirFd)
+{
+  if (dirFd < 0) {
+    return;
+  }
+#ifndef _WIN32
+  close(dirFd);
+#else
+  free(util_dirHandles[dirFd]);
+  util_dirHandles[dirFd] = 0;
+#endif
+}
+
+
+int
+util_dirPush(int dirFd, const char* name, int create)
+{
+  if (create && util_dirMkdir(dirFd, name) != 0 && errno != EEXIST) {
+    return -1;
+  }
+
+#ifndef _WIN32
+  return openat(dirFd, name, O_RDONLY|O_DIRECTORY);
+#else
+  char path[PATH_MAX];
+  _util_dirPath(path, sizeof(path), dirFd, name);
+  if (!util_isDirectory(path)) {
+    return -1;
+  }
+
+  return _util_dirHandle(strdup(path));
+#endif
+}
+
+
+int
+util_dirPop(int dirFd, int parentFd)
+{
+  (void)parentFd;
+  util_dirClose(dirFd);
+  return 0;
+}
+
+
+int
+util_dirOpenFile(int dirFd, const char* name, int flags)
+{
+#ifndef _WIN32
+  return openat(dirFd, name, flags, 0777);
+#else
+  char path[PATH_MAX];
+  return open(_util_dirPath(path, sizeof(path), dirFd, name), flags, 0777);
+#endif
+}
+
+
+FILE*
+util_dirFopen(int dirFd, const char* name, const char* mode)
+{
+  int fd = util_dirOpenFile(dirFd, name, mode[0] == 'r' ? O_RDONLY|_O_BINARY : O_WRONLY|O_CREAT|O_TRUNC|_O_BINARY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  FILE* fp = fdopen(fd, mode);
+  if (!fp) {
+    close(fd);
+  }
+  return fp;
+}
+
+
+int
+util_dirStat(int dirFd, const char* name, struct stat* st)
+{
+#ifndef _WIN32
+  return fstatat(dirFd, name, st, 0);
+#else
+  char path[PATH_MAX];
+  return stat(_util_dirPath(path, sizeof(path), dirFd, name), st);
+#endif
+}
+
+
+int
+util_dirMkdir(int dirFd, const char* name)
+{
+#ifndef _WIN32
+  return mkdirat(dirFd, name, 0777);
+#else
+  char path[PATH_MAX];
+  return util_mkdir(_util_dirPath(path, sizeof(path), dirFd, name), 0777);
+#endif
+}
+
+
+int
+util_dirSetModTime(int dirFd, const char* name, time_t modTime)
+{
+#ifndef _WIN32
+  struct timespec times[2] = {{0, UTIME_OMIT}, {modTime, 0}};
+  return utimensat(dirFd, name, times, 0);
+#else
+  char path[PATH_MAX];
+  struct stat st;
+  struct utimbuf ut;
+  _util_dirPath(path, sizeof(path), dirFd, name);
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+  ut.actime = st.st_atime;
+  ut.modtime = modTime;
+  return utime(path, &ut);
+#endif
+}
+
+
+int
+util_dirRemove(int dirFd, const char* name)
+{
+  struct stat st;
+  if (util_dirStat(dirFd, name, &st) != 0) {
+    return -1;
+  }
+
+#ifndef _WIN32
+  if (!S_ISDIR(st.st_mode)) {
+    return unlinkat(dirFd, name, 0);
+  }
+
+  int fd = openat(dirFd, name, O_RDONLY|O_DIRECTORY);
+  DIR* dir = fd < 0 ? 0 : fdopendir(fd);
+  if (!dir) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  int error = 0;
+  struct dirent* dp;
+  while (!error && (dp = readdir(dir)) != NULL) {
+    if (strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0) {
+      error = util_dirRemove(fd, dp->d_name);
+    }
+  }
+  closedir(dir);
+
+  return error ? error : unlinkat(dirFd, name, AT_REMOVEDIR);
+#else
+  char path[PATH_MAX];
+  _util_dirPath(path, sizeof(path), dirFd, name);
+  return S_ISDIR(st.st_mode) ? util_rmdir(path) : unlink(path);
+#endif
+}
+
+
+int
+util_dirOperationAt(int dirFd, const char* directory, void (*operation)(const char* filename, void* data), void* data)
+{
+#ifndef _WIN32
+  int fd = openat(dirFd, directory, O_RDONLY|O_DIRECTORY);
+  DIR* dir = fd < 0 ? 0 : fdopendir(fd);
+  if (!dir) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  struct dirent *dp;
+  while ((dp = readdir(dir)) != NULL) {
+    if (operation) {
+      operation(dp->d_name, data);
+    }
+  }
+
+  closedir(dir);
+  return 1;
+#else
+  char path[PATH_MAX];
+  return util_dirOperation(_util_dirPath(path, sizeof(path), dirFd, directory), operation, data);
+#endif
+}
+
+
 int
 util_exec(char* command)
 {
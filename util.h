@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
 #include <sys/time.h>
 
 const char*
@@ -9,6 +11,21 @@ util_formatNumber(int number);
 void
 util_connect(const char* hostname);
 
+// Connected socket for "hostname", or -1 if the connection failed
+int
+util_connectSocket(const char* hostname);
+
+// Non-blocking socket with a connection to "hostname" under way, or -1. Once it
+// is writable util_connectResult says whether the connection was made.
+int
+util_startConnect(const char* hostname);
+
+int
+util_connectResult(int socketFd);
+
+int
+util_setBlocking(int socketFd, int blocking);
+
 void
 util_resetConnectionErrorFlag(void);
 
@@ -23,6 +40,9 @@ util_getHistoryFile(void);
 char*
 util_latin1ToUtf8(const char* _buffer);
 
+char*
+util_utf8ToLatin1(const char* buffer);
+
 int
 util_mkpath(const char *dir);
 
@@ -68,6 +88,11 @@ util_printFormatSpeed(int32_t size, double elapsed);
 void
 util_printProgress(const char* filename, struct timeval* start, uint32_t total, uint32_t fileLength);
 
+// Whether a transfer's progress should be drawn again, at most 10 times a
+// second. "last" starts zeroed and is updated whenever progress is due.
+int
+util_progressDue(struct timeval* last);
+
 void
 util_onCtrlC(void (*handler)(void));
 
@@ -80,6 +105,54 @@ util_getTempFolder(void);
 int
 util_isDirectory(const char *path);
 
+// The util_dir functions name files relative to an open directory, so
+// nothing depends on the process wide current directory. UTIL_DIR_CWD names
+// them relative to it.
+#ifndef _WIN32
+#define UTIL_DIR_CWD AT_FDCWD
+#else
+#define UTIL_DIR_CWD -1
+#endif
+
+int
+util_dirOpenCwd(void);
+
+void
+util_dirClose(int dirFd);
+
+// Opens "name" in "dirFd", creating it first if "create" is set
+int
+util_dirPush(int dirFd, const char* name, int create);
+
+// Closes a directory opened by util_dirPush
+int
+util_dirPop(int dirFd, int parentFd);
+
+int
+util_dirOpenFile(int dirFd, const char* name, int flags);
+
+// "mode" is "r", "rb", "w" or "wb"
+FILE*
+util_dirFopen(int dirFd, const char* name, const char* mode);
+
+struct stat;
+
+int
+util_dirStat(int dirFd, const char* name, struct stat* st);
+
+int
+util_dirMkdir(int dirFd, const char* name);
+
+int
+util_dirSetModTime(int dirFd, const char* name, time_t modTime);
+
+// Removes a file, or a directory and everything in it
+int
+util_dirRemove(int dirFd, const char* name);
+
+int
+util_dirOperationAt(int dirFd, const char* directory, void (*operation)(const char* filename, void* data), void* data);
+
 int
 util_system(char** argv);
 
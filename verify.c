@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "common.h"
+#include "crc32.h"
+#include "verify.h"
+
+#define VERIFY_THREADS      4
+#define VERIFY_MAX_ATTEMPTS 3
+// amiga shell lines are limited, so large directories are summed in several calls
+#define VERIFY_MAX_COMMAND  400
+
+typedef struct verify_job {
+  int dirFd;
+  char* localName;
+  char* remotePath;
+  void* data;
+  int hashed;
+  int verified;
+  int localError;
+  int remoteError;
+  uint32_t localCrc;
+  uint32_t remoteCrc;
+  long bytes;
+  struct verify_job* next;
+  struct verify_job* nextQueued;
+} verify_job_t;
+
+struct verify_batch {
+  verify_job_t* head;
+  verify_job_t* tail;
+  struct verify_batch* next;
+};
+
+static pthread_mutex_t verify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t verify_workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t verify_doneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t verify_threads[VERIFY_THREADS];
+static int verify_threadCount = 0;
+static int verify_shutdown = 0;
+static verify_job_t* verify_queueHead = 0;
+static verify_job_t* verify_queueTail = 0;
+static verify_batch_t* verify_batches = 0;
+
+
+static void
+verify_freeBatch(verify_batch_t* batch)
+{
+  verify_job_t* job = batch->head;
+  while (job) {
+    verify_job_t* save = job;
+    job = job->next;
+    free(save->localName);
+    free(save->remotePath);
+    free(save);
+  }
+  free(batch);
+}
+
+
+void
+verify_cleanup(void)
+{
+  pthread_mutex_lock(&verify_mutex);
+  verify_shutdown = 1;
+  pthread_cond_broadcast(&verify_workCond);
+  pthread_mutex_unlock(&verify_mutex);
+
+  for (int i = 0; i < verify_threadCount; i++) {
+    pthread_join(verify_threads[i], 0);
+  }
+  verify_threadCount = 0;
+  verify_shutdown = 0;
+  verify_queueHead = verify_queueTail = 0;
+
+  while (verify_batches) {
+    verify_batch_t* save = verify_batches;
+    verify_batches = verify_batches->next;
+    verify_freeBatch(save);
+  }
+}
+
+
+static void*
+verify_worker(void* arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&verify_mutex);
+  for (;;) {
+    while (!verify_queueHead && !verify_shutdown) {
+      pthread_cond_wait(&verify_workCond, &verify_mutex);
+    }
+
+    if (verify_shutdown) {
+      break;
+    }
+
+    verify_job_t* job = verify_queueHead;
+    verify_queueHead = job->nextQueued;
+    if (!verify_queueHead) {
+      verify_queueTail = 0;
+    }
+    pthread_mutex_unlock(&verify_mutex);
+
+    uint32_t crc = 0;
+    FILE* fp = util_dirFopen(job->dirFd, job->localName, "rb");
+    int error = !fp || crc32_sumFile(fp, &crc) != 0;
+    long bytes = 0;
+    if (fp) {
+      bytes = ftell(fp);
+      fclose(fp);
+    }
+
+    pthread_mutex_lock(&verify_mutex);
+    job->bytes = bytes;
+    job->localCrc = crc;
+    job->localError = error;
+    job->hashed = 1;
+    pthread_cond_broadcast(&verify_doneCond);
+  }
+  pthread_mutex_unlock(&verify_mutex);
+
+  return 0;
+}
+
+
+static void
+verify_hash(verify_job_t* job)
+{
+  if (verify_threadCount == 0) {
+    for (int i = 0; i < VERIFY_THREADS; i++) {
+      if (pthread_create(&verify_threads[i], 0, verify_worker, 0) != 0) {
+	fatalError("failed to create crc32 thread");
+      }
+      verify_threadCount++;
+    }
+  }
+
+  pthread_mutex_lock(&verify_mutex);
+  job->hashed = 0;
+  job->nextQueued = 0;
+  if (verify_queueTail) {
+    verify_queueTail->nextQueued = job;
+  } else {
+    verify_queueHead = job;
+  }
+  verify_queueTail = job;
+  pthread_cond_signal(&verify_workCond);
+  pthread_mutex_unlock(&verify_mutex);
+}
+
+
+verify_batch_t*
+verify_newBatch(void)
+{
+  verify_batch_t* batch = calloc(1, sizeof(verify_batch_t));
+  if (!batch) {
+    fatalError("malloc failed");
+  }
+  batch->next = verify_batches;
+  verify_batches = batch;
+  return batch;
+}
+
+
+void
+verify_queue(verify_batch_t* batch, int dirFd, const char* localName, const char* remotePath, void* data)
+{
+  verify_job_t* job = calloc(1, sizeof(verify_job_t));
+  if (!job || !(job->localName = strdup(localName)) || !(job->remotePath = strdup(remotePath))) {
+    fatalError("malloc failed");
+  }
+  job->dirFd = dirFd;
+  job->data = data;
+
+  if (batch->tail) {
+    batch->tail->next = job;
+  } else {
+    batch->head = job;
+  }
+  batch->tail = job;
+
+  verify_hash(job);
+}
+
+
+static int
+verify_parseSums(verify_job_t* first, verify_job_t* end, char* output)
+{
+  char* line = output;
+  for (verify_job_t* job = first; job != end; job = job->next) {
+    if (job->verified) {
+      continue;
+    }
+
+    if (!line || !*line) {
+      return 0;
+    }
+
+    char* next = strchr(line, '\n');
+    if (next) {
+      *next++ = 0;
+    }
+
+    if (strcmp(line, "error") == 0) {
+      job->remoteError = 1;
+    } else if (sscanf(line, "%x", &job->remoteCrc) == 1) {
+      job->remoteError = 0;
+    } else {
+      return 0;
+    }
+    line = next;
+  }
+
+  return 1;
+}
+
+
+static void
+verify_remoteSum(verify_job_t* first, verify_job_t* end)
+{
+  char command[VERIFY_MAX_COMMAND+PATH_MAX];
+  char* argv[] = {command};
+  uint32_t error;
+  int length = snprintf(command, sizeof(command), "ssum");
+
+  for (verify_job_t* job = first; job != end; job = job->next) {
+    if (!job->verified) {
+      length += snprintf(command+length, sizeof(command)-length, " \"%s\"", job->remotePath);
+      if (length >= (int)sizeof(command)) {
+	fatalError("path too long %s", job->remotePath);
+      }
+    }
+  }
+
+  char* output = exec_captureCmd(&error, 1, argv);
+  int parsed = output && verify_parseSums(first, end, output);
+  free(output);
+
+  if (!parsed) {
+    if (first->next == end) {
+      fatalError("remote crc32 failed for %s", first->remotePath);
+    }
+
+    // an older ssum only sums one file at a time
+    for (verify_job_t* job = first; job != end; job = job->next) {
+      if (!job->verified) {
+	verify_remoteSum(job, job->next);
+      }
+    }
+  }
+}
+
+
+static void
+verify_remoteSums(verify_batch_t* batch)
+{
+  verify_job_t* first = batch->head;
+
+  while (first) {
+    if (first->verified) {
+      first = first->next;
+      continue;
+    }
+
+    int length = strlen("ssum");
+    verify_job_t* end = first;
+    while (end) {
+      if (!end->verified) {
+	int needed = strlen(end->remotePath) + 3;
+	if (end != first && length + needed > VERIFY_MAX_COMMAND) {
+	  break;
+	}
+	length += needed;
+      }
+      end = end->next;
+    }
+
+    verify_remoteSum(first, end);
+    first = end;
+  }
+}
+
+
+void
+verify_reconcile(verify_batch_t* batch, verify_redo_t redo)
+{
+  int verified = 0;
+
+  for (int attempt = 1; batch->head; attempt++) {
+    // the amiga sums its copies while the pool is still hashing ours
+    uint64_t start = report_start();
+    verify_remoteSums(batch);
+
+    pthread_mutex_lock(&verify_mutex);
+    for (verify_job_t* job = batch->head; job; job = job->next) {
+      while (!job->verified && !job->hashed) {
+	pthread_cond_wait(&verify_doneCond, &verify_mutex);
+      }
+    }
+    pthread_mutex_unlock(&verify_mutex);
+    report_phase(REPORT_PHASE_HASH, start);
+
+    int mismatches = 0;
+    for (verify_job_t* job = batch->head; job; job = job->next) {
+      if (job->verified) {
+	continue;
+      }
+      if (!job->localError && !job->remoteError && job->localCrc == job->remoteCrc) {
+	job->verified = 1;
+	verified++;
+	report_files(REPORT_FILES_VERIFIED, job->bytes);
+      } else {
+	mismatches++;
+      }
+    }
+
+    if (!mismatches) {
+      break;
+    }
+
+    for (verify_job_t* job = batch->head; job; job = job->next) {
+      if (job->verified) {
+	continue;
+      }
+      if (attempt == VERIFY_MAX_ATTEMPTS) {
+	fatalError("CRC32 verification failed for %s after %d attempts", job->remotePath, VERIFY_MAX_ATTEMPTS);
+      }
+      printf("\xE2\x9D\x8C CRC32 mismatch for %s - retrying (attempt %d/%d)\n", job->remotePath, attempt + 1, VERIFY_MAX_ATTEMPTS); // Red X mark
+      report_files(REPORT_FILES_RETRIED, job->bytes);
+      redo(job->localName, job->remotePath, job->data);
+      verify_hash(job);
+    }
+  }
+
+  if (verified) {
+    printf("\xE2\x9C\x85 %s %s CRC32 verified\n", util_formatNumber(verified), verified == 1 ? "file" : "files"); // utf-8 tick
+  }
+
+  verify_batch_t** ptr = &verify_batches;
+  while (*ptr != batch) {
+    ptr = &(*ptr)->next;
+  }
+  *ptr = batch->next;
+  verify_freeBatch(batch);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+typedef struct verify_batch verify_batch_t;
+
+// called from verify_reconcile to transfer a file again after a crc mismatch
+typedef void (*verify_redo_t)(const char* localName, const char* remotePath, void* data);
+
+verify_batch_t*
+verify_newBatch(void);
+
+void
+verify_queue(verify_batch_t* batch, int dirFd, const char* localName, const char* remotePath, void* data);
+
+void
+verify_reconcile(verify_batch_t* batch, verify_redo_t redo);
+
+void
+verify_cleanup(void);